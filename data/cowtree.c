@@ -0,0 +1,837 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "cowtree.h"
+
+#include <stdint.h>
+
+#if defined _WIN32
+    #include <windows.h>
+#else
+    #include <sched.h>
+#endif
+
+
+/* Memory ordering primitives (see HTABLE_CONC in htable.c). Additionally, the
+ * snapshots' reference counters need atomic increment and decrement. */
+#if defined __GNUC__
+    #define COWTREE_LOAD_ACQUIRE(dst, ptr)  do { (dst) = __atomic_load_n((ptr), __ATOMIC_ACQUIRE); } while(0)
+    #define COWTREE_STORE_RELEASE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+    #define COWTREE_FULL_BARRIER()          __atomic_thread_fence(__ATOMIC_SEQ_CST)
+    #define COWTREE_ATOMIC_INC(ptr)         ((void) __atomic_add_fetch((ptr), 1, __ATOMIC_RELAXED))
+    #define COWTREE_ATOMIC_DEC(ptr)         ((void) __atomic_sub_fetch((ptr), 1, __ATOMIC_RELEASE))
+#elif defined _MSC_VER
+    #if defined _M_IX86  ||  defined _M_X64  ||  defined _M_AMD64
+        #define COWTREE_ORDER_BARRIER__()   _ReadWriteBarrier()
+    #else
+        #define COWTREE_ORDER_BARRIER__()   MemoryBarrier()
+    #endif
+    #define COWTREE_LOAD_ACQUIRE(dst, ptr)  do { (dst) = *(ptr); COWTREE_ORDER_BARRIER__(); } while(0)
+    #define COWTREE_STORE_RELEASE(ptr, val) do { COWTREE_ORDER_BARRIER__(); *(ptr) = (val); } while(0)
+    #define COWTREE_FULL_BARRIER()          MemoryBarrier()
+    #define COWTREE_ATOMIC_INC(ptr)         ((void) InterlockedIncrement((ptr)))
+    #define COWTREE_ATOMIC_DEC(ptr)         ((void) InterlockedDecrement((ptr)))
+#else
+    #define COWTREE_LOAD_ACQUIRE(dst, ptr)  do { (dst) = *(ptr); } while(0)
+    #define COWTREE_STORE_RELEASE(ptr, val) do { *(ptr) = (val); } while(0)
+    #define COWTREE_FULL_BARRIER()          do { } while(0)
+    #define COWTREE_ATOMIC_INC(ptr)         ((void) ++(*(ptr)))
+    #define COWTREE_ATOMIC_DEC(ptr)         ((void) --(*(ptr)))
+#endif
+
+
+/* Nodes are shared between the versions of the tree, so they are reference
+ * counted: refs is the count of the parent nodes (or the versions, for the
+ * root) pointing to the node. Only the writer ever touches it.
+ *
+ * A node with refs == 1 is reachable only from the working version (its
+ * parent, if any, being exclusive too), so the writer may recycle it in place
+ * instead of copying it. */
+struct COWTREE_NODE {
+    COWTREE_NODE* left;
+    COWTREE_NODE* right;
+    COWTREE_ITEM* item;
+    unsigned refs;
+    unsigned red;
+};
+
+struct COWTREE_SNAPSHOT {
+    COWTREE_NODE* root;
+    size_t n;
+    long refs;                      /* Modified atomically by readers. */
+    COWTREE_SNAPSHOT* next;         /* Link in the list of retired versions. */
+};
+
+#define COWTREE_CACHELINE               64
+
+struct COWTREE_READER {
+    unsigned long epoch;
+    char padding[COWTREE_CACHELINE - sizeof(unsigned long)];
+};
+
+/* calloc() does not align to the cache line, so we allocate one extra line
+ * and round the pointer up. The original pointer is stored right before the
+ * aligned array, so that we can free it. */
+static COWTREE_READER*
+cowtree_alloc_readers(unsigned n_readers)
+{
+    char* block;
+    char* readers;
+
+    block = (char*) calloc((size_t) n_readers + 1, sizeof(COWTREE_READER));
+    if(block == NULL)
+        return NULL;
+
+    readers = (char*) (((uintptr_t) block + sizeof(void*) + COWTREE_CACHELINE - 1) &
+                       ~(uintptr_t) (COWTREE_CACHELINE - 1));
+    ((void**) readers)[-1] = block;
+    return (COWTREE_READER*) readers;
+}
+
+static void
+cowtree_free_readers(COWTREE_READER* readers)
+{
+    if(readers != NULL)
+        free(((void**) readers)[-1]);
+}
+
+
+#define IS_RED(node)            ((node) != NULL  &&  (node)->red)
+#define IS_BLACK(node)          ((node) != NULL  &&  !(node)->red)
+
+/* Max. height of the tree. (See RBTREE_CURSOR.) */
+#define COWTREE_MAX_HEIGHT      (2 * 8 * sizeof(void*))
+
+
+/* Ownership conventions of the modification code below: Every pointer to a
+ * node it passes around represents one reference (which is consumed when the
+ * node is linked into a new parent or released).
+ *
+ * The algorithms are the functional red-black insertion and deletion as known
+ * from S. Kahrs, "Red-black trees with types" (J. Functional Programming,
+ * 2001), where every "pattern match" is cowtree_take() and every constructor
+ * is cowtree_make(). */
+
+typedef struct COWTREE_PARTS {
+    COWTREE_NODE* left;
+    COWTREE_ITEM* item;
+    COWTREE_NODE* right;
+} COWTREE_PARTS;
+
+static void
+cowtree_item_release(COWTREE* tree, COWTREE_ITEM* item)
+{
+    item->refs--;
+    if(item->refs == 0  &&  tree->dtor_func != NULL)
+        tree->dtor_func(item);
+}
+
+static void
+cowtree_node_release(COWTREE* tree, COWTREE_NODE* node)
+{
+    while(node != NULL) {
+        COWTREE_NODE* right;
+
+        node->refs--;
+        if(node->refs > 0)
+            return;
+
+        cowtree_node_release(tree, node->left);
+        cowtree_item_release(tree, node->item);
+        right = node->right;
+        free(node);
+        node = right;
+    }
+}
+
+/* Disassemble the node into its parts. If the node is exclusive, it is moved
+ * into the spare nodes (to be reused by a subsequent cowtree_make()), and its
+ * references are moved into the parts. Otherwise new references are made. */
+static void
+cowtree_take(COWTREE* tree, COWTREE_NODE* node, COWTREE_PARTS* parts)
+{
+    parts->left = node->left;
+    parts->item = node->item;
+    parts->right = node->right;
+
+    if(node->refs == 1) {
+        node->left = tree->spare;
+        tree->spare = node;
+        tree->n_spare++;
+    } else {
+        node->refs--;
+        if(parts->left != NULL)
+            parts->left->refs++;
+        if(parts->right != NULL)
+            parts->right->refs++;
+        parts->item->refs++;
+    }
+}
+
+/* The spare nodes are allocated in advance (see cowtree_reserve()), so this
+ * never fails. */
+static COWTREE_NODE*
+cowtree_make(COWTREE* tree, unsigned red, COWTREE_NODE* left, COWTREE_ITEM* item,
+             COWTREE_NODE* right)
+{
+    COWTREE_NODE* node = tree->spare;
+
+    tree->spare = node->left;
+    tree->n_spare--;
+
+    node->left = left;
+    node->right = right;
+    node->item = item;
+    node->refs = 1;
+    node->red = red;
+    return node;
+}
+
+/* Make sure there are enough spare nodes for a modification of the working
+ * version. A single insertion or removal does at most 7 cowtree_make() calls
+ * per tree level (the worst being cowtree_append() falling back to
+ * cowtree_balance_left()), and the height of a red-black tree is at most twice
+ * its black height.
+ *
+ * Every exclusive node disassembled by cowtree_take() lands in the spare
+ * nodes too, and a removal takes one node more than it makes. So we also free
+ * the surplus here, otherwise the spare nodes would keep the peak size of the
+ * tree forever. */
+static int
+cowtree_reserve(COWTREE* tree)
+{
+    COWTREE_NODE* node;
+    size_t height = 1;
+    size_t needed;
+
+    for(node = tree->root; node != NULL; node = node->left) {
+        if(!node->red)
+            height += 2;
+    }
+    needed = 8 * (height + 2);
+
+    while(tree->n_spare < needed) {
+        node = (COWTREE_NODE*) malloc(sizeof(COWTREE_NODE));
+        if(node == NULL)
+            return -1;
+        node->left = tree->spare;
+        tree->spare = node;
+        tree->n_spare++;
+    }
+
+    while(tree->n_spare > needed) {
+        node = tree->spare;
+        tree->spare = node->left;
+        tree->n_spare--;
+        free(node);
+    }
+    return 0;
+}
+
+static COWTREE_NODE*
+cowtree_balance(COWTREE* tree, COWTREE_NODE* left, COWTREE_ITEM* item, COWTREE_NODE* right)
+{
+    COWTREE_PARTS a, b;
+
+    if(IS_RED(left)  &&  IS_RED(right)) {
+        cowtree_take(tree, left, &a);
+        cowtree_take(tree, right, &b);
+        return cowtree_make(tree, 1, cowtree_make(tree, 0, a.left, a.item, a.right), item,
+                                     cowtree_make(tree, 0, b.left, b.item, b.right));
+    }
+
+    if(IS_RED(left)  &&  IS_RED(left->left)) {
+        cowtree_take(tree, left, &a);
+        cowtree_take(tree, a.left, &b);
+        return cowtree_make(tree, 1, cowtree_make(tree, 0, b.left, b.item, b.right), a.item,
+                                     cowtree_make(tree, 0, a.right, item, right));
+    }
+
+    if(IS_RED(left)  &&  IS_RED(left->right)) {
+        cowtree_take(tree, left, &a);
+        cowtree_take(tree, a.right, &b);
+        return cowtree_make(tree, 1, cowtree_make(tree, 0, a.left, a.item, b.left), b.item,
+                                     cowtree_make(tree, 0, b.right, item, right));
+    }
+
+    if(IS_RED(right)  &&  IS_RED(right->right)) {
+        cowtree_take(tree, right, &a);
+        cowtree_take(tree, a.right, &b);
+        return cowtree_make(tree, 1, cowtree_make(tree, 0, left, item, a.left), a.item,
+                                     cowtree_make(tree, 0, b.left, b.item, b.right));
+    }
+
+    if(IS_RED(right)  &&  IS_RED(right->left)) {
+        cowtree_take(tree, right, &a);
+        cowtree_take(tree, a.left, &b);
+        return cowtree_make(tree, 1, cowtree_make(tree, 0, left, item, b.left), b.item,
+                                     cowtree_make(tree, 0, b.right, a.item, a.right));
+    }
+
+    return cowtree_make(tree, 0, left, item, right);
+}
+
+/* Descend from the root towards the key, remembering the result of the
+ * comparison at every level, so that the subsequent modification does not
+ * need to call the comparator again. Returns the count of visited nodes; the
+ * key is present in the tree if the last stored result is zero. */
+static unsigned
+cowtree_find_path(const COWTREE_NODE* node, const COWTREE_ITEM* key,
+                  COWTREE_CMP_FUNC cmp_func, signed char* dirs)
+{
+    unsigned n = 0;
+    int cmp;
+
+    while(node != NULL) {
+        cmp = cmp_func(key, node->item);
+        if(cmp < 0) {
+            dirs[n++] = -1;
+            node = node->left;
+        } else if(cmp > 0) {
+            dirs[n++] = +1;
+            node = node->right;
+        } else {
+            dirs[n++] = 0;
+            break;
+        }
+    }
+
+    return n;
+}
+
+static COWTREE_NODE*
+cowtree_ins(COWTREE* tree, COWTREE_NODE* node, COWTREE_ITEM* item, const signed char* dirs)
+{
+    COWTREE_PARTS p;
+    unsigned red;
+
+    if(node == NULL)
+        return cowtree_make(tree, 1, NULL, item, NULL);
+
+    red = node->red;
+    cowtree_take(tree, node, &p);
+    if(*dirs < 0)
+        p.left = cowtree_ins(tree, p.left, item, dirs + 1);
+    else
+        p.right = cowtree_ins(tree, p.right, item, dirs + 1);
+
+    if(red)
+        return cowtree_make(tree, 1, p.left, p.item, p.right);
+    else
+        return cowtree_balance(tree, p.left, p.item, p.right);
+}
+
+/* Turn a black node into a red one. */
+static COWTREE_NODE*
+cowtree_redden(COWTREE* tree, COWTREE_NODE* node)
+{
+    COWTREE_PARTS p;
+
+    cowtree_take(tree, node, &p);
+    return cowtree_make(tree, 1, p.left, p.item, p.right);
+}
+
+/* Re-balance after the black height of the left subtree has decreased. */
+static COWTREE_NODE*
+cowtree_balance_left(COWTREE* tree, COWTREE_NODE* left, COWTREE_ITEM* item, COWTREE_NODE* right)
+{
+    COWTREE_PARTS a, b;
+
+    if(IS_RED(left)) {
+        cowtree_take(tree, left, &a);
+        return cowtree_make(tree, 1, cowtree_make(tree, 0, a.left, a.item, a.right), item, right);
+    }
+
+    if(IS_BLACK(right))
+        return cowtree_balance(tree, left, item, cowtree_redden(tree, right));
+
+    /* Here the right is red with a black left child. */
+    cowtree_take(tree, right, &a);
+    cowtree_take(tree, a.left, &b);
+    return cowtree_make(tree, 1, cowtree_make(tree, 0, left, item, b.left), b.item,
+                        cowtree_balance(tree, b.right, a.item, cowtree_redden(tree, a.right)));
+}
+
+/* Re-balance after the black height of the right subtree has decreased. */
+static COWTREE_NODE*
+cowtree_balance_right(COWTREE* tree, COWTREE_NODE* left, COWTREE_ITEM* item, COWTREE_NODE* right)
+{
+    COWTREE_PARTS a, b;
+
+    if(IS_RED(right)) {
+        cowtree_take(tree, right, &a);
+        return cowtree_make(tree, 1, left, item, cowtree_make(tree, 0, a.left, a.item, a.right));
+    }
+
+    if(IS_BLACK(left))
+        return cowtree_balance(tree, cowtree_redden(tree, left), item, right);
+
+    /* Here the left is red with a black right child. */
+    cowtree_take(tree, left, &a);
+    cowtree_take(tree, a.right, &b);
+    return cowtree_make(tree, 1, cowtree_balance(tree, cowtree_redden(tree, a.left), a.item, b.left),
+                        b.item, cowtree_make(tree, 0, b.right, item, right));
+}
+
+/* Glue two subtrees (of the same black height) of a removed node together. */
+static COWTREE_NODE*
+cowtree_append(COWTREE* tree, COWTREE_NODE* left, COWTREE_NODE* right)
+{
+    COWTREE_PARTS a, b, c;
+    COWTREE_NODE* middle;
+    unsigned red;
+
+    if(left == NULL)
+        return right;
+    if(right == NULL)
+        return left;
+
+    if(!left->red  &&  right->red) {
+        cowtree_take(tree, right, &b);
+        return cowtree_make(tree, 1, cowtree_append(tree, left, b.left), b.item, b.right);
+    }
+    if(left->red  &&  !right->red) {
+        cowtree_take(tree, left, &a);
+        return cowtree_make(tree, 1, a.left, a.item, cowtree_append(tree, a.right, right));
+    }
+
+    /* Both are of the same color. */
+    red = left->red;
+    cowtree_take(tree, left, &a);
+    cowtree_take(tree, right, &b);
+    middle = cowtree_append(tree, a.right, b.left);
+    if(IS_RED(middle)) {
+        cowtree_take(tree, middle, &c);
+        return cowtree_make(tree, 1, cowtree_make(tree, red, a.left, a.item, c.left), c.item,
+                                     cowtree_make(tree, red, c.right, b.item, b.right));
+    }
+
+    if(red)
+        return cowtree_make(tree, 1, a.left, a.item, cowtree_make(tree, 1, middle, b.item, b.right));
+    else
+        return cowtree_balance_left(tree, a.left, a.item, cowtree_make(tree, 0, middle, b.item, b.right));
+}
+
+/* Remove the item from the subtree, following the path as recorded by
+ * cowtree_find_path(). The item has to be present there. If the node is
+ * black, black height of the resulting subtree is lower by one (and it may
+ * have a red root). */
+static COWTREE_NODE*
+cowtree_del(COWTREE* tree, COWTREE_NODE* node, const signed char* dirs)
+{
+    COWTREE_PARTS p;
+
+    cowtree_take(tree, node, &p);
+
+    if(*dirs < 0) {
+        if(IS_BLACK(p.left))
+            return cowtree_balance_left(tree, cowtree_del(tree, p.left, dirs + 1), p.item, p.right);
+        else
+            return cowtree_make(tree, 1, cowtree_del(tree, p.left, dirs + 1), p.item, p.right);
+    } else if(*dirs > 0) {
+        if(IS_BLACK(p.right))
+            return cowtree_balance_right(tree, p.left, p.item, cowtree_del(tree, p.right, dirs + 1));
+        else
+            return cowtree_make(tree, 1, p.left, p.item, cowtree_del(tree, p.right, dirs + 1));
+    } else {
+        cowtree_item_release(tree, p.item);
+        return cowtree_append(tree, p.left, p.right);
+    }
+}
+
+/* Make the root black. */
+static COWTREE_NODE*
+cowtree_blacken(COWTREE* tree, COWTREE_NODE* node)
+{
+    COWTREE_PARTS p;
+
+    if(node == NULL  ||  !node->red)
+        return node;
+
+    cowtree_take(tree, node, &p);
+    return cowtree_make(tree, 0, p.left, p.item, p.right);
+}
+
+static COWTREE_ITEM*
+cowtree_lookup_internal(const COWTREE_NODE* node, const COWTREE_ITEM* key,
+                        COWTREE_CMP_FUNC cmp_func)
+{
+    int cmp;
+
+    while(node != NULL) {
+        cmp = cmp_func(key, node->item);
+        if(cmp < 0)
+            node = node->left;
+        else if(cmp > 0)
+            node = node->right;
+        else
+            return node->item;
+    }
+
+    return NULL;
+}
+
+int
+cowtree_insert(COWTREE* tree, COWTREE_ITEM* item, COWTREE_CMP_FUNC cmp_func)
+{
+    signed char dirs[COWTREE_MAX_HEIGHT];
+    unsigned n;
+
+    n = cowtree_find_path(tree->root, item, cmp_func, dirs);
+    if(n > 0  &&  dirs[n - 1] == 0)
+        return -1;
+    if(cowtree_reserve(tree) != 0)
+        return -1;
+
+    item->refs = 1;
+    tree->root = cowtree_blacken(tree, cowtree_ins(tree, tree->root, item, dirs));
+    tree->n++;
+    return 0;
+}
+
+int
+cowtree_remove(COWTREE* tree, const COWTREE_ITEM* key, COWTREE_CMP_FUNC cmp_func)
+{
+    signed char dirs[COWTREE_MAX_HEIGHT];
+    unsigned n;
+
+    n = cowtree_find_path(tree->root, key, cmp_func, dirs);
+    if(n == 0  ||  dirs[n - 1] != 0)
+        return -1;
+    if(cowtree_reserve(tree) != 0)
+        return -1;
+
+    tree->root = cowtree_blacken(tree, cowtree_del(tree, tree->root, dirs));
+    tree->n--;
+    return 0;
+}
+
+COWTREE_ITEM*
+cowtree_lookup_working(COWTREE* tree, const COWTREE_ITEM* key, COWTREE_CMP_FUNC cmp_func)
+{
+    return cowtree_lookup_internal(tree->root, key, cmp_func);
+}
+
+
+/* Versions and their reclamation. */
+
+static void
+cowtree_yield(void)
+{
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+static COWTREE_SNAPSHOT*
+cowtree_snapshot(COWTREE* tree)
+{
+    COWTREE_SNAPSHOT* snapshot;
+
+    snapshot = (COWTREE_SNAPSHOT*) malloc(sizeof(COWTREE_SNAPSHOT));
+    if(snapshot == NULL)
+        return NULL;
+
+    snapshot->root = tree->root;
+    if(snapshot->root != NULL)
+        snapshot->root->refs++;
+    snapshot->n = tree->n;
+    snapshot->refs = 1;     /* The reference of the tree, as long as it is published. */
+    snapshot->next = NULL;
+    return snapshot;
+}
+
+static void
+cowtree_snapshot_free(COWTREE* tree, COWTREE_SNAPSHOT* snapshot)
+{
+    cowtree_node_release(tree, snapshot->root);
+    free(snapshot);
+}
+
+/* Wait until all read-side sections, which are in progress at the time of
+ * the call, end. (The same as htable_conc_synchronize().) */
+static void
+cowtree_synchronize(COWTREE* tree)
+{
+    unsigned long epoch;
+    unsigned i;
+
+    epoch = tree->epoch + 1;
+    if(epoch == 0)
+        epoch = 1;
+    COWTREE_STORE_RELEASE(&tree->epoch, epoch);
+    COWTREE_FULL_BARRIER();
+
+    for(i = 0; i < tree->n_readers; i++) {
+        while(1) {
+            unsigned long reader_epoch;
+
+            COWTREE_LOAD_ACQUIRE(reader_epoch, &tree->readers[i].epoch);
+            if(reader_epoch == 0  ||  reader_epoch == epoch)
+                break;
+            cowtree_yield();
+        }
+    }
+}
+
+void
+cowtree_collect(COWTREE* tree)
+{
+    COWTREE_SNAPSHOT** p_snapshot;
+    long refs;
+    int any_unused = 0;
+
+    for(p_snapshot = &tree->retired; *p_snapshot != NULL; p_snapshot = &(*p_snapshot)->next) {
+        COWTREE_LOAD_ACQUIRE(refs, &(*p_snapshot)->refs);
+        if(refs == 0) {
+            any_unused = 1;
+            break;
+        }
+    }
+    if(!any_unused)
+        return;
+
+    /* A reader may have picked up a retired version just before it has been
+     * replaced, and not yet announced its use of it. Wait for such readers,
+     * and only then trust the reference counters. */
+    cowtree_synchronize(tree);
+
+    p_snapshot = &tree->retired;
+    while(*p_snapshot != NULL) {
+        COWTREE_SNAPSHOT* snapshot = *p_snapshot;
+
+        COWTREE_LOAD_ACQUIRE(refs, &snapshot->refs);
+        if(refs == 0) {
+            *p_snapshot = snapshot->next;
+            cowtree_snapshot_free(tree, snapshot);
+        } else {
+            p_snapshot = &snapshot->next;
+        }
+    }
+}
+
+int
+cowtree_publish(COWTREE* tree)
+{
+    COWTREE_SNAPSHOT* snapshot;
+    COWTREE_SNAPSHOT* old_snapshot = tree->current;
+
+    snapshot = cowtree_snapshot(tree);
+    if(snapshot == NULL)
+        return -1;
+
+    COWTREE_STORE_RELEASE(&tree->current, snapshot);
+
+    COWTREE_ATOMIC_DEC(&old_snapshot->refs);
+    old_snapshot->next = tree->retired;
+    tree->retired = old_snapshot;
+
+    cowtree_collect(tree);
+    return 0;
+}
+
+int
+cowtree_init(COWTREE* tree, unsigned n_readers, void (*dtor_func)(COWTREE_ITEM*))
+{
+    tree->readers = cowtree_alloc_readers((n_readers > 0) ? n_readers : 1);
+    if(tree->readers == NULL)
+        return -1;
+
+    tree->root = NULL;
+    tree->n = 0;
+    tree->retired = NULL;
+    tree->spare = NULL;
+    tree->n_spare = 0;
+    tree->n_readers = n_readers;
+    tree->epoch = 1;
+    tree->dtor_func = dtor_func;
+
+    tree->current = cowtree_snapshot(tree);
+    if(tree->current == NULL) {
+        cowtree_free_readers(tree->readers);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+cowtree_fini(COWTREE* tree)
+{
+    COWTREE_NODE* node;
+
+    while(tree->retired != NULL) {
+        COWTREE_SNAPSHOT* snapshot = tree->retired;
+
+        tree->retired = snapshot->next;
+        cowtree_snapshot_free(tree, snapshot);
+    }
+    cowtree_snapshot_free(tree, tree->current);
+    cowtree_node_release(tree, tree->root);
+
+    while(tree->spare != NULL) {
+        node = tree->spare;
+        tree->spare = node->left;
+        free(node);
+    }
+
+    cowtree_free_readers(tree->readers);
+
+    tree->root = NULL;
+    tree->n = 0;
+    tree->current = NULL;
+    tree->n_spare = 0;
+    tree->readers = NULL;
+    tree->n_readers = 0;
+}
+
+
+/* Reader operations. */
+
+const COWTREE_SNAPSHOT*
+cowtree_read_begin(COWTREE* tree, unsigned reader)
+{
+    unsigned long epoch;
+    COWTREE_SNAPSHOT* snapshot;
+
+    COWTREE_LOAD_ACQUIRE(epoch, &tree->epoch);
+    COWTREE_STORE_RELEASE(&tree->readers[reader].epoch, epoch);
+
+    /* Make sure the writer either sees our announcement, or we see the version
+     * it has published before it started waiting for the readers. */
+    COWTREE_FULL_BARRIER();
+
+    COWTREE_LOAD_ACQUIRE(snapshot, &tree->current);
+    return snapshot;
+}
+
+void
+cowtree_read_end(COWTREE* tree, unsigned reader)
+{
+    COWTREE_STORE_RELEASE(&tree->readers[reader].epoch, 0);
+}
+
+const COWTREE_SNAPSHOT*
+cowtree_acquire(COWTREE* tree, unsigned reader)
+{
+    COWTREE_SNAPSHOT* snapshot;
+
+    snapshot = (COWTREE_SNAPSHOT*) cowtree_read_begin(tree, reader);
+    COWTREE_ATOMIC_INC(&snapshot->refs);
+    cowtree_read_end(tree, reader);
+    return snapshot;
+}
+
+void
+cowtree_release(const COWTREE_SNAPSHOT* snapshot)
+{
+    COWTREE_ATOMIC_DEC(&((COWTREE_SNAPSHOT*) snapshot)->refs);
+}
+
+size_t
+cowtree_size(const COWTREE_SNAPSHOT* snapshot)
+{
+    return snapshot->n;
+}
+
+COWTREE_ITEM*
+cowtree_lookup(const COWTREE_SNAPSHOT* snapshot, const COWTREE_ITEM* key,
+               COWTREE_CMP_FUNC cmp_func)
+{
+    return cowtree_lookup_internal(snapshot->root, key, cmp_func);
+}
+
+static void
+cowtree_leftmost_path(const COWTREE_NODE* node, COWTREE_CURSOR* cur)
+{
+    while(node != NULL) {
+        cur->stack[cur->n++] = node;
+        node = node->left;
+    }
+}
+
+COWTREE_ITEM*
+cowtree_head(const COWTREE_SNAPSHOT* snapshot, COWTREE_CURSOR* cur)
+{
+    cur->n = 0;
+    cowtree_leftmost_path(snapshot->root, cur);
+    return (cur->n > 0) ? cur->stack[cur->n - 1]->item : NULL;
+}
+
+COWTREE_ITEM*
+cowtree_next(COWTREE_CURSOR* cur)
+{
+    const COWTREE_NODE* node;
+
+    /* Nodes have no parent pointers (they may have many parents), so the
+     * cursor stack keeps only the nodes still to be visited. */
+    if(cur->n == 0)
+        return NULL;
+
+    node = cur->stack[--cur->n];
+    cowtree_leftmost_path(node->right, cur);
+    return (cur->n > 0) ? cur->stack[cur->n - 1]->item : NULL;
+}
+
+
+#ifdef CRE_TEST
+/* Verification of the tree correctness. Returns black height of the subtree,
+ * or -1 on an error. */
+static int
+cowtree_verify_recurse(const COWTREE_NODE* node, COWTREE_CMP_FUNC cmp_func)
+{
+    int left_height, right_height;
+
+    if(node == NULL)
+        return 1;
+
+    if(node->refs == 0  ||  node->item->refs == 0)
+        return -1;
+    if(node->red  &&  (IS_RED(node->left)  ||  IS_RED(node->right)))
+        return -1;
+    if(node->left != NULL  &&  cmp_func(node->left->item, node->item) >= 0)
+        return -1;
+    if(node->right != NULL  &&  cmp_func(node->right->item, node->item) <= 0)
+        return -1;
+
+    left_height = cowtree_verify_recurse(node->left, cmp_func);
+    right_height = cowtree_verify_recurse(node->right, cmp_func);
+    if(left_height < 0  ||  left_height != right_height)
+        return -1;
+
+    return left_height + (node->red ? 0 : 1);
+}
+
+/* Returns 0 if ok, or -1 on an error. */
+int
+cowtree_verify(const COWTREE_SNAPSHOT* snapshot, COWTREE_CMP_FUNC cmp_func)
+{
+    if(IS_RED(snapshot->root))
+        return -1;
+    return (cowtree_verify_recurse(snapshot->root, cmp_func) >= 0) ? 0 : -1;
+}
+#endif  /* #ifdef CRE_TEST */
@@ -0,0 +1,241 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef CRE_COWTREE_H
+#define CRE_COWTREE_H
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#if defined __cplusplus
+    #define COWTREE_INLINE__    inline
+#elif defined __STDC_VERSION__ && __STDC_VERSION__ >= 199901L
+    #define COWTREE_INLINE__    static inline
+#elif defined __GNUC__
+    #define COWTREE_INLINE__    static __inline__
+#elif defined _MSC_VER
+    #define COWTREE_INLINE__    static __inline
+#else
+    #define COWTREE_INLINE__    static
+#endif
+
+#if defined offsetof
+    #define COWTREE_OFFSETOF__(type, member)    offsetof(type, member)
+#elif defined __GNUC__ && __GNUC__ >= 4
+    #define COWTREE_OFFSETOF__(type, member)    __builtin_offsetof(type, member)
+#else
+    #define COWTREE_OFFSETOF__(type, member)    ((size_t) &((type*)0)->member)
+#endif
+
+
+/* COWTREE is a persistent (copy-on-write) red-black tree with lock-free
+ * readers.
+ *
+ * Unlike RBTREE, the tree nodes are allocated by the tree itself: Every
+ * modification copies the nodes on the path from the root to the modified
+ * place (and few more touched by re-balancing), while all the untouched
+ * subtrees are shared with the older versions of the tree. Therefore older
+ * versions of the tree remain intact and they may be still read by other
+ * threads.
+ *
+ * The application data are represented by COWTREE_ITEM, embedded in the
+ * application's own structure (use COWTREE_DATA to get to it). As the item
+ * may be referred by many versions of the tree, it is owned by the tree since
+ * it is inserted and the tree calls the destructor function (as passed to
+ * cowtree_init()) once the item is not reachable by any version.
+ *
+ * The writer (all the modifications have to be serialized by the caller, e.g.
+ * by a mutex) works on a private working version of the tree. A call to
+ * cowtree_publish() makes the working version visible to the readers: That
+ * is a single atomic pointer store, so multiple modifications may be
+ * published at once.
+ *
+ * Readers access the published version (COWTREE_SNAPSHOT) without taking any
+ * lock, in one of two ways:
+ *
+ * - Within a read-side section, delimited by cowtree_read_begin() and
+ *   cowtree_read_end(). Each reading thread has to use its own reader index,
+ *   lower than n_readers passed to cowtree_init(). The snapshot stays valid
+ *   until the section ends. The sections should be kept short, as the writer
+ *   waits for them when reclaiming old versions.
+ *
+ * - By cowtree_acquire() and cowtree_release(), which make the snapshot valid
+ *   for as long as needed. This costs an atomic increment and decrement of the
+ *   snapshot's reference counter.
+ *
+ * Memory of the old versions is reclaimed by the writer (in cowtree_publish()
+ * and cowtree_collect()), once they are not published anymore and no reader
+ * may be using them.
+ */
+
+
+/* Item structure. Treat as opaque.
+ */
+typedef struct COWTREE_ITEM {
+    unsigned long refs;
+} COWTREE_ITEM;
+
+typedef struct COWTREE_NODE COWTREE_NODE;
+typedef struct COWTREE_SNAPSHOT COWTREE_SNAPSHOT;
+typedef struct COWTREE_READER COWTREE_READER;
+
+
+/* Tree structure. Treat as opaque.
+ */
+typedef struct COWTREE {
+    COWTREE_NODE* root;             /* The working version. */
+    size_t n;
+    COWTREE_SNAPSHOT* current;      /* The published version. */
+    COWTREE_SNAPSHOT* retired;      /* Older versions, waiting for reclamation. */
+    COWTREE_NODE* spare;
+    size_t n_spare;
+    COWTREE_READER* readers;
+    unsigned n_readers;
+    unsigned long epoch;
+    void (*dtor_func)(COWTREE_ITEM*);
+} COWTREE;
+
+
+/* Comparator function type. See RBTREE_CMP_FUNC.
+ */
+typedef int (*COWTREE_CMP_FUNC)(const COWTREE_ITEM*, const COWTREE_ITEM*);
+
+
+/* Macro for getting pointer to the structure holding the item.
+ */
+#define COWTREE_DATA(item_ptr, type, member)    \
+                ((type*)((char*)(item_ptr) - COWTREE_OFFSETOF__(type, member)))
+
+
+/* Initialize the tree for use by up to n_readers concurrent reading threads.
+ * The destructor function (may be NULL) is called for every item which is
+ * not reachable by any version of the tree anymore.
+ *
+ * Returns 0 on success or -1 on failure.
+ */
+int cowtree_init(COWTREE* tree, unsigned n_readers, void (*dtor_func)(COWTREE_ITEM*));
+
+/* Destroy the tree, including all its versions and items. It must not run
+ * concurrently with any other operation on the tree and all the acquired
+ * snapshots have to be released before.
+ */
+void cowtree_fini(COWTREE* tree);
+
+
+/* Writer operations. They work with the working version of the tree and the
+ * calls have to be serialized by the caller.
+ *
+ * cowtree_insert() returns 0 on success, or -1 on failure (if an equal item
+ * is already present in the working version, or on a memory allocation
+ * failure). On failure, the item remains owned by the caller.
+ *
+ * cowtree_remove() removes the item equal to the key. Returns 0 on success,
+ * or -1 if there is no such item (or on a memory allocation failure). The
+ * removed item may still be in use by older versions of the tree, so it is
+ * only released later, via the destructor function.
+ *
+ * cowtree_lookup_working() finds the item equal to the key in the working
+ * version (or returns NULL).
+ */
+int cowtree_insert(COWTREE* tree, COWTREE_ITEM* item, COWTREE_CMP_FUNC cmp_func);
+int cowtree_remove(COWTREE* tree, const COWTREE_ITEM* key, COWTREE_CMP_FUNC cmp_func);
+COWTREE_ITEM* cowtree_lookup_working(COWTREE* tree, const COWTREE_ITEM* key,
+                                     COWTREE_CMP_FUNC cmp_func);
+
+/* Count of items in the working version. */
+COWTREE_INLINE__ size_t cowtree_size_working(const COWTREE* tree)
+        { return tree->n; }
+
+/* Publish the working version to the readers, and reclaim the older versions
+ * which are not used anymore.
+ *
+ * Returns 0 on success or -1 on a memory allocation failure (then the
+ * published version is not changed).
+ */
+int cowtree_publish(COWTREE* tree);
+
+/* Reclaim the older versions which are not used anymore. (cowtree_publish()
+ * does that on its own; this is useful when the writer is idle for a long
+ * time while readers release their snapshots.)
+ */
+void cowtree_collect(COWTREE* tree);
+
+
+/* Reader operations.
+ *
+ * cowtree_read_begin() begins a read-side section of the reader identified by
+ * the index, and returns the published version, valid until the section ends
+ * by cowtree_read_end(). The sections must not be nested.
+ *
+ * cowtree_acquire() returns the published version, valid until it is passed
+ * to cowtree_release(). The reader index has the same meaning as above, but
+ * it must not be used within a read-side section.
+ */
+const COWTREE_SNAPSHOT* cowtree_read_begin(COWTREE* tree, unsigned reader);
+void cowtree_read_end(COWTREE* tree, unsigned reader);
+const COWTREE_SNAPSHOT* cowtree_acquire(COWTREE* tree, unsigned reader);
+void cowtree_release(const COWTREE_SNAPSHOT* snapshot);
+
+
+/* Snapshot queries. They never modify anything, so they can be used by any
+ * count of threads at once.
+ *
+ * cowtree_size() returns count of items in the snapshot.
+ *
+ * cowtree_lookup() finds the item equal to the key, or returns NULL.
+ */
+size_t cowtree_size(const COWTREE_SNAPSHOT* snapshot);
+COWTREE_ITEM* cowtree_lookup(const COWTREE_SNAPSHOT* snapshot, const COWTREE_ITEM* key,
+                             COWTREE_CMP_FUNC cmp_func);
+
+
+/* Walking over all items in a snapshot, in the ascending order. The functions
+ * return NULL when reaching an end of the iteration.
+ *
+ * ```
+ * for(item = cowtree_head(snapshot, &cur); item != NULL; item = cowtree_next(&cur)) {
+ *     ...
+ * }
+ * ```
+ */
+typedef struct COWTREE_CURSOR {
+    /* See RBTREE_CURSOR. */
+    const COWTREE_NODE* stack[2 * 8 * sizeof(void*)];
+    unsigned n;
+} COWTREE_CURSOR;
+
+COWTREE_ITEM* cowtree_head(const COWTREE_SNAPSHOT* snapshot, COWTREE_CURSOR* cur);
+COWTREE_ITEM* cowtree_next(COWTREE_CURSOR* cur);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* CRE_COWTREE_H */
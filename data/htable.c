@@ -26,117 +26,415 @@
 #include "htable.h"
 
 #include <string.h>
+#include <time.h>
 
+#if defined __SSE2__  ||  defined _M_X64  ||  defined _M_AMD64  ||  \
+    (defined _M_IX86_FP  &&  _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define HTABLE_SSE2     1
+#endif
 
-#define HTABLE_PLANE_SIZE(plane_index)  (59 << (plane_index))
-#define HTABLE_SLOT_COUNT(htable)       (HTABLE_PLANE_SIZE(0) * ((1 << (htable)->n_planes) - 1))
-#define HTABLE_TOO_FULL(htable)         ((htable)->n >= HTABLE_SLOT_COUNT(htable))
-#define HTABLE_TOO_EMPTY(htable)        ((htable)->n < (HTABLE_SLOT_COUNT(htable) / 4))
+#if defined _MSC_VER
+    #include <intrin.h>
+#endif
 
+#if defined _WIN32
+    #include <windows.h>
+#else
+    #include <sched.h>
+#endif
+
+#if defined __GNUC__
+    #define HTABLE_PREFETCH(ptr)    __builtin_prefetch(ptr)
+#elif defined _MSC_VER  &&  (defined _M_IX86  ||  defined _M_X64  ||  defined _M_AMD64)
+    #define HTABLE_PREFETCH(ptr)    _mm_prefetch((const char*) (ptr), _MM_HINT_T0)
+#else
+    #define HTABLE_PREFETCH(ptr)    ((void) 0)
+#endif
+
+
+/* The table consists of so called planes, i.e. arrays of buckets, each bucket
+ * holding a chain of nodes. When the table becomes too populated, we allocate
+ * a new plane twice as large as the current one, and all new nodes then go
+ * into the new plane.
+ *
+ * Nodes from the older plane are then migrated into the new one incrementally:
+ * every insert or remove operation migrates a few buckets. As the old plane
+ * is always completely migrated long before the table needs to grow again,
+ * there are never more than two planes and lookups only very rarely need to
+ * examine more than one plane.
+ */
+#define HTABLE_MIN_PLANE_SIZE(htable)   (((htable)->flags & HTABLE_POW2PLANES) ? 64U : 59U)
+#define HTABLE_MAX_PLANE_SIZE(htable)   (HTABLE_MIN_PLANE_SIZE(htable) << 25)
+
+/* Count of buckets of the old plane migrated per each insert or remove. */
+#define HTABLE_MIGRATE_STEP             4
+
+#define HTABLE_TOO_FULL(htable)         ((htable)->n >= (htable)->plane_size)
+#define HTABLE_TOO_EMPTY(htable)                                               \
+            (!((htable)->flags & HTABLE_NOSHRINK)  &&                           \
+             (uint64_t) (htable)->n * 100 < (uint64_t) (htable)->plane_size * (htable)->shrink_percent)
+
+#ifdef CRE_HTABLE_STATS
+    #define HTABLE_COUNT(htable, counter)   ((htable)->counters.counter++)
+#else
+    #define HTABLE_COUNT(htable, counter)   ((void) 0)
+#endif
+
+/* Hash stored in the node (only if HTABLE_CACHEHASH is used). */
+#define HTABLE_NODE_HASH(node)          (((HTABLE_NODE_H*) (node))->hash)
+
+/* Index of the bucket for the hash in a plane of the given size and seed.
+ *
+ * Modulo by a size which is not a power of two takes all the bits of the hash
+ * into account. The bit mask does not, so we need to mix it first. With a
+ * non-zero seed (see HTABLE_FLOODGUARD), we always mix it, with the seed. */
+#define HTABLE_INDEX(htable, hash, seed, plane_size)                           \
+            htable_index__((htable), (hash), (seed), (plane_size))
+
+/* Index of the bucket in a plane of the given size where a bucket of any
+ * twice bigger plane (of the same seed) folds to. */
+#define HTABLE_FOLD_INDEX(htable, index, plane_size)                           \
+            (((htable)->flags & HTABLE_POW2PLANES)                             \
+                    ? ((index) & ((plane_size) - 1))                           \
+                    : ((index) % (plane_size)))
+
+/* Chains longer than this (for a table of n nodes) are treated as a symptom of
+ * hash flooding. For a decent hash function, the longest chain is expected to
+ * be roughly O(log n / log log n) long, so this is never hit by accident. */
+static unsigned
+htable_flood_threshold(size_t n)
+{
+    unsigned threshold = 8;
+
+    while(n > 0) {
+        threshold++;
+        n >>= 1;
+    }
+    return threshold;
+}
+
+
+#define htable_mix(hash)                htable_mix__(hash)
+
+
+static void
+htable_migrate(HTABLE* htable, uint32_t n_buckets, HTABLE_HASH_FUNC hash_func)
+{
+    HTABLE_NODE** old_plane = htable->old_plane;
+
+    if(old_plane == NULL)
+        return;
+
+    while(n_buckets > 0  &&  htable->migrate_index < htable->old_plane_size) {
+        HTABLE_NODE* node = old_plane[htable->migrate_index];
+
+        while(node != NULL) {
+            HTABLE_NODE* next = node->next;
+            uint32_t hash = (htable->flags & HTABLE_CACHEHASH) ? HTABLE_NODE_HASH(node) : hash_func(node);
+            uint32_t index = HTABLE_INDEX(htable, hash, htable->seed, htable->plane_size);
+
+            node->next = htable->plane[index];
+            htable->plane[index] = node;
+            node = next;
+        }
+
+        old_plane[htable->migrate_index] = NULL;
+        htable->migrate_index++;
+        n_buckets--;
+    }
+
+    if(htable->migrate_index >= htable->old_plane_size) {
+        free(old_plane);
+        htable->old_plane = NULL;
+        htable->old_plane_size = 0;
+        htable->migrate_index = 0;
+    }
+}
+
+/* Smallest plane size able to hold n nodes without growing. */
+static uint32_t
+htable_plane_size_for(const HTABLE* htable, size_t n)
+{
+    uint32_t plane_size = HTABLE_MIN_PLANE_SIZE(htable);
+
+    while(plane_size <= n  &&  plane_size < HTABLE_MAX_PLANE_SIZE(htable))
+        plane_size *= 2;
+    return plane_size;
+}
+
+/* Make the new_plane the current one. The current one becomes the old plane
+ * to be migrated. */
+static void
+htable_switch_plane(HTABLE* htable, HTABLE_NODE** new_plane, uint32_t new_plane_size,
+                    uint32_t new_seed, HTABLE_HASH_FUNC hash_func)
+{
+    /* Normally, any previous migration is long complete by now. But make sure
+     * we never end up with more than two planes. */
+    htable_migrate(htable, UINT32_MAX, hash_func);
+
+    htable->old_plane = htable->plane;
+    htable->old_plane_size = htable->plane_size;
+    htable->old_seed = htable->seed;
+    htable->migrate_index = 0;
+    htable->plane = new_plane;
+    htable->plane_size = new_plane_size;
+    htable->seed = new_seed;
+}
 
 static int
-htable_grow(HTABLE* htable)
+htable_grow(HTABLE* htable, HTABLE_HASH_FUNC hash_func)
 {
-    HTABLE_NODE** new_planes;
+    HTABLE_NODE** new_plane;
+    uint32_t new_plane_size;
 
-    /* Grow by appending one more plane, twice the size the previous one. */
-    new_planes = (HTABLE_NODE**) realloc(htable->planes, (htable->n_planes+1) * sizeof(HTABLE_NODE*));
-    if(new_planes == NULL) {
-        if(htable->n_planes > 0) {
+    if(htable->plane != NULL) {
+        if(htable->plane_size >= HTABLE_MAX_PLANE_SIZE(htable))
+            return 0;
+        new_plane_size = 2 * htable->plane_size;
+    } else {
+        new_plane_size = HTABLE_MIN_PLANE_SIZE(htable);
+    }
+
+    new_plane = (HTABLE_NODE**) calloc(new_plane_size, sizeof(HTABLE_NODE*));
+    if(new_plane == NULL) {
+        if(htable->plane != NULL) {
             /* It may be suboptimal, but we can still add the new stuff into
-             * the current planes. */
+             * the current plane. */
             return 0;
         }
         return -1;
     }
-    htable->planes = (void**) new_planes;
-
-    new_planes[htable->n_planes] = (HTABLE_NODE*) malloc(HTABLE_PLANE_SIZE(htable->n_planes) * sizeof(HTABLE_NODE*));
-    if(new_planes[htable->n_planes] == NULL)
-        return -1;
-    memset(new_planes[htable->n_planes], 0, HTABLE_PLANE_SIZE(htable->n_planes) * sizeof(HTABLE_NODE*));
-    htable->n_planes++;
 
+    htable_switch_plane(htable, new_plane, new_plane_size, htable->seed, hash_func);
+    HTABLE_COUNT(htable, n_grows);
     return 0;
 }
 
+/* Pick a new random seed and start rehashing all the nodes with it. This is
+ * not cryptographically strong, but the adversary has no way to observe the
+ * seed anyway. */
 static void
-htable_free_all_planes(HTABLE* htable)
+htable_reseed(HTABLE* htable, HTABLE_HASH_FUNC hash_func)
 {
-    int i;
+    HTABLE_NODE** new_plane;
+    uint32_t seed;
+
+    new_plane = (HTABLE_NODE**) calloc(htable->plane_size, sizeof(HTABLE_NODE*));
+    if(new_plane == NULL)
+        return;
+
+    seed = (uint32_t) time(NULL) ^ (uint32_t) clock() ^ htable->seed;
+    seed = htable_mix(seed ^ (uint32_t) (uintptr_t) htable);
+    seed = htable_mix(seed ^ (uint32_t) (uintptr_t) new_plane);
+    if(seed == 0)
+        seed = 1;
+
+    htable_switch_plane(htable, new_plane, htable->plane_size, seed, hash_func);
+    HTABLE_COUNT(htable, n_reseeds);
+}
+
+/* Called whenever the chain is extended by a newly inserted node. */
+static void
+htable_check_flood(HTABLE* htable, const HTABLE_NODE* chain, HTABLE_HASH_FUNC hash_func)
+{
+    unsigned threshold = htable_flood_threshold(htable->n);
+    unsigned len = 0;
+
+    /* Another migration still in progress means we have reseeded only recently
+     * (or the table has grown), and that did not help. Possibly the adversary
+     * is able to make the hashes themselves collide, in which case reseeding
+     * is futile. Refraining from it until the migration completes ensures the
+     * rehashing costs at most a few steps per operation. */
+    if(htable->old_plane != NULL)
+        return;
+
+    while(chain != NULL) {
+        len++;
+        if(len > threshold) {
+            htable_reseed(htable, hash_func);
+            return;
+        }
+        chain = chain->next;
+    }
+}
 
-    for(i = 0; i < htable->n_planes; i++)
-        free(htable->planes[i]);
-    free(htable->planes);
+static void
+htable_free_all_planes(HTABLE* htable)
+{
+    free(htable->plane);
+    free(htable->old_plane);
 
-    htable->planes = NULL;
-    htable->n_planes = 0;
+    htable->plane = NULL;
+    htable->old_plane = NULL;
+    htable->plane_size = 0;
+    htable->old_plane_size = 0;
+    htable->migrate_index = 0;
 }
 
 static void
 htable_shrink(HTABLE* htable)
 {
-    HTABLE_NODE** prev_plane;
-    size_t prev_plane_size;
-    HTABLE_NODE** plane;
-    size_t plane_size;
-    size_t i;
+    HTABLE_NODE** new_plane;
+    uint32_t new_plane_size;
+    uint32_t i;
 
-    if(htable->n == 0) {
+    if(htable->n == 0  &&  htable->min_plane_size == 0) {
         htable_free_all_planes(htable);
         return;
     }
 
-    if(htable->n_planes <= 1)
+    if(htable->old_plane != NULL  ||  htable->plane_size <= HTABLE_MIN_PLANE_SIZE(htable))
         return;
 
-    /* We shrink by merging the largest plane into the previous one. */
-    prev_plane = (HTABLE_NODE**) htable->planes[htable->n_planes-2];
-    prev_plane_size = HTABLE_PLANE_SIZE(htable->n_planes-2);
-    plane = (HTABLE_NODE**) htable->planes[htable->n_planes-1];
-    plane_size = HTABLE_PLANE_SIZE(htable->n_planes-1);
-    for(i = 0; i < plane_size; i++) {
-        if(plane[i] != NULL) {
-            if(prev_plane[i % prev_plane_size] != NULL) {
-                /* Join the slot in the previous plane to our tail. */
-                HTABLE_NODE* tail = plane[i];
+    new_plane_size = htable->plane_size / 2;
+    if(new_plane_size < htable->min_plane_size)
+        return;
+    new_plane = (HTABLE_NODE**) calloc(new_plane_size, sizeof(HTABLE_NODE*));
+    if(new_plane == NULL)
+        return;
+
+    /* We shrink by folding the plane into a new one of half the size. Since
+     * the new size divides the old one, a whole bucket always maps to a single
+     * bucket of the new plane, and we do not need to rehash anything. */
+    for(i = 0; i < htable->plane_size; i++) {
+        if(htable->plane[i] != NULL) {
+            uint32_t index = HTABLE_FOLD_INDEX(htable, i, new_plane_size);
+
+            if(new_plane[index] != NULL) {
+                /* Join the slot in the new plane to our tail. */
+                HTABLE_NODE* tail = htable->plane[i];
                 while(tail->next != NULL)
                     tail = tail->next;
-                tail->next = prev_plane[i % prev_plane_size];
+                tail->next = new_plane[index];
             }
 
-            /* Move it to the previous plane. */
-            prev_plane[i % prev_plane_size] = plane[i];
+            /* Move it to the new plane. */
+            new_plane[index] = htable->plane[i];
+        }
+    }
+
+    free(htable->plane);
+    htable->plane = new_plane;
+    htable->plane_size = new_plane_size;
+    HTABLE_COUNT(htable, n_shrinks);
+}
+
+void
+htable_set_shrink_policy(HTABLE* htable, unsigned low_water_percent, size_t min_size)
+{
+    htable->shrink_percent = (low_water_percent < 50) ? low_water_percent : 49;
+    htable->min_plane_size = (min_size > 0) ? htable_plane_size_for(htable, min_size) : 0;
+}
+
+int
+htable_reserve(HTABLE* htable, size_t n, HTABLE_HASH_FUNC hash_func)
+{
+    HTABLE_NODE** new_plane;
+    uint32_t new_plane_size;
+
+    new_plane_size = htable_plane_size_for(htable, n);
+    if(new_plane_size <= htable->plane_size)
+        return 0;
+
+    new_plane = (HTABLE_NODE**) calloc(new_plane_size, sizeof(HTABLE_NODE*));
+    if(new_plane == NULL)
+        return -1;
+
+    /* Unlike when growing on demand, the caller is going to insert a lot of
+     * stuff right away, so complete the migration immediately. */
+    htable_switch_plane(htable, new_plane, new_plane_size, htable->seed, hash_func);
+    htable_migrate(htable, UINT32_MAX, hash_func);
+    return 0;
+}
+
+void
+htable_compact(HTABLE* htable)
+{
+    uint32_t plane_size;
+
+    /* Each htable_shrink() halves the plane at most once. */
+    do {
+        if(!HTABLE_TOO_EMPTY(htable))
+            break;
+        plane_size = htable->plane_size;
+        htable_shrink(htable);
+    } while(htable->plane_size < plane_size);
+}
+
+static void
+htable_stats_plane(HTABLE_NODE* const* plane, uint32_t plane_size,
+                   HTABLE_PLANE_STATS* plane_stats, HTABLE_STATS* stats)
+{
+    uint32_t i;
+
+    plane_stats->size = plane_size;
+    plane_stats->n_used = 0;
+    plane_stats->n_nodes = 0;
+
+    for(i = 0; i < plane_size; i++) {
+        const HTABLE_NODE* node;
+        size_t len = 0;
+
+        for(node = plane[i]; node != NULL; node = node->next)
+            len++;
+
+        if(len > 0) {
+            plane_stats->n_used++;
+            plane_stats->n_nodes += len;
         }
+        if(len > stats->max_chain)
+            stats->max_chain = len;
+        stats->histogram[(len < HTABLE_STATS_HISTOGRAM_SIZE) ? len : HTABLE_STATS_HISTOGRAM_SIZE-1]++;
     }
+}
+
+void
+htable_stats(const HTABLE* htable, HTABLE_STATS* stats)
+{
+    size_t n_used = 0;
+    unsigned i;
+
+    memset(stats, 0, sizeof(HTABLE_STATS));
+    stats->n = htable->n;
+
+    if(htable->plane != NULL)
+        htable_stats_plane(htable->plane, htable->plane_size, &stats->planes[stats->n_planes++], stats);
+    if(htable->old_plane != NULL)
+        htable_stats_plane(htable->old_plane, htable->old_plane_size, &stats->planes[stats->n_planes++], stats);
 
-    free(plane);
-    htable->n_planes--;
+    for(i = 0; i < stats->n_planes; i++)
+        n_used += stats->planes[i].n_used;
+    if(n_used > 0)
+        stats->mean_chain = (double) htable->n / (double) n_used;
+
+#ifdef CRE_HTABLE_STATS
+    stats->counters = htable->counters;
+#endif
 }
 
 static HTABLE_NODE*
 htable_lookup_internal(HTABLE* htable, uint32_t hash, const HTABLE_NODE* key,
                        HTABLE_NODE*** p_ref, HTABLE_CMP_FUNC cmp_func)
 {
+    HTABLE_NODE** plane = htable->plane;
+    uint32_t plane_size = htable->plane_size;
+    uint32_t seed = htable->seed;
+    int cache_hash = (htable->flags & HTABLE_CACHEHASH);
     HTABLE_NODE* node;
     HTABLE_NODE** ref;
-    int i;
 
-    /* It's better to lookup the biggest planes first, as much more stuff is
-     * stored there, and also because it's moire recently inserted stuff which
-     * is arguably more likely to accessed soon. */
-    for(i = htable->n_planes-1; i >= 0; i--) {
-        HTABLE_NODE** plane;
-        size_t index;
+    HTABLE_COUNT(htable, n_lookups);
 
-        plane = (HTABLE_NODE**) htable->planes[i];
-        index = hash % HTABLE_PLANE_SIZE(i);
-
-        ref = &plane[index];
-        node = plane[index];
+    /* Look into the current plane first, as all the recently inserted stuff
+     * is there, and also most of the older stuff once its migration is done. */
+    while(plane != NULL) {
+        ref = &plane[HTABLE_INDEX(htable, hash, seed, plane_size)];
+        node = *ref;
 
         while(node != NULL) {
-            if(cmp_func(key, node) == 0) {
+            if((!cache_hash  ||  HTABLE_NODE_HASH(node) == hash)  &&
+               (HTABLE_COUNT(htable, n_cmp_calls), cmp_func(key, node) == 0)) {
                 if(p_ref != NULL)
                     *p_ref = ref;
                 return node;
@@ -145,30 +443,43 @@ htable_lookup_internal(HTABLE* htable, uint32_t hash, const HTABLE_NODE* key,
             ref = &node->next;
             node = node->next;
         }
+
+        if(plane == htable->old_plane)
+            break;
+        plane = htable->old_plane;
+        plane_size = htable->old_plane_size;
+        seed = htable->old_seed;
     }
 
     return NULL;
 }
 
+static void
+htable_fini_plane(HTABLE_NODE** plane, uint32_t plane_size,
+                  void (*dtor_func)(HTABLE_NODE*))
+{
+    uint32_t index;
+
+    if(plane == NULL)
+        return;
+
+    for(index = 0; index < plane_size; index++) {
+        while(plane[index] != NULL) {
+            HTABLE_NODE* node;
+
+            node = plane[index];
+            plane[index] = node->next;
+            dtor_func(node);
+        }
+    }
+}
+
 void
 htable_fini(HTABLE* htable, void (*dtor_func)(HTABLE_NODE*))
 {
     if(dtor_func != NULL  &&  htable->n > 0) {
-        unsigned i;
-        size_t index;
-
-        for(i = 0; i < htable->n_planes; i++) {
-            HTABLE_NODE** plane = (HTABLE_NODE**) htable->planes[i];
-            for(index = 0; index < HTABLE_PLANE_SIZE(i); index++) {
-                while(plane[index] != NULL) {
-                    HTABLE_NODE* node;
-
-                    node = plane[index];
-                    plane[index] = node->next;
-                    dtor_func(node);
-                }
-            }
-        }
+        htable_fini_plane(htable->plane, htable->plane_size, dtor_func);
+        htable_fini_plane(htable->old_plane, htable->old_plane_size, dtor_func);
     }
     htable->n = 0;
 
@@ -176,29 +487,45 @@ htable_fini(HTABLE* htable, void (*dtor_func)(HTABLE_NODE*))
 }
 
 static int
-htable_insert_internal(HTABLE* htable, HTABLE_NODE* node,
+htable_insert_internal(HTABLE* htable, HTABLE_NODE* node, uint32_t hash,
                        HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func,
                        int skip_lookup)
 {
-    uint32_t hash;
-    HTABLE_NODE** plane;
+    HTABLE_NODE* equal = NULL;
+    uint32_t index;
 
-    hash = hash_func(node);
-    if(!skip_lookup) {
+    if(!skip_lookup  &&  !(htable->flags & HTABLE_MULTIMAP)) {
         if(htable_lookup_internal(htable, hash, node, NULL, cmp_func) != NULL)
             return -1;
     }
 
     /* When we are too populated, grow by adding a new plane. */
-    if(HTABLE_TOO_FULL(htable)) {
-        if(htable_grow(htable) != 0)
+    if(htable->plane == NULL  ||  HTABLE_TOO_FULL(htable)) {
+        if(htable_grow(htable, hash_func) != 0)
             return -1;
     }
 
-    plane = (HTABLE_NODE**) htable->planes[htable->n_planes - 1];
+    htable_migrate(htable, HTABLE_MIGRATE_STEP, hash_func);
 
-    node->next = plane[hash % HTABLE_PLANE_SIZE(htable->n_planes - 1)];
-    plane[hash % HTABLE_PLANE_SIZE(htable->n_planes - 1)] = node;
+    /* In the multimap mode, we keep all equal nodes adjacent in a single chain.
+     * (Note we have to look for them only after the migration step, as it may
+     * move them elsewhere.) */
+    if(!skip_lookup  &&  (htable->flags & HTABLE_MULTIMAP))
+        equal = htable_lookup_internal(htable, hash, node, NULL, cmp_func);
+
+    if(htable->flags & HTABLE_CACHEHASH)
+        HTABLE_NODE_HASH(node) = hash;
+    if(equal != NULL) {
+        node->next = equal->next;
+        equal->next = node;
+    } else {
+        index = HTABLE_INDEX(htable, hash, htable->seed, htable->plane_size);
+        node->next = htable->plane[index];
+        htable->plane[index] = node;
+
+        if(htable->flags & HTABLE_FLOODGUARD)
+            htable_check_flood(htable, htable->plane[index], hash_func);
+    }
 
     htable->n++;
     return 0;
@@ -208,38 +535,50 @@ int
 htable_insert(HTABLE* htable, HTABLE_NODE* node,
               HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
 {
-    return htable_insert_internal(htable, node, cmp_func, hash_func, 0);
+    return htable_insert_internal(htable, node, hash_func(node), cmp_func, hash_func, 0);
 }
 
 int
 htable_insert_unsafe(HTABLE* htable, HTABLE_NODE* node,
                      HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
 {
-    return htable_insert_internal(htable, node, cmp_func, hash_func, 1);
+    return htable_insert_internal(htable, node, hash_func(node), cmp_func, hash_func, 1);
 }
 
-HTABLE_NODE*
-htable_remove(HTABLE* htable, const HTABLE_NODE* key,
-              HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+void
+htable_unlink__(HTABLE* htable, HTABLE_NODE** ref, HTABLE_HASH_FUNC hash_func)
+{
+    *ref = (*ref)->next;
+    htable->n--;
+
+    htable_migrate(htable, HTABLE_MIGRATE_STEP, hash_func);
+
+    if(HTABLE_TOO_EMPTY(htable))
+        htable_shrink(htable);
+}
+
+static HTABLE_NODE*
+htable_remove_internal(HTABLE* htable, const HTABLE_NODE* key, uint32_t hash,
+                       HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
 {
-    uint32_t hash;
     HTABLE_NODE* node;
     HTABLE_NODE** p_ref;
 
-    hash = hash_func(key);
     node = htable_lookup_internal(htable, hash, key, &p_ref, cmp_func);
     if(node == NULL)
         return NULL;
 
-    *p_ref = node->next;
-    htable->n--;
-
-    if(HTABLE_TOO_EMPTY(htable))
-        htable_shrink(htable);
-
+    htable_unlink__(htable, p_ref, hash_func);
     return node;
 }
 
+HTABLE_NODE*
+htable_remove(HTABLE* htable, const HTABLE_NODE* key,
+              HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    return htable_remove_internal(htable, key, hash_func(key), cmp_func, hash_func);
+}
+
 HTABLE_NODE*
 htable_lookup(HTABLE* htable, const HTABLE_NODE* key,
               HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
@@ -249,3 +588,1118 @@ htable_lookup(HTABLE* htable, const HTABLE_NODE* key,
     hash = hash_func(key);
     return htable_lookup_internal(htable, hash, key, NULL, cmp_func);
 }
+
+int
+htable_insert_hashed(HTABLE* htable, HTABLE_NODE* node, uint32_t hash,
+                     HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    return htable_insert_internal(htable, node, hash, cmp_func, hash_func, 0);
+}
+
+int
+htable_insert_unsafe_hashed(HTABLE* htable, HTABLE_NODE* node, uint32_t hash,
+                            HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    return htable_insert_internal(htable, node, hash, cmp_func, hash_func, 1);
+}
+
+HTABLE_NODE*
+htable_remove_hashed(HTABLE* htable, const HTABLE_NODE* key, uint32_t hash,
+                     HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    return htable_remove_internal(htable, key, hash, cmp_func, hash_func);
+}
+
+HTABLE_NODE*
+htable_lookup_hashed(HTABLE* htable, const HTABLE_NODE* key, uint32_t hash,
+                     HTABLE_CMP_FUNC cmp_func)
+{
+    return htable_lookup_internal(htable, hash, key, NULL, cmp_func);
+}
+
+/* The batched operations are organized as a software pipeline: When resolving
+ * a key, the first nodes of the chains for a key HTABLE_BATCH_DISTANCE
+ * positions ahead are being prefetched, and the bucket heads for a key twice
+ * as far ahead. */
+#define HTABLE_BATCH_DISTANCE           8
+#define HTABLE_BATCH_RING               (2 * HTABLE_BATCH_DISTANCE)
+
+/* Helper for the batched operations: Prefetch the bucket heads where the hash
+ * may live (if stage == 0), or the first nodes of the respective chains (if
+ * stage == 1). The latter is only useful after the former has already had some
+ * time to complete. */
+static void
+htable_prefetch(HTABLE* htable, uint32_t hash, int stage)
+{
+    HTABLE_NODE** ref;
+
+    if(htable->plane == NULL)
+        return;
+
+    ref = &htable->plane[HTABLE_INDEX(htable, hash, htable->seed, htable->plane_size)];
+    if(stage == 0)
+        HTABLE_PREFETCH(ref);
+    else if(*ref != NULL)
+        HTABLE_PREFETCH(*ref);
+
+    if(htable->old_plane != NULL) {
+        ref = &htable->old_plane[HTABLE_INDEX(htable, hash, htable->old_seed, htable->old_plane_size)];
+        if(stage == 0)
+            HTABLE_PREFETCH(ref);
+        else if(*ref != NULL)
+            HTABLE_PREFETCH(*ref);
+    }
+}
+
+void
+htable_lookup_batch(HTABLE* htable, const HTABLE_NODE* const* keys,
+                    HTABLE_NODE** results, size_t n,
+                    HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    uint32_t hashes[HTABLE_BATCH_RING];
+    size_t i, j;
+
+    for(i = 0; i < n + 2 * HTABLE_BATCH_DISTANCE; i++) {
+        if(i >= 2 * HTABLE_BATCH_DISTANCE) {
+            j = i - 2 * HTABLE_BATCH_DISTANCE;
+            results[j] = htable_lookup_internal(htable, hashes[j % HTABLE_BATCH_RING],
+                                                keys[j], NULL, cmp_func);
+        }
+        if(i >= HTABLE_BATCH_DISTANCE  &&  i - HTABLE_BATCH_DISTANCE < n) {
+            j = i - HTABLE_BATCH_DISTANCE;
+            htable_prefetch(htable, hashes[j % HTABLE_BATCH_RING], 1);
+        }
+        if(i < n) {
+            hashes[i % HTABLE_BATCH_RING] = hash_func(keys[i]);
+            htable_prefetch(htable, hashes[i % HTABLE_BATCH_RING], 0);
+        }
+    }
+}
+
+size_t
+htable_insert_batch(HTABLE* htable, HTABLE_NODE* const* nodes, size_t n,
+                    HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    uint32_t hashes[HTABLE_BATCH_RING];
+    size_t i, j;
+
+    for(i = 0; i < n + 2 * HTABLE_BATCH_DISTANCE; i++) {
+        if(i >= 2 * HTABLE_BATCH_DISTANCE) {
+            j = i - 2 * HTABLE_BATCH_DISTANCE;
+            if(htable_insert_internal(htable, nodes[j], hashes[j % HTABLE_BATCH_RING],
+                                      cmp_func, hash_func, 0) != 0)
+                return j;
+        }
+        if(i >= HTABLE_BATCH_DISTANCE  &&  i - HTABLE_BATCH_DISTANCE < n) {
+            j = i - HTABLE_BATCH_DISTANCE;
+            htable_prefetch(htable, hashes[j % HTABLE_BATCH_RING], 1);
+        }
+        if(i < n) {
+            hashes[i % HTABLE_BATCH_RING] = hash_func(nodes[i]);
+            htable_prefetch(htable, hashes[i % HTABLE_BATCH_RING], 0);
+        }
+    }
+
+    return n;
+}
+
+/* Move the cursor to the 1st node at or after cursor->ref. */
+static HTABLE_NODE*
+htable_cursor_seek(HTABLE_CURSOR* cursor)
+{
+    HTABLE* htable = cursor->htable;
+
+    while(*cursor->ref == NULL) {
+        HTABLE_NODE** plane = (cursor->in_old_plane ? htable->old_plane : htable->plane);
+        uint32_t plane_size = (cursor->in_old_plane ? htable->old_plane_size : htable->plane_size);
+
+        cursor->index++;
+        if(cursor->index >= plane_size) {
+            if(cursor->in_old_plane  ||  htable->old_plane == NULL) {
+                cursor->ref = NULL;
+                cursor->node = NULL;
+
+                /* htable_remove_at_cursor() never shrinks the table, as that
+                 * would break the cursor. So do it now, as much as needed. */
+                htable_compact(htable);
+                return NULL;
+            }
+
+            /* Buckets of the old plane below migrate_index are all empty. */
+            plane = htable->old_plane;
+            cursor->in_old_plane = 1;
+            cursor->index = htable->migrate_index;
+        }
+
+        cursor->ref = &plane[cursor->index];
+    }
+
+    cursor->node = *cursor->ref;
+    return cursor->node;
+}
+
+HTABLE_NODE*
+htable_first(HTABLE* htable, HTABLE_CURSOR* cursor)
+{
+    cursor->htable = htable;
+    cursor->node = NULL;
+    cursor->index = 0;
+    cursor->in_old_plane = 0;
+    cursor->key = NULL;
+    cursor->hash = 0;
+
+    if(htable->plane == NULL) {
+        cursor->ref = NULL;
+        return NULL;
+    }
+
+    cursor->ref = &htable->plane[0];
+    return htable_cursor_seek(cursor);
+}
+
+HTABLE_NODE*
+htable_next(HTABLE_CURSOR* cursor)
+{
+    if(cursor->ref == NULL)
+        return NULL;
+
+    /* If the current node has been removed, cursor->ref already refers to
+     * the node which has followed it. */
+    if(cursor->node != NULL)
+        cursor->ref = &cursor->node->next;
+    return htable_cursor_seek(cursor);
+}
+
+HTABLE_NODE*
+htable_remove_at_cursor(HTABLE_CURSOR* cursor)
+{
+    HTABLE_NODE* node = cursor->node;
+
+    if(node == NULL)
+        return NULL;
+
+    *cursor->ref = node->next;
+    cursor->node = NULL;
+    cursor->htable->n--;
+    return node;
+}
+
+HTABLE_NODE*
+htable_lookup_all(HTABLE* htable, const HTABLE_NODE* key, HTABLE_CURSOR* cursor,
+                  HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    uint32_t hash = hash_func(key);
+    HTABLE_NODE** ref;
+
+    cursor->htable = htable;
+    cursor->key = key;
+    cursor->hash = hash;
+    cursor->index = 0;
+    cursor->in_old_plane = 0;
+    cursor->node = htable_lookup_internal(htable, hash, key, &ref, cmp_func);
+    cursor->ref = (cursor->node != NULL) ? ref : NULL;
+    return cursor->node;
+}
+
+HTABLE_NODE*
+htable_next_equal(HTABLE_CURSOR* cursor, HTABLE_CMP_FUNC cmp_func)
+{
+    HTABLE_NODE* node;
+
+    if(cursor->ref == NULL)
+        return NULL;
+
+    if(cursor->node != NULL)
+        cursor->ref = &cursor->node->next;
+    node = *cursor->ref;
+
+    /* All the equal nodes are adjacent, so the 1st non-equal one ends it. */
+    if(node == NULL  ||
+       ((cursor->htable->flags & HTABLE_CACHEHASH)  &&  HTABLE_NODE_HASH(node) != cursor->hash)  ||
+       cmp_func(cursor->key, node) != 0)
+    {
+        cursor->ref = NULL;
+        node = NULL;
+    }
+
+    cursor->node = node;
+    return node;
+}
+
+size_t
+htable_count(HTABLE* htable, const HTABLE_NODE* key,
+             HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    HTABLE_CURSOR cursor;
+    HTABLE_NODE* node;
+    size_t n = 0;
+
+    for(node = htable_lookup_all(htable, key, &cursor, cmp_func, hash_func);
+        node != NULL;
+        node = htable_next_equal(&cursor, cmp_func))
+    {
+        n++;
+    }
+
+    return n;
+}
+
+/*********************************
+ ***   HTABLE_SHARDED flavour   ***
+ *********************************/
+
+int
+htable_sharded_init(HTABLE_SHARDED* htable, unsigned shard_bits, unsigned flags)
+{
+    unsigned i;
+
+    if(shard_bits > 16)
+        return -1;
+
+    htable->shards = (HTABLE*) malloc(sizeof(HTABLE) << shard_bits);
+    if(htable->shards == NULL)
+        return -1;
+
+    htable->shard_bits = shard_bits;
+    for(i = 0; i < htable_sharded_count(htable); i++)
+        htable_init_ex(&htable->shards[i], flags);
+    return 0;
+}
+
+void
+htable_sharded_fini(HTABLE_SHARDED* htable, void (*dtor_func)(HTABLE_NODE*))
+{
+    unsigned i;
+
+    for(i = 0; i < htable_sharded_count(htable); i++)
+        htable_fini(&htable->shards[i], dtor_func);
+    free(htable->shards);
+    htable->shards = NULL;
+}
+
+int
+htable_sharded_insert(HTABLE_SHARDED* htable, HTABLE_NODE* node,
+                      HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    uint32_t hash = hash_func(node);
+    HTABLE* shard = &htable->shards[htable_sharded_index(htable, hash)];
+
+    return htable_insert_internal(shard, node, hash, cmp_func, hash_func, 0);
+}
+
+HTABLE_NODE*
+htable_sharded_remove(HTABLE_SHARDED* htable, const HTABLE_NODE* key,
+                      HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    uint32_t hash = hash_func(key);
+    HTABLE* shard = &htable->shards[htable_sharded_index(htable, hash)];
+
+    return htable_remove_internal(shard, key, hash, cmp_func, hash_func);
+}
+
+HTABLE_NODE*
+htable_sharded_lookup(HTABLE_SHARDED* htable, const HTABLE_NODE* key,
+                      HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    uint32_t hash = hash_func(key);
+    HTABLE* shard = &htable->shards[htable_sharded_index(htable, hash)];
+
+    return htable_lookup_internal(shard, hash, key, NULL, cmp_func);
+}
+
+int
+htable_sharded_merge_shard(HTABLE_SHARDED* dst, HTABLE_SHARDED* const* srcs,
+                           unsigned n_srcs, unsigned shard,
+                           HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func,
+                           HTABLE_MERGE_FUNC merge_func)
+{
+    HTABLE* dst_shard = &dst->shards[shard];
+    unsigned i;
+
+    for(i = 0; i < n_srcs; i++) {
+        HTABLE* src_shard = &srcs[i]->shards[shard];
+        HTABLE_CURSOR cursor;
+        HTABLE_NODE* node;
+
+        /* Make a room for all the nodes at once, so that the target does not
+         * have to grow (and migrate) repeatedly. (If it fails, never mind.) */
+        htable_reserve(dst_shard, dst_shard->n + src_shard->n, hash_func);
+
+        for(node = htable_first(src_shard, &cursor); node != NULL; node = htable_next(&cursor)) {
+            uint32_t hash = (src_shard->flags & HTABLE_CACHEHASH) ? HTABLE_NODE_HASH(node) : hash_func(node);
+            HTABLE_NODE* equal = NULL;
+
+            if(!(dst_shard->flags & HTABLE_MULTIMAP))
+                equal = htable_lookup_internal(dst_shard, hash, node, NULL, cmp_func);
+
+            if(equal == NULL) {
+                /* Note we insert into the target only after the node is
+                 * unlinked from the source as the insertion rewrites its
+                 * member HTABLE_NODE::next. */
+                htable_remove_at_cursor(&cursor);
+                if(htable_insert_internal(dst_shard, node, hash, cmp_func, hash_func,
+                                          !(dst_shard->flags & HTABLE_MULTIMAP)) != 0) {
+                    /* Put it back. (This cannot fail as it is just removed.) */
+                    htable_insert_internal(src_shard, node, hash, cmp_func, hash_func,
+                                           !(src_shard->flags & HTABLE_MULTIMAP));
+                    return -1;
+                }
+            } else {
+                htable_remove_at_cursor(&cursor);
+                merge_func(equal, node);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/******************************
+ ***   HTABLE_FLAT flavour   ***
+ ******************************/
+
+/* The slots are organized in groups of 16. Every slot has a control byte
+ * which is either HTABLE_CTRL_EMPTY, HTABLE_CTRL_DELETED (a tombstone), or
+ * (if the slot is occupied) the lowest 7 bits of the node's hash. The rest of
+ * the hash determines the group where the probing starts.
+ *
+ * As we select the group by a bit mask, we always mix the hash by htable_mix()
+ * first, so that a weak hash function does not cluster the nodes. */
+#define HTABLE_FLAT_GROUP_SIZE          16
+#define HTABLE_FLAT_MIN_CAPACITY        HTABLE_FLAT_GROUP_SIZE
+
+#define HTABLE_CTRL_EMPTY               ((uint8_t) 0x80)
+#define HTABLE_CTRL_DELETED             ((uint8_t) 0xfe)
+
+#define HTABLE_FLAT_H1(mixed_hash)      ((size_t) ((mixed_hash) >> 7))
+#define HTABLE_FLAT_H2(mixed_hash)      ((uint8_t) ((mixed_hash) & 0x7f))
+
+#define HTABLE_FLAT_TOO_FULL(htable)    ((htable)->n + (htable)->n_deleted >= (htable)->capacity - (htable)->capacity / 8)
+#define HTABLE_FLAT_TOO_EMPTY(htable)   ((htable)->n < (htable)->capacity / 8)
+
+
+static unsigned
+htable_ctz(unsigned mask)
+{
+#if defined __GNUC__
+    return (unsigned) __builtin_ctz(mask);
+#elif defined _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned) index;
+#else
+    unsigned index = 0;
+    while(!(mask & 1U)) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+/* Returns bit mask of slots in the group whose control byte is equal to c. */
+static unsigned
+htable_flat_match(const uint8_t* ctrl, uint8_t c)
+{
+#ifdef HTABLE_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i*) ctrl);
+    return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) c)));
+#else
+    unsigned mask = 0;
+    int i;
+
+    for(i = 0; i < HTABLE_FLAT_GROUP_SIZE; i++) {
+        if(ctrl[i] == c)
+            mask |= (1U << i);
+    }
+    return mask;
+#endif
+}
+
+/* Returns bit mask of slots in the group which are not occupied (i.e. which
+ * are either empty or deleted). */
+static unsigned
+htable_flat_match_free(const uint8_t* ctrl)
+{
+#ifdef HTABLE_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i*) ctrl);
+    return (unsigned) _mm_movemask_epi8(group);
+#else
+    unsigned mask = 0;
+    int i;
+
+    for(i = 0; i < HTABLE_FLAT_GROUP_SIZE; i++) {
+        if(ctrl[i] & 0x80)
+            mask |= (1U << i);
+    }
+    return mask;
+#endif
+}
+
+/* Returns index of the slot holding a node equal to the key, or
+ * htable->capacity if there is no such node. */
+static size_t
+htable_flat_lookup_internal(HTABLE_FLAT* htable, uint32_t hash,
+                            const HTABLE_NODE* key, HTABLE_CMP_FUNC cmp_func)
+{
+    size_t group_mask;
+    size_t group;
+    size_t step;
+    uint8_t h2;
+
+    if(htable->capacity == 0)
+        return htable->capacity;
+
+    group_mask = htable->capacity / HTABLE_FLAT_GROUP_SIZE - 1;
+    group = HTABLE_FLAT_H1(hash) & group_mask;
+    h2 = HTABLE_FLAT_H2(hash);
+
+    /* Triangular probing over the groups visits every group (as the count of
+     * groups is a power of two). The probing ends in the first group having an
+     * empty slot. As we never let the table become full, there is always some. */
+    for(step = 1; ; step++) {
+        const uint8_t* ctrl = htable->ctrl + group * HTABLE_FLAT_GROUP_SIZE;
+        unsigned mask;
+
+        mask = htable_flat_match(ctrl, h2);
+        while(mask != 0) {
+            size_t index = group * HTABLE_FLAT_GROUP_SIZE + htable_ctz(mask);
+
+            if(cmp_func(key, htable->slots[index]) == 0)
+                return index;
+            mask &= mask - 1;
+        }
+
+        if(htable_flat_match(ctrl, HTABLE_CTRL_EMPTY) != 0)
+            return htable->capacity;
+
+        group = (group + step) & group_mask;
+    }
+}
+
+/* Returns index of the 1st unoccupied slot on the probing path of the hash. */
+static size_t
+htable_flat_find_free(HTABLE_FLAT* htable, uint32_t hash)
+{
+    size_t group_mask;
+    size_t group;
+    size_t step;
+
+    group_mask = htable->capacity / HTABLE_FLAT_GROUP_SIZE - 1;
+    group = HTABLE_FLAT_H1(hash) & group_mask;
+
+    for(step = 1; ; step++) {
+        unsigned mask;
+
+        mask = htable_flat_match_free(htable->ctrl + group * HTABLE_FLAT_GROUP_SIZE);
+        if(mask != 0)
+            return group * HTABLE_FLAT_GROUP_SIZE + htable_ctz(mask);
+
+        group = (group + step) & group_mask;
+    }
+}
+
+static void
+htable_flat_free_all(HTABLE_FLAT* htable)
+{
+    /* The control bytes live in the same memory block as the slots. */
+    free(htable->slots);
+
+    htable->slots = NULL;
+    htable->ctrl = NULL;
+    htable->capacity = 0;
+    htable->n_deleted = 0;
+}
+
+static int
+htable_flat_rehash(HTABLE_FLAT* htable, size_t capacity, HTABLE_HASH_FUNC hash_func)
+{
+    HTABLE_FLAT tmp;
+    size_t i;
+
+    tmp.slots = (HTABLE_NODE**) malloc(capacity * (sizeof(HTABLE_NODE*) + 1));
+    if(tmp.slots == NULL)
+        return -1;
+    tmp.ctrl = (uint8_t*) (tmp.slots + capacity);
+    memset(tmp.ctrl, HTABLE_CTRL_EMPTY, capacity);
+    tmp.capacity = capacity;
+    tmp.n = htable->n;
+    tmp.n_deleted = 0;
+
+    for(i = 0; i < htable->capacity; i++) {
+        if(!(htable->ctrl[i] & 0x80)) {
+            HTABLE_NODE* node = htable->slots[i];
+            uint32_t hash = htable_mix(hash_func(node));
+            size_t index = htable_flat_find_free(&tmp, hash);
+
+            tmp.slots[index] = node;
+            tmp.ctrl[index] = HTABLE_FLAT_H2(hash);
+        }
+    }
+
+    free(htable->slots);
+    *htable = tmp;
+    return 0;
+}
+
+void
+htable_flat_fini(HTABLE_FLAT* htable, void (*dtor_func)(HTABLE_NODE*))
+{
+    if(dtor_func != NULL  &&  htable->n > 0) {
+        size_t i;
+
+        for(i = 0; i < htable->capacity; i++) {
+            if(!(htable->ctrl[i] & 0x80))
+                dtor_func(htable->slots[i]);
+        }
+    }
+    htable->n = 0;
+
+    htable_flat_free_all(htable);
+}
+
+static int
+htable_flat_insert_internal(HTABLE_FLAT* htable, HTABLE_NODE* node,
+                            HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func,
+                            int skip_lookup)
+{
+    uint32_t hash;
+    size_t index;
+
+    hash = htable_mix(hash_func(node));
+    if(!skip_lookup) {
+        if(htable_flat_lookup_internal(htable, hash, node, cmp_func) < htable->capacity)
+            return -1;
+    }
+
+    /* When we are too populated, rehash into a bigger table. If it is mainly
+     * the tombstones what fills the table, rehashing into a table of the same
+     * size is enough to get rid of them. */
+    if(htable->capacity == 0) {
+        if(htable_flat_rehash(htable, HTABLE_FLAT_MIN_CAPACITY, hash_func) != 0)
+            return -1;
+    } else if(HTABLE_FLAT_TOO_FULL(htable)) {
+        size_t capacity = htable->capacity;
+
+        if(htable->n >= capacity / 2)
+            capacity *= 2;
+        if(htable_flat_rehash(htable, capacity, hash_func) != 0)
+            return -1;
+    }
+
+    index = htable_flat_find_free(htable, hash);
+    if(htable->ctrl[index] == HTABLE_CTRL_DELETED)
+        htable->n_deleted--;
+    htable->slots[index] = node;
+    htable->ctrl[index] = HTABLE_FLAT_H2(hash);
+
+    htable->n++;
+    return 0;
+}
+
+int
+htable_flat_insert(HTABLE_FLAT* htable, HTABLE_NODE* node,
+                   HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    return htable_flat_insert_internal(htable, node, cmp_func, hash_func, 0);
+}
+
+int
+htable_flat_insert_unsafe(HTABLE_FLAT* htable, HTABLE_NODE* node,
+                          HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    return htable_flat_insert_internal(htable, node, cmp_func, hash_func, 1);
+}
+
+HTABLE_NODE*
+htable_flat_remove(HTABLE_FLAT* htable, const HTABLE_NODE* key,
+                   HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    HTABLE_NODE* node;
+    size_t index;
+    const uint8_t* group_ctrl;
+
+    index = htable_flat_lookup_internal(htable, htable_mix(hash_func(key)), key, cmp_func);
+    if(index >= htable->capacity)
+        return NULL;
+
+    node = htable->slots[index];
+
+    /* If the group still has an empty slot, no probing ever continues past
+     * this group, so we may mark the slot as empty too. Otherwise we have to
+     * leave a tombstone in it so that we do not break any probing path. */
+    group_ctrl = htable->ctrl + (index - index % HTABLE_FLAT_GROUP_SIZE);
+    if(htable_flat_match(group_ctrl, HTABLE_CTRL_EMPTY) != 0) {
+        htable->ctrl[index] = HTABLE_CTRL_EMPTY;
+    } else {
+        htable->ctrl[index] = HTABLE_CTRL_DELETED;
+        htable->n_deleted++;
+    }
+    htable->n--;
+
+    if(htable->n == 0) {
+        htable_flat_free_all(htable);
+    } else if(htable->capacity > HTABLE_FLAT_MIN_CAPACITY  &&  HTABLE_FLAT_TOO_EMPTY(htable)) {
+        /* Failure to shrink is not fatal. */
+        htable_flat_rehash(htable, htable->capacity / 2, hash_func);
+    }
+
+    return node;
+}
+
+HTABLE_NODE*
+htable_flat_lookup(HTABLE_FLAT* htable, const HTABLE_NODE* key,
+                   HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    size_t index;
+
+    index = htable_flat_lookup_internal(htable, htable_mix(hash_func(key)), key, cmp_func);
+    return (index < htable->capacity) ? htable->slots[index] : NULL;
+}
+
+
+
+/******************************
+ ***   HTABLE_CONC flavour   ***
+ ******************************/
+
+/* Memory ordering primitives. Readers follow all the pointers with acquire
+ * loads and the writer publishes them with release stores. The read-side
+ * sections and htable_conc_synchronize() need a full barrier between a store
+ * and a subsequent load. */
+#if defined __GNUC__
+    #define HTABLE_LOAD_ACQUIRE(dst, ptr)   do { (dst) = __atomic_load_n((ptr), __ATOMIC_ACQUIRE); } while(0)
+    #define HTABLE_STORE_RELEASE(ptr, val)  __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+    #define HTABLE_FULL_BARRIER()           __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined _MSC_VER
+    #if defined _M_IX86  ||  defined _M_X64  ||  defined _M_AMD64
+        /* x86 and x64 do not reorder loads with other loads, nor stores with
+         * other stores, so we only need to prevent the compiler from doing so. */
+        #define HTABLE_ORDER_BARRIER__()    _ReadWriteBarrier()
+    #else
+        #define HTABLE_ORDER_BARRIER__()    MemoryBarrier()
+    #endif
+    #define HTABLE_LOAD_ACQUIRE(dst, ptr)   do { (dst) = *(ptr); HTABLE_ORDER_BARRIER__(); } while(0)
+    #define HTABLE_STORE_RELEASE(ptr, val)  do { HTABLE_ORDER_BARRIER__(); *(ptr) = (val); } while(0)
+    #define HTABLE_FULL_BARRIER()           MemoryBarrier()
+#else
+    /* Unknown compiler. We can only hope it is a strongly ordered machine and
+     * that the compiler does not reorder accesses across function calls. */
+    #define HTABLE_LOAD_ACQUIRE(dst, ptr)   do { (dst) = *(ptr); } while(0)
+    #define HTABLE_STORE_RELEASE(ptr, val)  do { *(ptr) = (val); } while(0)
+    #define HTABLE_FULL_BARRIER()           do { } while(0)
+#endif
+
+#define HTABLE_CONC_PLANE_SIZE(size_index) ((uint32_t) 59 << (size_index))
+#define HTABLE_CONC_MAX_SIZE_INDEX          25
+
+/* The plane is published to readers together with its size, so that a reader
+ * always sees a consistent pair. The slots follow the structure in the same
+ * memory block. */
+struct HTABLE_CONC_PLANE {
+    int size_index;
+    uint32_t size;
+    HTABLE_NODE** slots;
+};
+
+/* Every reader has its own slot (in its own cache line), where it announces
+ * the epoch when its current read-side section has started; or zero when not
+ * inside any read-side section. */
+#define HTABLE_CONC_CACHELINE               64
+
+struct HTABLE_CONC_READER {
+    unsigned long epoch;
+    char padding[HTABLE_CONC_CACHELINE - sizeof(unsigned long)];
+};
+
+/* calloc() does not align to the cache line, so we allocate one extra line
+ * and round the pointer up. The original pointer is stored right before the
+ * aligned array, so that we can free it. */
+static HTABLE_CONC_READER*
+htable_conc_alloc_readers(unsigned n_readers)
+{
+    char* block;
+    char* readers;
+
+    block = (char*) calloc((size_t) n_readers + 1, sizeof(HTABLE_CONC_READER));
+    if(block == NULL)
+        return NULL;
+
+    readers = (char*) (((uintptr_t) block + sizeof(void*) + HTABLE_CONC_CACHELINE - 1) &
+                       ~(uintptr_t) (HTABLE_CONC_CACHELINE - 1));
+    ((void**) readers)[-1] = block;
+    return (HTABLE_CONC_READER*) readers;
+}
+
+static void
+htable_conc_free_readers(HTABLE_CONC_READER* readers)
+{
+    if(readers != NULL)
+        free(((void**) readers)[-1]);
+}
+
+
+static void
+htable_yield(void)
+{
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+int
+htable_conc_init(HTABLE_CONC* htable, unsigned n_readers)
+{
+    htable->readers = htable_conc_alloc_readers((n_readers > 0) ? n_readers : 1);
+    if(htable->readers == NULL)
+        return -1;
+
+    htable->plane = NULL;
+    htable->n_readers = n_readers;
+    htable->epoch = 1;
+    htable->n = 0;
+    return 0;
+}
+
+void
+htable_conc_read_begin(HTABLE_CONC* htable, unsigned reader)
+{
+    unsigned long epoch;
+
+    HTABLE_LOAD_ACQUIRE(epoch, &htable->epoch);
+    HTABLE_STORE_RELEASE(&htable->readers[reader].epoch, epoch);
+
+    /* Make sure the writer either sees our announcement, or we see anything
+     * it has published before it started waiting for the readers. */
+    HTABLE_FULL_BARRIER();
+}
+
+void
+htable_conc_read_end(HTABLE_CONC* htable, unsigned reader)
+{
+    HTABLE_STORE_RELEASE(&htable->readers[reader].epoch, 0);
+}
+
+void
+htable_conc_synchronize(HTABLE_CONC* htable)
+{
+    unsigned long epoch;
+    unsigned i;
+
+    /* Start a new epoch. Any reader which starts its section from now on sees
+     * everything published so far, so we only have to wait for the readers
+     * which have announced any older epoch. */
+    epoch = htable->epoch + 1;
+    if(epoch == 0)
+        epoch = 1;
+    HTABLE_STORE_RELEASE(&htable->epoch, epoch);
+    HTABLE_FULL_BARRIER();
+
+    for(i = 0; i < htable->n_readers; i++) {
+        while(1) {
+            unsigned long reader_epoch;
+
+            HTABLE_LOAD_ACQUIRE(reader_epoch, &htable->readers[i].epoch);
+            if(reader_epoch == 0  ||  reader_epoch == epoch)
+                break;
+            htable_yield();
+        }
+    }
+}
+
+static HTABLE_CONC_PLANE*
+htable_conc_alloc_plane(int size_index)
+{
+    HTABLE_CONC_PLANE* plane;
+    size_t size = HTABLE_CONC_PLANE_SIZE(size_index);
+
+    if(size > (SIZE_MAX - sizeof(HTABLE_CONC_PLANE)) / sizeof(HTABLE_NODE*))
+        return NULL;
+
+    plane = (HTABLE_CONC_PLANE*) calloc(1, sizeof(HTABLE_CONC_PLANE) +
+                                           size * sizeof(HTABLE_NODE*));
+    if(plane == NULL)
+        return NULL;
+
+    plane->size_index = size_index;
+    plane->size = (uint32_t) size;
+    plane->slots = (HTABLE_NODE**) (plane + 1);
+    return plane;
+}
+
+/* Publish the new plane and release the old one as soon as no reader can use
+ * it anymore. */
+static void
+htable_conc_publish(HTABLE_CONC* htable, HTABLE_CONC_PLANE* plane)
+{
+    HTABLE_CONC_PLANE* old_plane = htable->plane;
+
+    HTABLE_STORE_RELEASE(&htable->plane, plane);
+    if(old_plane != NULL) {
+        htable_conc_synchronize(htable);
+        free(old_plane);
+    }
+}
+
+/* If the chain starting with the node contains nodes of more slots of the
+ * plane, return the last node of its leading run of nodes of the same slot.
+ * Otherwise return NULL. */
+static HTABLE_NODE*
+htable_conc_run_tail(HTABLE_NODE* node, const HTABLE_CONC_PLANE* plane,
+                     HTABLE_HASH_FUNC hash_func)
+{
+    uint32_t index;
+
+    if(node == NULL)
+        return NULL;
+
+    index = hash_func(node) % plane->size;
+    while(node->next != NULL) {
+        if(hash_func(node->next) % plane->size != index)
+            return node;
+        node = node->next;
+    }
+
+    return NULL;
+}
+
+/* We grow twice, so the nodes of each old slot split into two slots of the
+ * new plane. Readers must never miss a node, so we cannot just move the nodes
+ * to their new chains. Instead, we "unzip" the old chains in place:
+ *
+ * Initially, each new slot points to its first node in the old chain, so the
+ * chains of the two slots stay zipped together. That is fine for readers:
+ * They only examine some extra nodes of the other slot. Once no reader can
+ * see the old plane, each pass unlinks one run of the other slot's nodes from
+ * every chain, until the chains are separated. Between the passes we wait for
+ * the readers, because a reader may still be walking through a run we have
+ * just unlinked, and the next pass relinks the tail of that run.
+ *
+ * The count of passes is given by the longest chain, which is short thanks
+ * to the load factor. */
+static void
+htable_conc_grow(HTABLE_CONC* htable, HTABLE_HASH_FUNC hash_func)
+{
+    HTABLE_CONC_PLANE* old_plane = htable->plane;
+    HTABLE_CONC_PLANE* plane;
+    HTABLE_NODE** tails;
+    HTABLE_NODE* node;
+    uint32_t index;
+    int unzipped;
+
+    /* On failure, it may be suboptimal, but we can still add the new stuff
+     * into the current plane. */
+    plane = htable_conc_alloc_plane(old_plane->size_index + 1);
+    if(plane == NULL)
+        return;
+
+    for(index = 0; index < old_plane->size; index++) {
+        for(node = old_plane->slots[index]; node != NULL; node = node->next) {
+            HTABLE_NODE** slot = &plane->slots[hash_func(node) % plane->size];
+
+            if(*slot == NULL)
+                *slot = node;
+        }
+    }
+
+    HTABLE_STORE_RELEASE(&htable->plane, plane);
+    htable_conc_synchronize(htable);
+
+    /* No reader can see the old plane now, so we reuse its slots to remember
+     * where the unzipping of each chain continues. */
+    tails = old_plane->slots;
+    for(index = 0; index < old_plane->size; index++)
+        tails[index] = htable_conc_run_tail(tails[index], plane, hash_func);
+
+    while(1) {
+        unzipped = 0;
+        for(index = 0; index < old_plane->size; index++) {
+            HTABLE_NODE* tail = tails[index];
+            HTABLE_NODE* run_tail;
+
+            if(tail == NULL)
+                continue;
+
+            /* Unlink the run following the tail. The tail of the run still
+             * links to the next nodes of our tail's slot, so that is where the
+             * next pass continues. */
+            run_tail = htable_conc_run_tail(tail->next, plane, hash_func);
+            HTABLE_STORE_RELEASE(&tail->next, (run_tail != NULL) ? run_tail->next : NULL);
+            tails[index] = run_tail;
+            unzipped = 1;
+        }
+
+        if(!unzipped)
+            break;
+        htable_conc_synchronize(htable);
+    }
+
+    free(old_plane);
+}
+
+/* We shrink twice by concatenating the chains of each pair of slots which map
+ * to the same slot of the new plane. Readers of the old plane may then see
+ * some extra nodes, but they cannot miss any. */
+static void
+htable_conc_shrink(HTABLE_CONC* htable)
+{
+    HTABLE_CONC_PLANE* old_plane = htable->plane;
+    HTABLE_CONC_PLANE* plane;
+    uint32_t index;
+
+    if(htable->n == 0) {
+        htable_conc_publish(htable, NULL);
+        return;
+    }
+
+    if(old_plane->size_index == 0)
+        return;
+
+    plane = htable_conc_alloc_plane(old_plane->size_index - 1);
+    if(plane == NULL)
+        return;
+
+    for(index = 0; index < plane->size; index++) {
+        HTABLE_NODE* head = old_plane->slots[index];
+        HTABLE_NODE* other = old_plane->slots[index + plane->size];
+
+        if(head != NULL  &&  other != NULL) {
+            HTABLE_NODE* tail = head;
+
+            while(tail->next != NULL)
+                tail = tail->next;
+            HTABLE_STORE_RELEASE(&tail->next, other);
+        }
+
+        plane->slots[index] = (head != NULL) ? head : other;
+    }
+
+    htable_conc_publish(htable, plane);
+}
+
+static HTABLE_NODE*
+htable_conc_lookup_internal(HTABLE_CONC* htable, uint32_t hash, const HTABLE_NODE* key,
+                            HTABLE_NODE*** p_ref, HTABLE_CMP_FUNC cmp_func)
+{
+    HTABLE_CONC_PLANE* plane;
+    HTABLE_NODE* node;
+    HTABLE_NODE** ref;
+
+    HTABLE_LOAD_ACQUIRE(plane, &htable->plane);
+    if(plane == NULL)
+        return NULL;
+
+    ref = &plane->slots[hash % plane->size];
+    HTABLE_LOAD_ACQUIRE(node, ref);
+
+    while(node != NULL) {
+        if(cmp_func(key, node) == 0) {
+            if(p_ref != NULL)
+                *p_ref = ref;
+            return node;
+        }
+
+        ref = &node->next;
+        HTABLE_LOAD_ACQUIRE(node, ref);
+    }
+
+    return NULL;
+}
+
+void
+htable_conc_fini(HTABLE_CONC* htable, void (*dtor_func)(HTABLE_NODE*))
+{
+    if(htable->plane != NULL) {
+        if(dtor_func != NULL)
+            htable_fini_plane(htable->plane->slots, htable->plane->size, dtor_func);
+        free(htable->plane);
+    }
+
+    htable_conc_free_readers(htable->readers);
+
+    htable->plane = NULL;
+    htable->readers = NULL;
+    htable->n_readers = 0;
+    htable->n = 0;
+}
+
+static int
+htable_conc_insert_internal(HTABLE_CONC* htable, HTABLE_NODE* node,
+                            HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func,
+                            int skip_lookup)
+{
+    HTABLE_CONC_PLANE* plane;
+    uint32_t hash;
+    HTABLE_NODE** slot;
+
+    hash = hash_func(node);
+    if(!skip_lookup) {
+        if(htable_conc_lookup_internal(htable, hash, node, NULL, cmp_func) != NULL)
+            return -1;
+    }
+
+    /* When we are too populated, grow. */
+    if(htable->plane == NULL) {
+        plane = htable_conc_alloc_plane(0);
+        if(plane == NULL)
+            return -1;
+        HTABLE_STORE_RELEASE(&htable->plane, plane);
+    } else if(htable->n >= htable->plane->size  &&
+              htable->plane->size_index < HTABLE_CONC_MAX_SIZE_INDEX) {
+        htable_conc_grow(htable, hash_func);
+    }
+
+    /* The node becomes visible to the readers only with the store into the
+     * slot, so the plain store into node->next is enough. */
+    slot = &htable->plane->slots[hash % htable->plane->size];
+    node->next = *slot;
+    HTABLE_STORE_RELEASE(slot, node);
+
+    htable->n++;
+    return 0;
+}
+
+int
+htable_conc_insert(HTABLE_CONC* htable, HTABLE_NODE* node,
+                   HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    return htable_conc_insert_internal(htable, node, cmp_func, hash_func, 0);
+}
+
+int
+htable_conc_insert_unsafe(HTABLE_CONC* htable, HTABLE_NODE* node,
+                          HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    return htable_conc_insert_internal(htable, node, cmp_func, hash_func, 1);
+}
+
+HTABLE_NODE*
+htable_conc_remove(HTABLE_CONC* htable, const HTABLE_NODE* key,
+                   HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    HTABLE_NODE* node;
+    HTABLE_NODE** p_ref;
+
+    node = htable_conc_lookup_internal(htable, hash_func(key), key, &p_ref, cmp_func);
+    if(node == NULL)
+        return NULL;
+
+    /* We do not touch node->next, so any reader standing on the node can still
+     * continue along the chain. */
+    HTABLE_STORE_RELEASE(p_ref, node->next);
+    htable->n--;
+
+    if(htable->n < htable->plane->size / 4)
+        htable_conc_shrink(htable);
+
+    return node;
+}
+
+HTABLE_NODE*
+htable_conc_lookup(HTABLE_CONC* htable, const HTABLE_NODE* key,
+                   HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func)
+{
+    return htable_conc_lookup_internal(htable, hash_func(key), key, NULL, cmp_func);
+}
@@ -28,6 +28,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -61,10 +62,44 @@ typedef struct HTABLE_NODE {
 } HTABLE_NODE;
 
 
+/* Node which also caches the hash of its key. See HTABLE_CACHEHASH.
+ *
+ * To use it, embed HTABLE_NODE_H into your structure instead of HTABLE_NODE,
+ * and pass pointer to its member HTABLE_NODE_H::node into all the functions.
+ */
+typedef struct HTABLE_NODE_H {
+    HTABLE_NODE node;
+    uint32_t hash;
+} HTABLE_NODE_H;
+
+
+/* Counters of operations, maintained only if CRE_HTABLE_STATS is defined (when
+ * compiling htable.c as well as all the code using it). See htable_stats().
+ */
+typedef struct HTABLE_COUNTERS {
+    uint64_t n_lookups;         /* Including those done by insert and remove. */
+    uint64_t n_cmp_calls;       /* Comparator calls made by the lookups. */
+    uint64_t n_grows;
+    uint64_t n_shrinks;
+    uint64_t n_reseeds;         /* See HTABLE_FLOODGUARD. */
+} HTABLE_COUNTERS;
+
+
 typedef struct HTABLE {
-    void** planes;
-    int n_planes;
+    HTABLE_NODE** plane;        /* The current plane. */
+    HTABLE_NODE** old_plane;    /* Older plane being migrated, or NULL. */
+    uint32_t plane_size;
+    uint32_t old_plane_size;
+    uint32_t seed;              /* Seed of the current plane (see HTABLE_FLOODGUARD). */
+    uint32_t old_seed;          /* Seed of the older plane. */
+    uint32_t migrate_index;     /* Next bucket of the old plane to migrate. */
+    unsigned flags;
+    unsigned shrink_percent;    /* See htable_set_shrink_policy(). */
+    uint32_t min_plane_size;
     size_t n;
+#ifdef CRE_HTABLE_STATS
+    HTABLE_COUNTERS counters;
+#endif
 } HTABLE;
 
 
@@ -111,10 +146,129 @@ typedef uint32_t (*HTABLE_HASH_FUNC)(const HTABLE_NODE*);
                 ((type*)((char*)(node_ptr) - HTABLE_OFFSETOF__(type, member)))
 
 
-#define HTABLE_INITIALIZER              { NULL, 0, 0 }
+/* Flag for htable_init_ex() asking to use planes of power-of-two sizes.
+ *
+ * By default, the planes have sizes which are not a power of two, and a bucket
+ * is selected by a modulo of the hash. With this flag, the bucket is selected
+ * by a cheap bit mask instead of the (relatively expensive) integer division.
+ * To prevent any weak hash function from clustering the nodes into few buckets
+ * (as only the low bits of the hash would be used), the hash is then mixed by
+ * a finalizer first.
+ */
+#define HTABLE_POW2PLANES               0x0001
+
+/* Flag for htable_init_ex() specifying that all the nodes in the table are
+ * actually HTABLE_NODE_H structures.
+ *
+ * The table then stores hash of every node in it when it is inserted. Lookups
+ * call the comparator function only for nodes with the matching hash, and the
+ * table never needs to call the hash function for nodes already inserted.
+ * This is especially useful when the comparator function is expensive, e.g.
+ * for long string keys.
+ *
+ * Note the key passed into htable_lookup() or htable_remove() may still be
+ * just a HTABLE_NODE.
+ */
+#define HTABLE_CACHEHASH                0x0002
+
+/* Flag for htable_init_ex() asking the table to never shrink when nodes are
+ * removed. The memory is then released only by htable_fini().
+ *
+ * This is the same as calling htable_set_shrink_policy(htable, 0, 0).
+ */
+#define HTABLE_NOSHRINK                 0x0004
+
+/* Flag for htable_init_ex() making the table a multimap, i.e. allowing any
+ * count of nodes with the same key.
+ *
+ * htable_insert() then never fails because of an equal node already present.
+ * Instead, it places the new node next to the equal ones, so that all of them
+ * can be enumerated by htable_lookup_all() and htable_next_equal(). Note that
+ * htable_insert_unsafe() would not do that, so in this mode it may be used
+ * only for keys not yet present in the table.
+ *
+ * htable_lookup() and htable_remove() deal with the first node of the equal
+ * ones.
+ */
+#define HTABLE_MULTIMAP                 0x0008
+
+/* Flag for htable_init_ex() enabling a defense against hash flooding, i.e.
+ * against an adversary who crafts keys so that they all land in few buckets
+ * and every operation on them degrades to a linear walk of a long chain.
+ *
+ * The table then watches length of the chains as nodes are inserted. If any
+ * chain grows much longer than a decent hash function could ever produce for
+ * the given count of nodes, the table picks a random seed, and from then on
+ * it selects the buckets by a seeded mix of the hashes. All the nodes are
+ * rehashed into a new plane incrementally, the same way as when the table
+ * grows.
+ *
+ * Note this can only separate nodes whose hashes differ. If the adversary is
+ * able to produce keys with identical hashes, only a keyed hash function
+ * (i.e. one with a secret seed) can help.
+ */
+#define HTABLE_FLOODGUARD               0x0010
+
+
+#ifdef CRE_HTABLE_STATS
+    #define HTABLE_COUNTERS_INITIALIZER__   , { 0 }
+#else
+    #define HTABLE_COUNTERS_INITIALIZER__
+#endif
+
+#define HTABLE_INITIALIZER              { NULL, NULL, 0, 0, 0, 0, 0, 0, 25, 0, 0 HTABLE_COUNTERS_INITIALIZER__ }
+#define HTABLE_INITIALIZER_EX(flags)    { NULL, NULL, 0, 0, 0, 0, 0, (flags), 25, 0, 0 HTABLE_COUNTERS_INITIALIZER__ }
+
+HTABLE_INLINE__ void htable_init_ex(HTABLE* htable, unsigned flags)
+        { htable->plane = NULL; htable->old_plane = NULL; htable->plane_size = 0;
+          htable->old_plane_size = 0; htable->seed = 0; htable->old_seed = 0;
+          htable->migrate_index = 0;
+          htable->flags = flags; htable->shrink_percent = 25;
+          htable->min_plane_size = 0; htable->n = 0;
+#ifdef CRE_HTABLE_STATS
+          memset(&htable->counters, 0, sizeof(HTABLE_COUNTERS));
+#endif
+        }
 
 HTABLE_INLINE__ void htable_init(HTABLE* htable)
-        { htable->planes = NULL; htable->n_planes = 0; htable->n = 0; }
+        { htable_init_ex(htable, 0); }
+
+/* Set the policy when the table shrinks as nodes are removed.
+ *
+ * The table shrinks whenever the count of nodes falls below low_water_percent
+ * of its capacity (default: 25). Zero disables shrinking altogether. Values
+ * above 49 are treated as 49: The table has to stay at least half empty
+ * after shrinking, or it would have to grow again right away.
+ *
+ * When min_size is non-zero, the table never shrinks below a capacity needed
+ * for min_size nodes (and it keeps that capacity even when it becomes empty).
+ *
+ * This is usually called right after the initialization.
+ */
+void htable_set_shrink_policy(HTABLE* htable, unsigned low_water_percent, size_t min_size);
+
+/* Make the table ready to hold n nodes without any further growing.
+ *
+ * This is useful before inserting many nodes at once. Any nodes already
+ * present in the table are moved into the new storage immediately, so the
+ * hash_func is needed (unless the table is empty, or HTABLE_CACHEHASH is
+ * used).
+ *
+ * Note the table may still shrink later if nodes are removed from it. See
+ * htable_set_shrink_policy() for how to prevent that.
+ *
+ * Returns 0 on success or -1 on failure.
+ */
+int htable_reserve(HTABLE* htable, size_t n, HTABLE_HASH_FUNC hash_func);
+
+/* Shrink the table as much as the shrink policy allows for the current count
+ * of nodes.
+ *
+ * Removals normally shrink the table on their own, so this is only needed
+ * after removing many nodes with htable_remove_at_cursor() if the iteration
+ * has been stopped before reaching the end (see HTABLE_CURSOR).
+ */
+void htable_compact(HTABLE* htable);
 
 /* Cleaner of the hashtable. Calls the provided destructor for every node
  * and releases all itnernal buffers.:x
@@ -129,7 +283,8 @@ HTABLE_INLINE__ int htable_is_empty(HTABLE* htable)
 /* Insert a new node into the hash table.
  *
  * Returns 0 on success or -1 on failure. The function fails if an internal
- * memory allocation fails, or if a node with the same key is already present.
+ * memory allocation fails, or if a node with the same key is already present
+ * (unless HTABLE_MULTIMAP is used).
  */
 int htable_insert(HTABLE* htable, HTABLE_NODE* node,
                   HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
@@ -163,6 +318,466 @@ HTABLE_NODE* htable_remove(HTABLE* htable, const HTABLE_NODE* key,
 HTABLE_NODE* htable_lookup(HTABLE* htable, const HTABLE_NODE* key,
                            HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
 
+/* Statistics of the table, as retrieved by htable_stats().
+ *
+ * The chain lengths cover all the buckets of all the planes. With a good hash
+ * function, most chains are short and the max_chain stays very low even for
+ * huge tables. A long tail in the histogram indicates a weak hash function.
+ */
+#define HTABLE_STATS_HISTOGRAM_SIZE     16
+
+typedef struct HTABLE_PLANE_STATS {
+    uint32_t size;              /* Count of buckets. */
+    uint32_t n_used;            /* Count of non-empty buckets. */
+    size_t n_nodes;
+} HTABLE_PLANE_STATS;
+
+typedef struct HTABLE_STATS {
+    size_t n;
+    unsigned n_planes;
+    HTABLE_PLANE_STATS planes[2];   /* The current plane, and the old one being migrated. */
+    size_t max_chain;
+    double mean_chain;              /* Mean length of the non-empty chains. */
+    size_t histogram[HTABLE_STATS_HISTOGRAM_SIZE];  /* Count of buckets with a chain of
+                                                     * length i (the last one of length
+                                                     * HTABLE_STATS_HISTOGRAM_SIZE-1 or more). */
+    HTABLE_COUNTERS counters;       /* All zero unless CRE_HTABLE_STATS is defined. */
+} HTABLE_STATS;
+
+/* Retrieve the statistics of the table. Note this has to walk all the planes.
+ */
+void htable_stats(const HTABLE* htable, HTABLE_STATS* stats);
+
+/* Variants of htable_insert(), htable_remove() and htable_lookup() for callers
+ * which already know the hash of the node (or of the key).
+ *
+ * The hash has to be the same value as the hash_func would return for it. The
+ * hash_func is still needed by htable_insert_hashed() and htable_remove_hashed()
+ * for rehashing other nodes when the table grows (unless HTABLE_CACHEHASH is
+ * used).
+ *
+ * htable_insert_unsafe_hashed() relates to htable_insert_unsafe() the same
+ * way.
+ */
+int htable_insert_hashed(HTABLE* htable, HTABLE_NODE* node, uint32_t hash,
+                         HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+int htable_insert_unsafe_hashed(HTABLE* htable, HTABLE_NODE* node, uint32_t hash,
+                                HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+HTABLE_NODE* htable_remove_hashed(HTABLE* htable, const HTABLE_NODE* key, uint32_t hash,
+                                  HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+HTABLE_NODE* htable_lookup_hashed(HTABLE* htable, const HTABLE_NODE* key, uint32_t hash,
+                                  HTABLE_CMP_FUNC cmp_func);
+
+/* Batched variants of htable_lookup() and htable_insert().
+ *
+ * When resolving many keys at once, these are faster than calling the simple
+ * functions in a loop: They compute the hashes of several keys first and issue
+ * prefetches for the respective buckets, so that the memory latency of the
+ * buckets overlaps instead of being paid for each key one after another. The
+ * gain is most pronounced for tables much larger than the CPU caches.
+ *
+ * htable_lookup_batch() looks up all the n keys and stores the found nodes (or
+ * NULL if not found) into the corresponding elements of the results array.
+ *
+ * htable_insert_batch() inserts the n nodes in the given order. It returns
+ * count of nodes inserted. If that is lower than n, the insertion of the node
+ * with that index failed (for the same reasons as htable_insert() may fail)
+ * and no more nodes have been inserted.
+ */
+void htable_lookup_batch(HTABLE* htable, const HTABLE_NODE* const* keys,
+                         HTABLE_NODE** results, size_t n,
+                         HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+size_t htable_insert_batch(HTABLE* htable, HTABLE_NODE* const* nodes, size_t n,
+                           HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+
+
+/* Type-specialized HTABLE.
+ *
+ * HTABLE_DEFINE(name, type, member, hash_fn, eq_fn) generates a family of
+ * functions operating on HTABLE holding structures of the given type (which
+ * embed HTABLE_NODE as the given member):
+ *
+ *   int name_insert(HTABLE* htable, type* item);
+ *   type* name_lookup(HTABLE* htable, const type* key);
+ *   type* name_remove(HTABLE* htable, const type* key);
+ *
+ * These work exactly as htable_insert(), htable_lookup() and htable_remove(),
+ * but the lookup parts are inlined, together with the hash function and the
+ * equality function, which may be functions (preferably inline ones) or
+ * function-like macros:
+ *
+ *   uint32_t hash_fn(const type* item);
+ *   int eq_fn(const type* item1, const type* item2);    // Non-zero if equal.
+ *
+ * For small keys, this avoids most of the cost of calling the callbacks.
+ *
+ * It also generates callbacks name_hash_func and name_cmp_func, usable with
+ * all the other HTABLE functions on the same table (e.g. for htable_fini()).
+ *
+ * Example:
+ *
+ *   typedef struct ITEM { HTABLE_NODE the_node; uint64_t id; } ITEM;
+ *
+ *   #define ITEM_HASH(item)        ((uint32_t) ((item)->id ^ ((item)->id >> 32)))
+ *   #define ITEM_EQ(item1, item2)  ((item1)->id == (item2)->id)
+ *
+ *   HTABLE_DEFINE(item_table, ITEM, the_node, ITEM_HASH, ITEM_EQ)
+ */
+#define HTABLE_DEFINE(name, type, member, hash_fn, eq_fn)                      \
+    HTABLE_INLINE__ uint32_t name##_hash_func(const HTABLE_NODE* node)         \
+            { return hash_fn(HTABLE_DATA(node, const type, member)); }         \
+                                                                                \
+    HTABLE_INLINE__ int name##_cmp_func(const HTABLE_NODE* node1,               \
+                                        const HTABLE_NODE* node2)               \
+            { return !(eq_fn(HTABLE_DATA(node1, const type, member),           \
+                             HTABLE_DATA(node2, const type, member))); }       \
+                                                                                \
+    HTABLE_INLINE__ HTABLE_NODE** name##_lookup_ref__(HTABLE* htable,           \
+                                        const type* key, uint32_t hash)         \
+    {                                                                           \
+        HTABLE_NODE** plane = htable->plane;                                    \
+        uint32_t plane_size = htable->plane_size;                               \
+        uint32_t seed = htable->seed;                                           \
+        while(plane != NULL) {                                                  \
+            HTABLE_NODE** ref = &plane[htable_index__(htable,                   \
+                                        hash, seed, plane_size)];               \
+            while(*ref != NULL) {                                               \
+                if((!(htable->flags & HTABLE_CACHEHASH)  ||                     \
+                    ((HTABLE_NODE_H*) *ref)->hash == hash)  &&                  \
+                   eq_fn(key, HTABLE_DATA(*ref, const type, member)))           \
+                    return ref;                                                 \
+                ref = &(*ref)->next;                                            \
+            }                                                                   \
+            if(plane == htable->old_plane)                                      \
+                break;                                                          \
+            plane = htable->old_plane;                                          \
+            plane_size = htable->old_plane_size;                                \
+            seed = htable->old_seed;                                            \
+        }                                                                       \
+        return NULL;                                                            \
+    }                                                                           \
+                                                                                \
+    HTABLE_INLINE__ type* name##_lookup(HTABLE* htable, const type* key)        \
+    {                                                                           \
+        HTABLE_NODE** ref = name##_lookup_ref__(htable, key, hash_fn(key));     \
+        return (ref != NULL) ? HTABLE_DATA(*ref, type, member) : NULL;          \
+    }                                                                           \
+                                                                                \
+    HTABLE_INLINE__ int name##_insert(HTABLE* htable, type* item)               \
+    {                                                                           \
+        uint32_t hash = hash_fn(item);                                          \
+        if(htable->flags & HTABLE_MULTIMAP)                                     \
+            return htable_insert_hashed(htable, &item->member, hash,            \
+                                        name##_cmp_func, name##_hash_func);     \
+        if(name##_lookup_ref__(htable, item, hash) != NULL)                     \
+            return -1;                                                          \
+        return htable_insert_unsafe_hashed(htable, &item->member, hash,         \
+                                        name##_cmp_func, name##_hash_func);     \
+    }                                                                           \
+                                                                                \
+    HTABLE_INLINE__ type* name##_remove(HTABLE* htable, const type* key)        \
+    {                                                                           \
+        HTABLE_NODE** ref = name##_lookup_ref__(htable, key, hash_fn(key));     \
+        HTABLE_NODE* node;                                                      \
+        if(ref == NULL)                                                         \
+            return NULL;                                                        \
+        node = *ref;                                                            \
+        htable_unlink__(htable, ref, name##_hash_func);                         \
+        return HTABLE_DATA(node, type, member);                                 \
+    }
+
+/* Internals used by HTABLE_DEFINE(). Do not use directly. */
+HTABLE_INLINE__ uint32_t htable_mix__(uint32_t hash)   /* Finalizer of MurmurHash3. */
+        { hash ^= hash >> 16; hash *= 0x85ebca6bU; hash ^= hash >> 13;
+          hash *= 0xc2b2ae35U; hash ^= hash >> 16; return hash; }
+HTABLE_INLINE__ uint32_t htable_index__(const HTABLE* htable, uint32_t hash,
+                                        uint32_t seed, uint32_t plane_size)
+        { if(htable->flags & HTABLE_POW2PLANES)
+              return htable_mix__(hash ^ seed) & (plane_size - 1);
+          return (seed != 0 ? htable_mix__(hash ^ seed) : hash) % plane_size; }
+void htable_unlink__(HTABLE* htable, HTABLE_NODE** ref, HTABLE_HASH_FUNC hash_func);
+
+
+/* Cursor for iterating over all nodes of HTABLE.
+ *
+ * The nodes are visited in the order of the internal buckets (i.e. in no
+ * particular order from the application's point of view):
+ *
+ *   HTABLE_CURSOR cur;
+ *   HTABLE_NODE* node;
+ *
+ *   for(node = htable_first(&htable, &cur); node != NULL; node = htable_next(&cur)) {
+ *       if(is_stale(node))
+ *           free_node(htable_remove_at_cursor(&cur));
+ *   }
+ *
+ * While the iteration is in progress, the table must not be modified by any
+ * other means than htable_remove_at_cursor().
+ *
+ * The members of the structure are private.
+ */
+typedef struct HTABLE_CURSOR {
+    HTABLE* htable;
+    HTABLE_NODE** ref;          /* Reference to the current node. */
+    HTABLE_NODE* node;          /* The current node (NULL if removed). */
+    uint32_t index;             /* Bucket index of the current node. */
+    int in_old_plane;
+    const HTABLE_NODE* key;     /* Only for htable_lookup_all(). */
+    uint32_t hash;
+} HTABLE_CURSOR;
+
+/* Start the iteration. Returns the first node, or NULL if the table is empty.
+ */
+HTABLE_NODE* htable_first(HTABLE* htable, HTABLE_CURSOR* cursor);
+
+/* Move to the next node. Returns the node, or NULL if there are no more nodes.
+ */
+HTABLE_NODE* htable_next(HTABLE_CURSOR* cursor);
+
+/* Remove the current node of the cursor from the table.
+ *
+ * This is cheap: Unlike htable_remove(), it calls neither the hash function
+ * nor the comparator function. Subsequent htable_next() then continues with
+ * the node following the removed one.
+ *
+ * The table does not shrink while the iteration is in progress; only when it
+ * reaches the end. If you stop the iteration earlier after removing many
+ * nodes, call htable_compact() afterwards.
+ *
+ * Returns the removed node (so caller may e.g. free any resources associated
+ * with it), or NULL if the current node has already been removed.
+ */
+HTABLE_NODE* htable_remove_at_cursor(HTABLE_CURSOR* cursor);
+
+/* Iterate over all nodes equal to the key (see HTABLE_MULTIMAP):
+ *
+ *   for(node = htable_lookup_all(&htable, key, &cur, cmp_func, hash_func);
+ *       node != NULL;
+ *       node = htable_next_equal(&cur, cmp_func))
+ *   {
+ *       ...
+ *   }
+ *
+ * The key has to stay valid while the cursor is in use. The current node may
+ * be removed by htable_remove_at_cursor(). Do not mix htable_next_equal() and
+ * htable_next() on the same cursor.
+ */
+HTABLE_NODE* htable_lookup_all(HTABLE* htable, const HTABLE_NODE* key, HTABLE_CURSOR* cursor,
+                               HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+HTABLE_NODE* htable_next_equal(HTABLE_CURSOR* cursor, HTABLE_CMP_FUNC cmp_func);
+
+/* Returns count of nodes equal to the key (see HTABLE_MULTIMAP).
+ */
+size_t htable_count(HTABLE* htable, const HTABLE_NODE* key,
+                    HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+
+
+/* HTABLE_SHARDED is a set of HTABLE tables (shards), where every node lives in
+ * the shard determined by the high bits of its hash.
+ *
+ * It is meant for parallel aggregation: Every worker thread fills its own
+ * private HTABLE_SHARDED (all created with the same shard_bits), and at the
+ * end the results are merged by htable_sharded_merge_shard(). As the merging
+ * of each shard is independent of all the others, the calls for different
+ * shards may run in parallel, each in its own thread, without any locking.
+ */
+typedef struct HTABLE_SHARDED {
+    HTABLE* shards;
+    unsigned shard_bits;
+} HTABLE_SHARDED;
+
+/* Merge function type for htable_sharded_merge_shard().
+ *
+ * It is called when the target already holds a node (dst) equal to the node
+ * being merged (src). It should fold the data of src into dst. The src node
+ * is then no longer in any table, so the function is also responsible for
+ * releasing it (if needed).
+ */
+typedef void (*HTABLE_MERGE_FUNC)(HTABLE_NODE* dst, HTABLE_NODE* src);
+
+/* Initialize the table with (1 << shard_bits) shards, each initialized by
+ * htable_init_ex() with the given flags. The shard_bits may be at most 16.
+ *
+ * Returns 0 on success or -1 on failure.
+ */
+int htable_sharded_init(HTABLE_SHARDED* htable, unsigned shard_bits, unsigned flags);
+
+/* Counterpart of htable_fini(). */
+void htable_sharded_fini(HTABLE_SHARDED* htable, void (*dtor_func)(HTABLE_NODE*));
+
+/* Returns count of shards. */
+HTABLE_INLINE__ unsigned htable_sharded_count(const HTABLE_SHARDED* htable)
+        { return (1U << htable->shard_bits); }
+
+/* Returns index of the shard where a node of the given hash belongs. */
+HTABLE_INLINE__ unsigned htable_sharded_index(const HTABLE_SHARDED* htable, uint32_t hash)
+        { return (htable->shard_bits > 0) ? (unsigned) (hash >> (32 - htable->shard_bits)) : 0; }
+
+/* Returns the given shard, e.g. for iterating over it with HTABLE_CURSOR. */
+HTABLE_INLINE__ HTABLE* htable_sharded_shard(HTABLE_SHARDED* htable, unsigned shard)
+        { return &htable->shards[shard]; }
+
+/* Counterparts of htable_insert(), htable_remove() and htable_lookup(). They
+ * compute the hash just once, and use it both for choosing the shard and
+ * within the shard.
+ */
+int htable_sharded_insert(HTABLE_SHARDED* htable, HTABLE_NODE* node,
+                          HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+HTABLE_NODE* htable_sharded_remove(HTABLE_SHARDED* htable, const HTABLE_NODE* key,
+                                   HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+HTABLE_NODE* htable_sharded_lookup(HTABLE_SHARDED* htable, const HTABLE_NODE* key,
+                                   HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+
+/* Move all nodes of the given shard of all the n_srcs source tables into the
+ * same shard of the target table. Nodes whose key is already present in the
+ * target are handed to merge_func (unless the target is HTABLE_MULTIMAP; then
+ * all the nodes are simply moved).
+ *
+ * All the tables must have the same shard_bits.
+ *
+ * Returns 0 on success, or -1 if an internal memory allocation fails (then
+ * some nodes may remain in the source tables).
+ */
+int htable_sharded_merge_shard(HTABLE_SHARDED* dst, HTABLE_SHARDED* const* srcs,
+                               unsigned n_srcs, unsigned shard,
+                               HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func,
+                               HTABLE_MERGE_FUNC merge_func);
+
+
+/* HTABLE_FLAT is an open-addressing flavour of the hash table above.
+ *
+ * It uses the same node type and the same callbacks as HTABLE, and the API
+ * mirrors it, so that application may switch a particular table between the
+ * two flavours just by changing the function names.
+ *
+ * Instead of chaining colliding nodes through HTABLE_NODE::next, the table
+ * stores pointers to the nodes in a flat array of slots. For every slot, it
+ * also maintains a single byte of metadata holding 7 bits of the node's hash.
+ * Lookups then examine the metadata of 16 slots at once (with SSE2 if
+ * available), and they follow a pointer into the nodes only when the metadata
+ * suggests a match. This is considerably more cache friendly for very large
+ * tables.
+ *
+ * Note the member HTABLE_NODE::next is not used by HTABLE_FLAT at all.
+ */
+typedef struct HTABLE_FLAT {
+    HTABLE_NODE** slots;
+    uint8_t* ctrl;
+    size_t capacity;
+    size_t n;
+    size_t n_deleted;
+} HTABLE_FLAT;
+
+
+#define HTABLE_FLAT_INITIALIZER         { NULL, NULL, 0, 0, 0 }
+
+HTABLE_INLINE__ void htable_flat_init(HTABLE_FLAT* htable)
+        { htable->slots = NULL; htable->ctrl = NULL; htable->capacity = 0;
+          htable->n = 0; htable->n_deleted = 0; }
+
+/* Counterpart of htable_fini(). */
+void htable_flat_fini(HTABLE_FLAT* htable, void (*dtor_func)(HTABLE_NODE*));
+
+/* Counterpart of htable_is_empty(). */
+HTABLE_INLINE__ int htable_flat_is_empty(HTABLE_FLAT* htable)
+        { return (htable->n == 0); }
+
+/* Counterparts of htable_insert(), htable_insert_unsafe(), htable_remove()
+ * and htable_lookup(). They have the same semantics as those.
+ */
+int htable_flat_insert(HTABLE_FLAT* htable, HTABLE_NODE* node,
+                       HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+int htable_flat_insert_unsafe(HTABLE_FLAT* htable, HTABLE_NODE* node,
+                              HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+HTABLE_NODE* htable_flat_remove(HTABLE_FLAT* htable, const HTABLE_NODE* key,
+                                HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+HTABLE_NODE* htable_flat_lookup(HTABLE_FLAT* htable, const HTABLE_NODE* key,
+                                HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+
+
+/* HTABLE_CONC is a flavour of the hash table which allows lock-free lookups
+ * concurrently with modifications of the table.
+ *
+ * It uses the same node type and the same callbacks as HTABLE. Modifications
+ * (insert, remove) have to be serialized by the caller (e.g. by a mutex), but
+ * lookups may run concurrently with them (and with each other) in any count of
+ * threads without taking any lock.
+ *
+ * Every lookup has to be performed inside a read-side section, delimited by
+ * htable_conc_read_begin() and htable_conc_read_end(). Each reading thread has
+ * to use its own reader index, lower than n_readers passed to
+ * htable_conc_init(). The section guarantees that the nodes found, as well as
+ * internal data of the table, are not released while the section lasts; the
+ * read-side section must not be nested and it should be kept short.
+ *
+ * A removed node may still be in use by readers which found it before it has
+ * been removed. Before releasing the node, call htable_conc_synchronize(),
+ * which waits until all read-side sections in progress are over. (For many
+ * nodes removed at once, a single call is enough.)
+ *
+ * Unlike HTABLE, the table consists of a single plane, so a lookup examines
+ * just one chain of nodes. When the plane gets too populated (or too empty),
+ * the writer replaces it with a plane twice as large (or small) and relinks
+ * the chains in place, in steps which cannot make any concurrent lookup miss
+ * a node. Because the writer waits for the readers between the steps (like
+ * htable_conc_synchronize() does), it must not call the modifying functions
+ * from inside a read-side section.
+ */
+typedef struct HTABLE_CONC_PLANE HTABLE_CONC_PLANE;
+typedef struct HTABLE_CONC_READER HTABLE_CONC_READER;
+
+typedef struct HTABLE_CONC {
+    HTABLE_CONC_PLANE* plane;
+    HTABLE_CONC_READER* readers;
+    unsigned n_readers;
+    unsigned long epoch;
+    size_t n;
+} HTABLE_CONC;
+
+
+/* Initialize the table for use by up to n_readers concurrent reading threads.
+ *
+ * Returns 0 on success or -1 on failure.
+ */
+int htable_conc_init(HTABLE_CONC* htable, unsigned n_readers);
+
+/* Counterpart of htable_fini(). It must not run concurrently with any other
+ * operation on the table, including lookups.
+ */
+void htable_conc_fini(HTABLE_CONC* htable, void (*dtor_func)(HTABLE_NODE*));
+
+/* Counterpart of htable_is_empty(). */
+HTABLE_INLINE__ int htable_conc_is_empty(HTABLE_CONC* htable)
+        { return (htable->n == 0); }
+
+/* Counterparts of htable_insert(), htable_insert_unsafe() and htable_remove().
+ * The calls have to be serialized by the caller.
+ */
+int htable_conc_insert(HTABLE_CONC* htable, HTABLE_NODE* node,
+                       HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+int htable_conc_insert_unsafe(HTABLE_CONC* htable, HTABLE_NODE* node,
+                              HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+HTABLE_NODE* htable_conc_remove(HTABLE_CONC* htable, const HTABLE_NODE* key,
+                                HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+
+/* Counterpart of htable_lookup(). It must be called inside a read-side section
+ * (unless called by the writer), and the found node may only be used until
+ * the section ends.
+ */
+HTABLE_NODE* htable_conc_lookup(HTABLE_CONC* htable, const HTABLE_NODE* key,
+                                HTABLE_CMP_FUNC cmp_func, HTABLE_HASH_FUNC hash_func);
+
+/* Begin and end a read-side section of the reader identified by the index.
+ */
+void htable_conc_read_begin(HTABLE_CONC* htable, unsigned reader);
+void htable_conc_read_end(HTABLE_CONC* htable, unsigned reader);
+
+/* Wait until all read-side sections, which are in progress at the time of
+ * the call, end. It has to be called by the writer (i.e. serialized with the
+ * modifications).
+ */
+void htable_conc_synchronize(HTABLE_CONC* htable);
+
 
 #ifdef __cplusplus
 }  /* extern "C" { */
@@ -0,0 +1,214 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "intmap.h"
+
+#include <string.h>
+
+
+#define INTMAP_MIN_CAPACITY             16
+
+/* We keep the load factor below 3/4, as the linear probing degrades quickly
+ * with higher ones. */
+#define INTMAP_TOO_FULL(map)            ((map)->n >= (map)->capacity - (map)->capacity / 4)
+#define INTMAP_TOO_EMPTY(map)           ((map)->n < (map)->capacity / 8)
+
+
+/* Finalizer of MurmurHash3 (64-bit variant). As we select the slot by a bit
+ * mask, we need all bits of the key to affect the low bits of the hash, or
+ * keys like 0x1000, 0x2000, 0x3000 would all collide. */
+static uint64_t
+intmap_hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+/* Returns index of the slot holding the key, or of the empty slot where the
+ * probing for the key ends. The map must not be empty. */
+static size_t
+intmap_find(const INTMAP* map, uint64_t key)
+{
+    size_t mask = map->capacity - 1;
+    size_t index = (size_t) intmap_hash(key) & mask;
+
+    while(map->slots[index].key != key  &&  map->slots[index].key != INTMAP_EMPTY_KEY)
+        index = (index + 1) & mask;
+
+    return index;
+}
+
+static int
+intmap_resize(INTMAP* map, size_t capacity)
+{
+    INTMAP_SLOT* old_slots = map->slots;
+    size_t old_capacity = map->capacity;
+    INTMAP_SLOT* slots;
+    size_t i;
+
+    slots = (INTMAP_SLOT*) malloc(capacity * sizeof(INTMAP_SLOT));
+    if(slots == NULL)
+        return -1;
+
+    /* All bits set make INTMAP_EMPTY_KEY. */
+    memset(slots, 0xff, capacity * sizeof(INTMAP_SLOT));
+
+    map->slots = slots;
+    map->capacity = capacity;
+
+    for(i = 0; i < old_capacity; i++) {
+        if(old_slots[i].key != INTMAP_EMPTY_KEY)
+            map->slots[intmap_find(map, old_slots[i].key)] = old_slots[i];
+    }
+
+    free(old_slots);
+    return 0;
+}
+
+int
+intmap_reserve(INTMAP* map, size_t n)
+{
+    size_t capacity = INTMAP_MIN_CAPACITY;
+
+    while(n >= capacity - capacity / 4) {
+        /* Refuse sizes whose slot array would not fit into size_t. */
+        if(capacity > SIZE_MAX / 2 / sizeof(INTMAP_SLOT))
+            return -1;
+        capacity *= 2;
+    }
+
+    if(capacity <= map->capacity)
+        return 0;
+    return intmap_resize(map, capacity);
+}
+
+int
+intmap_insert(INTMAP* map, uint64_t key, uint64_t value)
+{
+    size_t index;
+
+    if(key == INTMAP_EMPTY_KEY)
+        return -1;
+
+    if(map->capacity == 0  ||  INTMAP_TOO_FULL(map)) {
+        if(intmap_resize(map, (map->capacity > 0) ? 2 * map->capacity : INTMAP_MIN_CAPACITY) != 0)
+            return -1;
+    }
+
+    index = intmap_find(map, key);
+    if(map->slots[index].key == key)
+        return -1;
+
+    map->slots[index].key = key;
+    map->slots[index].value = value;
+    map->n++;
+    return 0;
+}
+
+uint64_t*
+intmap_lookup(const INTMAP* map, uint64_t key)
+{
+    size_t index;
+
+    if(map->n == 0  ||  key == INTMAP_EMPTY_KEY)
+        return NULL;
+
+    index = intmap_find(map, key);
+    if(map->slots[index].key != key)
+        return NULL;
+    return &map->slots[index].value;
+}
+
+int
+intmap_remove(INTMAP* map, uint64_t key, uint64_t* p_value)
+{
+    size_t mask;
+    size_t i, j;
+
+    if(map->n == 0  ||  key == INTMAP_EMPTY_KEY)
+        return -1;
+
+    i = intmap_find(map, key);
+    if(map->slots[i].key != key)
+        return -1;
+
+    if(p_value != NULL)
+        *p_value = map->slots[i].value;
+
+    /* Instead of leaving a tombstone behind, shift back any following entries
+     * which would otherwise become unreachable, i.e. those whose probing
+     * starts at or before the vacated slot (cyclically). */
+    mask = map->capacity - 1;
+    j = i;
+    while(1) {
+        size_t home;
+
+        j = (j + 1) & mask;
+        if(map->slots[j].key == INTMAP_EMPTY_KEY)
+            break;
+
+        home = (size_t) intmap_hash(map->slots[j].key) & mask;
+        if(((j - home) & mask) >= ((j - i) & mask)) {
+            map->slots[i] = map->slots[j];
+            i = j;
+        }
+    }
+    map->slots[i].key = INTMAP_EMPTY_KEY;
+    map->n--;
+
+    if(map->n == 0) {
+        intmap_fini(map);
+    } else if(map->capacity > INTMAP_MIN_CAPACITY  &&  INTMAP_TOO_EMPTY(map)) {
+        /* No error checking here: If the resize fails, we still have valid
+         * albeit bloated map. */
+        intmap_resize(map, map->capacity / 2);
+    }
+
+    return 0;
+}
+
+int
+intmap_next(const INTMAP* map, size_t* p_iter, uint64_t* p_key, uint64_t* p_value)
+{
+    size_t i;
+
+    for(i = *p_iter; i < map->capacity; i++) {
+        if(map->slots[i].key != INTMAP_EMPTY_KEY) {
+            if(p_key != NULL)
+                *p_key = map->slots[i].key;
+            if(p_value != NULL)
+                *p_value = map->slots[i].value;
+            *p_iter = i + 1;
+            return 1;
+        }
+    }
+
+    *p_iter = map->capacity;
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef CRE_INTMAP_H
+#define CRE_INTMAP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#if defined __cplusplus
+    #define INTMAP_INLINE__     inline
+#elif defined __STDC_VERSION__ && __STDC_VERSION__ >= 199901L
+    #define INTMAP_INLINE__     static inline
+#elif defined __GNUC__
+    #define INTMAP_INLINE__     static __inline__
+#elif defined _MSC_VER
+    #define INTMAP_INLINE__     static __inline
+#else
+    #define INTMAP_INLINE__     static
+#endif
+
+
+/* INTMAP is a hash map from uint64_t keys to uint64_t values.
+ *
+ * Unlike HTABLE, it is not intrusive: The keys and values are stored directly
+ * in a flat array of slots, and collisions are resolved by linear probing. So
+ * there is no per-entry allocation, no per-entry pointer, and no callbacks.
+ *
+ * The key INTMAP_EMPTY_KEY is reserved to mark empty slots, so it cannot be
+ * stored in the map.
+ */
+#define INTMAP_EMPTY_KEY        UINT64_MAX
+
+typedef struct INTMAP_SLOT {
+    uint64_t key;
+    uint64_t value;
+} INTMAP_SLOT;
+
+typedef struct INTMAP {
+    INTMAP_SLOT* slots;
+    size_t capacity;            /* Zero or a power of two. */
+    size_t n;
+} INTMAP;
+
+
+/* Static initializer. */
+#define INTMAP_INITIALIZER      { NULL, 0, 0 }
+
+/* Initialize/deinitialize the map. */
+INTMAP_INLINE__ void intmap_init(INTMAP* map)
+        { map->slots = NULL; map->capacity = 0; map->n = 0; }
+INTMAP_INLINE__ void intmap_fini(INTMAP* map)
+        { free(map->slots); intmap_init(map); }
+
+INTMAP_INLINE__ size_t intmap_size(const INTMAP* map)
+        { return map->n; }
+INTMAP_INLINE__ int intmap_is_empty(const INTMAP* map)
+        { return (map->n == 0); }
+
+/* Make the map ready to hold n entries without any further growing.
+ *
+ * Returns 0 on success or -1 on failure.
+ */
+int intmap_reserve(INTMAP* map, size_t n);
+
+/* Insert a new entry into the map.
+ *
+ * Returns 0 on success or -1 on failure. The function fails if an internal
+ * memory allocation fails, if the key is INTMAP_EMPTY_KEY, or if the key is
+ * already present.
+ */
+int intmap_insert(INTMAP* map, uint64_t key, uint64_t value);
+
+/* Look up value associated with the key.
+ *
+ * Returns pointer to the value (so caller may also update it in place), or
+ * NULL if the key is not present. The pointer is valid only until the map is
+ * modified.
+ */
+uint64_t* intmap_lookup(const INTMAP* map, uint64_t key);
+
+/* Remove the entry with the given key.
+ *
+ * Returns 0 on success (and if p_value is not NULL, stores there the removed
+ * value), or -1 if the key is not present.
+ */
+int intmap_remove(INTMAP* map, uint64_t key, uint64_t* p_value);
+
+/* Iterate over all the entries (in no particular order):
+ *
+ *   size_t iter = 0;
+ *   uint64_t key, value;
+ *
+ *   while(intmap_next(&map, &iter, &key, &value)) {
+ *       ...
+ *   }
+ *
+ * Returns non-zero and stores the key and the value (where not NULL) of the
+ * next entry, or zero when there are no more entries. The map must not be
+ * modified during the iteration.
+ */
+int intmap_next(const INTMAP* map, size_t* p_iter, uint64_t* p_key, uint64_t* p_value);
+
+
+#ifdef __cplusplus
+}  /* extern "C" { */
+#endif
+
+#endif  /* #ifndef CRE_INTMAP_H */
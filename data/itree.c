@@ -0,0 +1,139 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "itree.h"
+
+
+#define NODE(rbnode)        ((ITREE_NODE*) (rbnode))
+
+
+void
+itree_augment__(RBTREE_NODE* rbnode)
+{
+    ITREE_NODE* node = NODE(rbnode);
+    RBTREE_NODE* left = rbtree_left(rbnode);
+    RBTREE_NODE* right = rbtree_right(rbnode);
+    int64_t max_end = node->end;
+
+    if(left != NULL  &&  NODE(left)->max_end > max_end)
+        max_end = NODE(left)->max_end;
+    if(right != NULL  &&  NODE(right)->max_end > max_end)
+        max_end = NODE(right)->max_end;
+    node->max_end = max_end;
+}
+
+/* Order by start, then by end. Equal intervals are ordered by the address of
+ * the node so that they may coexist in the tree, and so that itree_remove()
+ * finds the exact node. */
+static int
+itree_cmp(const RBTREE_NODE* rbnode1, const RBTREE_NODE* rbnode2)
+{
+    const ITREE_NODE* node1 = (const ITREE_NODE*) rbnode1;
+    const ITREE_NODE* node2 = (const ITREE_NODE*) rbnode2;
+
+    if(node1->start != node2->start)
+        return (node1->start < node2->start) ? -1 : +1;
+    if(node1->end != node2->end)
+        return (node1->end < node2->end) ? -1 : +1;
+    if(node1 != node2)
+        return ((uintptr_t) node1 < (uintptr_t) node2) ? -1 : +1;
+    return 0;
+}
+
+int
+itree_insert(ITREE* itree, ITREE_NODE* node, int64_t start, int64_t end)
+{
+    if(start > end)
+        return -1;
+
+    node->start = start;
+    node->end = end;
+    node->max_end = end;
+    return rbtree_insert(&itree->tree, &node->node, itree_cmp);
+}
+
+void
+itree_remove(ITREE* itree, ITREE_NODE* node)
+{
+    rbtree_remove(&itree->tree, &node->node, itree_cmp);
+}
+
+
+typedef struct ITREE_QUERY {
+    int64_t lo;
+    int64_t hi;
+    int (*callback)(ITREE_NODE*, void*);
+    void* ctx;
+    size_t n;
+    int stop;
+} ITREE_QUERY;
+
+static void
+itree_overlap_recurse(ITREE_QUERY* query, RBTREE_NODE* rbnode)
+{
+    ITREE_NODE* node;
+
+    while(rbnode != NULL  &&  !query->stop) {
+        node = NODE(rbnode);
+
+        /* No interval in the subtree reaches the query. */
+        if(node->max_end < query->lo)
+            return;
+
+        itree_overlap_recurse(query, rbtree_left(rbnode));
+        if(query->stop)
+            return;
+
+        /* The node and all the nodes in its right subtree start too late. */
+        if(node->start > query->hi)
+            return;
+
+        if(node->end >= query->lo) {
+            query->n++;
+            if(query->callback != NULL  &&  query->callback(node, query->ctx) != 0)
+                query->stop = 1;
+        }
+
+        /* Tail recursion into the right subtree. */
+        rbnode = rbtree_right(rbnode);
+    }
+}
+
+size_t
+itree_overlap(ITREE* itree, int64_t lo, int64_t hi,
+              int (*callback)(ITREE_NODE* node, void* ctx), void* ctx)
+{
+    ITREE_QUERY query;
+
+    query.lo = lo;
+    query.hi = hi;
+    query.callback = callback;
+    query.ctx = ctx;
+    query.n = 0;
+    query.stop = 0;
+
+    itree_overlap_recurse(&query, itree->tree.root);
+    return query.n;
+}
@@ -0,0 +1,139 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef CRE_ITREE_H
+#define CRE_ITREE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "rbtree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#if defined __cplusplus
+    #define ITREE_INLINE__      inline
+#elif defined __STDC_VERSION__ && __STDC_VERSION__ >= 199901L
+    #define ITREE_INLINE__      static inline
+#elif defined __GNUC__
+    #define ITREE_INLINE__      static __inline__
+#elif defined _MSC_VER
+    #define ITREE_INLINE__      static __inline
+#else
+    #define ITREE_INLINE__      static
+#endif
+
+
+/* Intrusive interval tree.
+ *
+ * It is an augmented RBTREE: Every node holds a closed interval [start, end]
+ * and additionally a maximum of the interval ends in its subtree. That allows
+ * to find all the intervals overlapping a given interval (or containing a
+ * given point) in O(log n + k) time, where k is the count of the reported
+ * intervals.
+ *
+ * Like RBTREE, it never allocates any memory on its own. Embed ITREE_NODE in
+ * your own structure and use ITREE_DATA to get back to it. Multiple equal
+ * intervals may be stored in the tree.
+ */
+
+
+/* Node structure. The members start and end may be read by the application
+ * (but they must not be modified as long as the node is in the tree).
+ * Treat the rest as opaque.
+ */
+typedef struct ITREE_NODE {
+    RBTREE_NODE node;
+    int64_t start;
+    int64_t end;
+    int64_t max_end;
+} ITREE_NODE;
+
+/* Tree structure. Treat as opaque.
+ */
+typedef struct ITREE {
+    RBTREE tree;
+} ITREE;
+
+
+/* Macro for getting pointer to the structure holding the itree node data.
+ */
+#define ITREE_DATA(node_ptr, type, member)      RBTREE_DATA(node_ptr, type, member)
+
+
+void itree_augment__(RBTREE_NODE* node);
+
+/* The tree has to be initialized before it is used by any other function.
+ */
+ITREE_INLINE__ void itree_init(ITREE* itree)
+        { rbtree_init_augmented(&itree->tree, 0, itree_augment__); }
+
+#define ITREE_INITIALIZER       { RBTREE_INITIALIZER_AUGMENTED(0, itree_augment__) }
+
+
+/* Check whether the tree is empty. Returns non-zero if empty, zero otherwise.
+ */
+ITREE_INLINE__ int itree_is_empty(const ITREE* itree)
+        { return rbtree_is_empty(&itree->tree); }
+
+/* Disconnect the nodes from the tree one by one; see rbtree_fini_step().
+ */
+ITREE_INLINE__ ITREE_NODE* itree_fini_step(ITREE* itree)
+        { return (ITREE_NODE*) rbtree_fini_step(&itree->tree); }
+
+
+/* Insert the node into the tree, representing the interval [start, end].
+ *
+ * Returns 0 on success, or -1 if the interval is invalid (start > end).
+ */
+int itree_insert(ITREE* itree, ITREE_NODE* node, int64_t start, int64_t end);
+
+/* Remove the node from the tree.
+ */
+void itree_remove(ITREE* itree, ITREE_NODE* node);
+
+
+/* Call the callback for every interval in the tree overlapping with the
+ * interval [lo, hi] (i.e. start <= hi && lo <= end), in the ascending order
+ * of their starts. E.g. lo == hi asks for all intervals containing the point.
+ *
+ * If the callback returns non-zero, the query stops. The callback must not
+ * modify the tree. It may be NULL if the caller is interested only in the
+ * count.
+ *
+ * Returns count of the intervals the callback has been called for.
+ */
+size_t itree_overlap(ITREE* itree, int64_t lo, int64_t hi,
+                     int (*callback)(ITREE_NODE* node, void* ctx), void* ctx);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* CRE_ITREE_H */
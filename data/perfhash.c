@@ -0,0 +1,443 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "perfhash.h"
+
+#include <string.h>
+
+
+/* Layout of the blob:
+ *
+ *   - PERFHASH_HEADER;
+ *   - displacements: a pair of uint32_t (d0, d1) for every bucket;
+ *   - slots: uint32_t for every slot, i.e. an offset (from the beginning of
+ *     the blob) of a key record;
+ *   - key records: PERFHASH_RECORD followed by the key data, each padded to a
+ *     multiple of 4 bytes.
+ *
+ * The key with hash h belongs to bucket b = PERFHASH_BUCKET(h) and it lives in
+ * slot (f1(h) + d0[b] * f2(h) + d1[b]) % n.
+ */
+#define PERFHASH_MAGIC              0x48504352U     /* "CRPH" in little endian. */
+#define PERFHASH_VERSION            1
+
+typedef struct PERFHASH_HEADER {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n;
+    uint32_t n_buckets;
+    uint64_t seed;
+    uint64_t size;
+} PERFHASH_HEADER;
+
+typedef struct PERFHASH_RECORD {
+    uint32_t index;
+    uint32_t size;
+} PERFHASH_RECORD;
+
+#define PERFHASH_ALIGN(size)        (((size) + 3) & ~(size_t) 3)
+
+/* Average count of keys per bucket. Higher values make the blob smaller but
+ * the build slower. */
+#define PERFHASH_LAMBDA             4
+
+/* How many values of d0 we try for a bucket before we give up and start over
+ * with a different seed. */
+#define PERFHASH_MAX_D0             32
+#define PERFHASH_MAX_ATTEMPTS       16
+
+
+static uint64_t
+perfhash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* FNV-1a (64-bit variant), with the seed mixed into the offset basis, and
+ * finalized by the MurmurHash3 finalizer to spread the bits. */
+static uint64_t
+perfhash_hash(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* ptr = (const uint8_t*) data;
+    uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+    size_t i;
+
+    for(i = 0; i < size; i++) {
+        h ^= ptr[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    return perfhash_mix(h);
+}
+
+#define PERFHASH_BUCKET(h, n_buckets)   ((uint32_t) ((h) >> 32) % (n_buckets))
+#define PERFHASH_F1(h, n)               ((uint32_t) (h) % (n))
+#define PERFHASH_F2(h, n)               ((uint32_t) perfhash_mix((h) ^ 0x9e3779b97f4a7c15ULL) % (n))
+
+static uint32_t
+perfhash_slot(uint32_t f1, uint32_t f2, uint32_t n, uint32_t d0, uint32_t d1)
+{
+    return (uint32_t) (((uint64_t) f1 + (uint64_t) d0 * f2 + d1) % n);
+}
+
+
+/* Working data of the builder. */
+typedef struct PERFHASH_BUILD {
+    const PERFHASH_KEY* keys;
+    uint32_t n;
+    uint32_t n_buckets;
+    uint64_t* hashes;           /* [n] */
+    uint32_t* f;                /* [2 * n] Precomputed f1 and f2 of every key. */
+    uint32_t* bucket_start;     /* [n_buckets + 1] */
+    uint32_t* bucket_keys;      /* [n] Key indexes, grouped by buckets. */
+    uint32_t* bucket_order;     /* [n_buckets] From the largest bucket. */
+    uint32_t* displacements;    /* [2 * n_buckets] */
+    uint32_t* slot_keys;        /* [n] Key index for every slot, or UINT32_MAX. */
+    uint32_t* tmp_slots;        /* [max. bucket size] */
+} PERFHASH_BUILD;
+
+/* Returns 0 on success, 1 if we should retry with another seed, or -1 if the
+ * keys are not distinct. */
+static int
+perfhash_try(PERFHASH_BUILD* b, uint64_t seed)
+{
+    uint32_t* count;
+    uint32_t max_size = 0;
+    uint32_t free_slot = 0;
+    uint32_t i, j, k;
+
+    for(i = 0; i < b->n; i++) {
+        b->hashes[i] = perfhash_hash(b->keys[i].data, b->keys[i].size, seed);
+        b->f[2*i] = PERFHASH_F1(b->hashes[i], b->n);
+        b->f[2*i+1] = PERFHASH_F2(b->hashes[i], b->n);
+    }
+
+    /* Group the keys by the buckets (counting sort). */
+    memset(b->bucket_start, 0, (b->n_buckets + 1) * sizeof(uint32_t));
+    for(i = 0; i < b->n; i++)
+        b->bucket_start[PERFHASH_BUCKET(b->hashes[i], b->n_buckets) + 1]++;
+    for(i = 0; i < b->n_buckets; i++) {
+        if(b->bucket_start[i+1] > max_size)
+            max_size = b->bucket_start[i+1];
+        b->bucket_start[i+1] += b->bucket_start[i];
+    }
+    /* (We temporarily use the slot_keys as a vector of write positions.) */
+    memcpy(b->slot_keys, b->bucket_start, b->n_buckets * sizeof(uint32_t));
+    for(i = 0; i < b->n; i++)
+        b->bucket_keys[b->slot_keys[PERFHASH_BUCKET(b->hashes[i], b->n_buckets)]++] = i;
+
+    /* Keys with the same (full) hash would never get into distinct slots. */
+    for(i = 0; i < b->n_buckets; i++) {
+        for(j = b->bucket_start[i]; j < b->bucket_start[i+1]; j++) {
+            for(k = j + 1; k < b->bucket_start[i+1]; k++) {
+                const PERFHASH_KEY* key1 = &b->keys[b->bucket_keys[j]];
+                const PERFHASH_KEY* key2 = &b->keys[b->bucket_keys[k]];
+
+                if(b->hashes[b->bucket_keys[j]] != b->hashes[b->bucket_keys[k]])
+                    continue;
+                if(key1->size == key2->size  &&  memcmp(key1->data, key2->data, key1->size) == 0)
+                    return -1;
+                return 1;
+            }
+        }
+    }
+
+    /* Order the buckets from the largest one (counting sort again). */
+    count = (uint32_t*) calloc(max_size + 2, sizeof(uint32_t));
+    if(count == NULL)
+        return -1;
+    for(i = 0; i < b->n_buckets; i++)
+        count[max_size - (b->bucket_start[i+1] - b->bucket_start[i]) + 1]++;
+    for(i = 0; i <= max_size; i++)
+        count[i+1] += count[i];
+    for(i = 0; i < b->n_buckets; i++)
+        b->bucket_order[count[max_size - (b->bucket_start[i+1] - b->bucket_start[i])]++] = i;
+    free(count);
+
+    /* Place the buckets. */
+    memset(b->slot_keys, 0xff, b->n * sizeof(uint32_t));
+    memset(b->displacements, 0, 2 * (size_t) b->n_buckets * sizeof(uint32_t));
+    for(i = 0; i < b->n_buckets; i++) {
+        uint32_t bucket = b->bucket_order[i];
+        uint32_t start = b->bucket_start[bucket];
+        uint32_t size = b->bucket_start[bucket+1] - start;
+        uint32_t d0, d1;
+        int placed = 0;
+
+        if(size == 0)
+            break;  /* All the remaining buckets are empty too. */
+
+        if(size == 1) {
+            /* A single key can go directly to any free slot. As the remaining
+             * buckets are all of this kind, just fill the free slots in order. */
+            uint32_t key = b->bucket_keys[start];
+
+            while(b->slot_keys[free_slot] != UINT32_MAX)
+                free_slot++;
+            b->slot_keys[free_slot] = key;
+            b->displacements[2 * bucket] = 0;
+            b->displacements[2 * bucket + 1] = (free_slot + b->n - b->f[2*key]) % b->n;
+            continue;
+        }
+
+        for(d0 = 0; d0 < PERFHASH_MAX_D0  &&  !placed; d0++) {
+            for(d1 = 0; d1 < b->n  &&  !placed; d1++) {
+                for(j = 0; j < size; j++) {
+                    uint32_t key = b->bucket_keys[start + j];
+                    uint32_t slot = perfhash_slot(b->f[2*key], b->f[2*key+1], b->n, d0, d1);
+
+                    if(b->slot_keys[slot] != UINT32_MAX)
+                        break;
+                    for(k = 0; k < j; k++) {
+                        if(b->tmp_slots[k] == slot)
+                            break;
+                    }
+                    if(k < j)
+                        break;
+                    b->tmp_slots[j] = slot;
+                }
+
+                if(j == size) {
+                    for(j = 0; j < size; j++)
+                        b->slot_keys[b->tmp_slots[j]] = b->bucket_keys[start + j];
+                    b->displacements[2 * bucket] = d0;
+                    b->displacements[2 * bucket + 1] = d1;
+                    placed = 1;
+                }
+            }
+        }
+
+        if(!placed)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+perfhash_write(PERFHASH_BUILD* b, uint64_t seed, void** p_blob, size_t* p_size)
+{
+    PERFHASH_HEADER header;
+    size_t size;
+    size_t off;
+    uint8_t* blob;
+    uint32_t* slots;
+    uint32_t i;
+
+    size = sizeof(PERFHASH_HEADER) + 2 * (size_t) b->n_buckets * sizeof(uint32_t) +
+           (size_t) b->n * sizeof(uint32_t);
+    for(i = 0; i < b->n; i++)
+        size += sizeof(PERFHASH_RECORD) + PERFHASH_ALIGN(b->keys[i].size);
+
+    blob = (uint8_t*) malloc(size);
+    if(blob == NULL)
+        return -1;
+
+    header.magic = PERFHASH_MAGIC;
+    header.version = PERFHASH_VERSION;
+    header.n = b->n;
+    header.n_buckets = b->n_buckets;
+    header.seed = seed;
+    header.size = size;
+    memcpy(blob, &header, sizeof(PERFHASH_HEADER));
+    off = sizeof(PERFHASH_HEADER);
+
+    if(b->n_buckets > 0)
+        memcpy(blob + off, b->displacements, 2 * (size_t) b->n_buckets * sizeof(uint32_t));
+    off += 2 * (size_t) b->n_buckets * sizeof(uint32_t);
+
+    slots = (uint32_t*) (blob + off);
+    off += (size_t) b->n * sizeof(uint32_t);
+
+    for(i = 0; i < b->n; i++) {
+        const PERFHASH_KEY* key = &b->keys[b->slot_keys[i]];
+        PERFHASH_RECORD record;
+
+        record.index = b->slot_keys[i];
+        record.size = (uint32_t) key->size;
+
+        slots[i] = (uint32_t) off;
+        memcpy(blob + off, &record, sizeof(PERFHASH_RECORD));
+        off += sizeof(PERFHASH_RECORD);
+        if(key->size > 0)
+            memcpy(blob + off, key->data, key->size);
+        memset(blob + off + key->size, 0, PERFHASH_ALIGN(key->size) - key->size);
+        off += PERFHASH_ALIGN(key->size);
+    }
+
+    *p_blob = blob;
+    *p_size = size;
+    return 0;
+}
+
+int
+perfhash_build(const PERFHASH_KEY* keys, uint32_t n, void** p_blob, size_t* p_size)
+{
+    PERFHASH_BUILD b;
+    uint64_t seed = 0;
+    int attempt;
+    int ret = -1;
+
+    memset(&b, 0, sizeof(PERFHASH_BUILD));
+    b.keys = keys;
+    b.n = n;
+    b.n_buckets = (n + PERFHASH_LAMBDA - 1) / PERFHASH_LAMBDA;
+
+    if(n > 0) {
+        b.hashes = (uint64_t*) malloc(n * sizeof(uint64_t));
+        b.f = (uint32_t*) malloc(2 * (size_t) n * sizeof(uint32_t));
+        b.bucket_start = (uint32_t*) malloc((b.n_buckets + 1) * sizeof(uint32_t));
+        b.bucket_keys = (uint32_t*) malloc(n * sizeof(uint32_t));
+        b.bucket_order = (uint32_t*) malloc(b.n_buckets * sizeof(uint32_t));
+        b.displacements = (uint32_t*) malloc(2 * b.n_buckets * sizeof(uint32_t));
+        b.slot_keys = (uint32_t*) malloc(n * sizeof(uint32_t));
+        b.tmp_slots = (uint32_t*) malloc(n * sizeof(uint32_t));
+        if(b.hashes == NULL  ||  b.f == NULL  ||  b.bucket_start == NULL  ||  b.bucket_keys == NULL  ||
+           b.bucket_order == NULL  ||  b.displacements == NULL  ||
+           b.slot_keys == NULL  ||  b.tmp_slots == NULL)
+            goto out;
+
+        for(attempt = 0; attempt < PERFHASH_MAX_ATTEMPTS; attempt++) {
+            int err;
+
+            seed = perfhash_mix(0x2545f4914f6cdd1dULL + attempt);
+            err = perfhash_try(&b, seed);
+            if(err < 0)
+                goto out;
+            if(err == 0)
+                break;
+        }
+        if(attempt >= PERFHASH_MAX_ATTEMPTS)
+            goto out;
+    }
+
+    ret = perfhash_write(&b, seed, p_blob, p_size);
+
+out:
+    free(b.hashes);
+    free(b.f);
+    free(b.bucket_start);
+    free(b.bucket_keys);
+    free(b.bucket_order);
+    free(b.displacements);
+    free(b.slot_keys);
+    free(b.tmp_slots);
+    return ret;
+}
+
+int
+perfhash_build_htable(HTABLE* htable, void (*key_func)(const HTABLE_NODE*, PERFHASH_KEY*),
+                      HTABLE_NODE** nodes, void** p_blob, size_t* p_size)
+{
+    PERFHASH_KEY* keys;
+    HTABLE_CURSOR cursor;
+    HTABLE_NODE* node;
+    uint32_t i = 0;
+    int ret;
+
+    if(htable->n > UINT32_MAX)
+        return -1;
+
+    keys = (PERFHASH_KEY*) malloc((htable->n > 0 ? htable->n : 1) * sizeof(PERFHASH_KEY));
+    if(keys == NULL)
+        return -1;
+
+    for(node = htable_first(htable, &cursor); node != NULL; node = htable_next(&cursor)) {
+        key_func(node, &keys[i]);
+        if(nodes != NULL)
+            nodes[i] = node;
+        i++;
+    }
+
+    ret = perfhash_build(keys, i, p_blob, p_size);
+    free(keys);
+    return ret;
+}
+
+int
+perfhash_init(PERFHASH* ph, const void* blob, size_t size)
+{
+    PERFHASH_HEADER header;
+    size_t min_size;
+
+    if(size < sizeof(PERFHASH_HEADER))
+        return -1;
+
+    memcpy(&header, blob, sizeof(PERFHASH_HEADER));
+    if(header.magic != PERFHASH_MAGIC  ||  header.version != PERFHASH_VERSION  ||
+       header.size != size  ||  (header.n > 0) != (header.n_buckets > 0))
+        return -1;
+
+    min_size = sizeof(PERFHASH_HEADER) + 2 * (size_t) header.n_buckets * sizeof(uint32_t) +
+               (size_t) header.n * (sizeof(uint32_t) + sizeof(PERFHASH_RECORD));
+    if(size < min_size)
+        return -1;
+
+    ph->blob = (const uint8_t*) blob;
+    ph->size = size;
+    ph->n = header.n;
+    ph->n_buckets = header.n_buckets;
+    ph->seed = header.seed;
+    ph->displacements = (const uint32_t*) (ph->blob + sizeof(PERFHASH_HEADER));
+    ph->slots = ph->displacements + 2 * (size_t) header.n_buckets;
+    return 0;
+}
+
+size_t
+perfhash_lookup(const PERFHASH* ph, const void* key, size_t size)
+{
+    const PERFHASH_RECORD* record;
+    uint64_t h;
+    uint32_t bucket;
+    uint32_t slot;
+    size_t off;
+
+    if(ph->n == 0)
+        return PERFHASH_NOT_FOUND;
+
+    h = perfhash_hash(key, size, ph->seed);
+    bucket = PERFHASH_BUCKET(h, ph->n_buckets);
+    slot = perfhash_slot(PERFHASH_F1(h, ph->n), PERFHASH_F2(h, ph->n), ph->n,
+                         ph->displacements[2 * bucket], ph->displacements[2 * bucket + 1]);
+
+    /* perfhash_init() has checked only the header, so do not trust anything
+     * else read from the blob. (Note ph->size is at least the size of one
+     * record, as ph->n > 0.) */
+    off = ph->slots[slot];
+    if(off % 4 != 0  ||  off > ph->size - sizeof(PERFHASH_RECORD))
+        return PERFHASH_NOT_FOUND;
+    record = (const PERFHASH_RECORD*) (ph->blob + off);
+    if(record->index >= ph->n  ||  record->size > ph->size - off - sizeof(PERFHASH_RECORD))
+        return PERFHASH_NOT_FOUND;
+
+    if(record->size != size  ||  memcmp(record + 1, key, size) != 0)
+        return PERFHASH_NOT_FOUND;
+    return record->index;
+}
@@ -0,0 +1,143 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef CRE_PERFHASH_H
+#define CRE_PERFHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "htable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#if defined __cplusplus
+    #define PERFHASH_INLINE__   inline
+#elif defined __STDC_VERSION__ && __STDC_VERSION__ >= 199901L
+    #define PERFHASH_INLINE__   static inline
+#elif defined __GNUC__
+    #define PERFHASH_INLINE__   static __inline__
+#elif defined _MSC_VER
+    #define PERFHASH_INLINE__   static __inline
+#else
+    #define PERFHASH_INLINE__   static
+#endif
+
+
+/* Static minimal perfect hash table for read-only sets of keys.
+ *
+ * perfhash_build() takes a set of n distinct keys (arbitrary byte strings)
+ * and produces a single contiguous blob which maps every key to its index in
+ * the original set (i.e. an integer in the range 0 ... n-1), so application
+ * may use it to index its own array of values.
+ *
+ * The blob contains no pointers, so it can be written into a file and later
+ * loaded back (e.g. mapped into memory with mmap()) and used directly after
+ * a trivial validation by perfhash_init(). Note however it uses the native
+ * byte order of the machine which has built it.
+ *
+ * The lookup computes one hash of the key and performs one comparison of the
+ * key with the stored one.
+ *
+ * (It is based on the CHD algorithm: The keys are split into small buckets,
+ * and for each bucket a pair of displacements is found which places all its
+ * keys into yet free slots.)
+ */
+
+typedef struct PERFHASH_KEY {
+    const void* data;
+    size_t size;
+} PERFHASH_KEY;
+
+typedef struct PERFHASH {
+    const uint8_t* blob;
+    size_t size;
+    uint32_t n;
+    uint32_t n_buckets;
+    uint64_t seed;
+    const uint32_t* displacements;
+    const uint32_t* slots;
+} PERFHASH;
+
+
+/* Returned by perfhash_lookup() when the key is not present. */
+#define PERFHASH_NOT_FOUND          ((size_t) -1)
+
+
+/* Build the blob for the given array of n keys.
+ *
+ * On success, returns 0 and stores the blob and its size into *p_blob and
+ * *p_size. Caller is then responsible to free() the blob.
+ *
+ * Returns -1 on failure (a memory allocation failure, or if the keys are not
+ * all distinct).
+ */
+int perfhash_build(const PERFHASH_KEY* keys, uint32_t n, void** p_blob, size_t* p_size);
+
+/* Build the blob for all the nodes of HTABLE.
+ *
+ * The key_func provides the key of a node. If nodes is not NULL, it has to be
+ * an array of (at least) htable->n elements, and the function fills it so that
+ * nodes[i] is the node whose key maps to the index i.
+ *
+ * Returns 0 on success or -1 on failure, as perfhash_build() does.
+ */
+int perfhash_build_htable(HTABLE* htable, void (*key_func)(const HTABLE_NODE*, PERFHASH_KEY*),
+                          HTABLE_NODE** nodes, void** p_blob, size_t* p_size);
+
+/* Initialize the PERFHASH structure for a blob produced by perfhash_build().
+ *
+ * This does not copy the blob, so it has to stay valid as long as the
+ * structure is in use.
+ *
+ * Only the header of the blob is validated here (so this is cheap even for
+ * a huge blob). Returns 0 on success, or -1 if the header is invalid (e.g.
+ * the blob is truncated, or built on a machine with a different byte order).
+ *
+ * The rest of the blob is checked lazily: perfhash_lookup() never reads out
+ * of the blob bounds and never returns an index out of the range 0 ...
+ * (perfhash_count() - 1), even if the blob is corrupted. (But it then may
+ * fail to find a key, or return an index of another key.)
+ */
+int perfhash_init(PERFHASH* ph, const void* blob, size_t size);
+
+/* Returns count of keys. */
+PERFHASH_INLINE__ size_t perfhash_count(const PERFHASH* ph)
+        { return ph->n; }
+
+/* Returns index of the key (as it has been passed into perfhash_build()), or
+ * PERFHASH_NOT_FOUND if the key is not present.
+ */
+size_t perfhash_lookup(const PERFHASH* ph, const void* key, size_t size);
+
+
+#ifdef __cplusplus
+}  /* extern "C" { */
+#endif
+
+#endif  /* #ifndef CRE_PERFHASH_H */
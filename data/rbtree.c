@@ -26,6 +26,7 @@
 #include "rbtree.h"
 
 #include <stdint.h>
+#include <string.h>
 
 
 #define RED_FLAG                ((uintptr_t) 0x1U)
@@ -44,10 +45,52 @@
 #define SET_LEFT(node, ptr)     do { (node)->lc = (RBTREE_NODE*)((uintptr_t)(ptr) | COLOR(node)); } while(0)
 #define SET_RIGHT(node, ptr)    do { (node)->r = (ptr); } while(0)
 
+/* Subtree size (only for RBTREE_ORDERSTAT). */
+#define OS_SIZE(node)           (((RBTREE_NODE_OS*)(node))->size)
+#define SIZE(node)              ((node) != NULL ? OS_SIZE(node) : 0)
+
+/* Parent (only for RBTREE_PARENT). */
+#define PARENT(node)            (((RBTREE_NODE_P*)(node))->parent)
+
 
 typedef RBTREE_CURSOR RBTREE_PATH;
 
 
+/* Recompute any data the tree keeps in the node about its subtree, assuming
+ * the children are already up to date. This has to be called whenever the
+ * children of the node change. */
+static void
+rbtree_update(RBTREE* tree, RBTREE_NODE* node)
+{
+    if(tree->flags & RBTREE_ORDERSTAT)
+        OS_SIZE(node) = 1 + SIZE(LEFT(node)) + SIZE(RIGHT(node));
+    if(tree->augment_func != NULL)
+        tree->augment_func(node);
+}
+
+/* Update the parent link of the child (if any). This has to be called whenever
+ * a node is linked to a different parent. */
+static void
+rbtree_set_parent(RBTREE* tree, RBTREE_NODE* child, RBTREE_NODE* parent)
+{
+    if((tree->flags & RBTREE_PARENT)  &&  child != NULL)
+        PARENT(child) = parent;
+}
+
+/* Update all the nodes on the path (except the last one) from the bottom up. */
+static void
+rbtree_update_path(RBTREE* tree, RBTREE_PATH* path)
+{
+    unsigned i;
+
+    if(!(tree->flags & RBTREE_ORDERSTAT)  &&  tree->augment_func == NULL)
+        return;
+
+    for(i = path->n - 1; i > 0; i--)
+        rbtree_update(tree, path->stack[i - 1]);
+}
+
+
 /* Helper tree "rotation" operations, used as primitives for re-balancing. */
 static void
 rbtree_rotate_left(RBTREE* tree, RBTREE_NODE* parent, RBTREE_NODE* node)
@@ -57,6 +100,11 @@ rbtree_rotate_left(RBTREE* tree, RBTREE_NODE* parent, RBTREE_NODE* node)
     tmp = RIGHT(node);
     SET_RIGHT(node, LEFT(tmp));
     SET_LEFT(tmp, node);
+    rbtree_set_parent(tree, RIGHT(node), node);
+    rbtree_set_parent(tree, node, tmp);
+    rbtree_set_parent(tree, tmp, parent);
+    rbtree_update(tree, node);
+    rbtree_update(tree, tmp);
 
     if(parent != NULL) {
         if(node == LEFT(parent))
@@ -76,6 +124,11 @@ rbtree_rotate_right(RBTREE* tree, RBTREE_NODE* parent, RBTREE_NODE* node)
     tmp = LEFT(node);
     SET_LEFT(node, RIGHT(tmp));
     SET_RIGHT(tmp, node);
+    rbtree_set_parent(tree, LEFT(node), node);
+    rbtree_set_parent(tree, node, tmp);
+    rbtree_set_parent(tree, tmp, parent);
+    rbtree_update(tree, node);
+    rbtree_update(tree, tmp);
 
     if(parent != NULL) {
         if(node == RIGHT(parent))
@@ -170,7 +223,8 @@ rbtree_lookup_path(RBTREE_NODE* node, const RBTREE_NODE* key,
     return cmp;
 }
 
-static void
+/* Returns non-zero if the black height of the tree has grown. */
+static int
 rbtree_insert_fixup(RBTREE* tree, RBTREE_PATH* path)
 {
     RBTREE_NODE* node;
@@ -190,15 +244,16 @@ rbtree_insert_fixup(RBTREE* tree, RBTREE_PATH* path)
 
         /* No parent: the node is a root and root should alway be black. */
         if(parent == NULL) {
+            int grown = IS_RED(node);
             MAKE_BLACK(node);
             tree->root = node;
-            break;
+            return grown;
         }
 
         /* If parent is black, we could not introduce a double-red problem
          * and we are done. */
         if(IS_BLACK(parent))
-            break;
+            return 0;
 
         /* If we reach here, there is the double-red problem.
          * Note grandparent has to exist and be black (implied from red parent). */
@@ -229,7 +284,7 @@ rbtree_insert_fixup(RBTREE* tree, RBTREE_PATH* path)
              * the hierarchy) is now black, fixing the double-red problem. */
             MAKE_BLACK(parent);
             MAKE_RED(grandparent);
-            break;
+            return 0;
         }
 
         /* Red uncle. This allows us to make both the parent and the uncle
@@ -244,8 +299,33 @@ rbtree_insert_fixup(RBTREE* tree, RBTREE_PATH* path)
     }
 }
 
-int
-rbtree_insert(RBTREE* tree, RBTREE_NODE* node, RBTREE_CMP_FUNC cmp_func)
+/* Link the new node as a child of the last node of the path (as found by
+ * rbtree_lookup_path()) and append it to the path. */
+static void
+rbtree_link(RBTREE* tree, RBTREE_PATH* path, RBTREE_NODE* node, int cmp)
+{
+    SET_LEFT(node, NULL);
+    SET_RIGHT(node, NULL);
+    MAKE_RED(node);
+    rbtree_update(tree, node);
+
+    /* Insert the node as child of a leaf node. */
+    if(path->n > 0) {
+        if(cmp < 0)
+            SET_LEFT(path->stack[path->n - 1], node);
+        else
+            SET_RIGHT(path->stack[path->n - 1], node);
+        rbtree_set_parent(tree, node, path->stack[path->n - 1]);
+    } else {
+        tree->root = node;
+        rbtree_set_parent(tree, node, NULL);
+    }
+    path->stack[path->n++] = node;
+    rbtree_update_path(tree, path);
+}
+
+RBTREE_NODE*
+rbtree_insert_or_get(RBTREE* tree, RBTREE_NODE* node, RBTREE_CMP_FUNC cmp_func)
 {
     RBTREE_PATH path;
     int cmp;
@@ -256,27 +336,170 @@ rbtree_insert(RBTREE* tree, RBTREE_NODE* node, RBTREE_CMP_FUNC cmp_func)
     cmp = rbtree_lookup_path(tree->root, node, cmp_func, &path);
     if(path.n > 0  &&  cmp == 0) {
         /* An equal node already present. */
-        return -1;
+        return path.stack[path.n - 1];
     }
 
-    SET_LEFT(node, NULL);
-    SET_RIGHT(node, NULL);
-    MAKE_RED(node);
+    rbtree_link(tree, &path, node, cmp);
 
-    /* Insert the node as child of a leaf node. */
-    if(path.n > 0) {
-        if(cmp < 0)
-            SET_LEFT(path.stack[path.n - 1], node);
-        else
-            SET_RIGHT(path.stack[path.n - 1], node);
+    /* Preserve RB-tree properties. */
+    rbtree_insert_fixup(tree, &path);
+
+    return node;
+}
+
+int
+rbtree_insert(RBTREE* tree, RBTREE_NODE* node, RBTREE_CMP_FUNC cmp_func)
+{
+    return (rbtree_insert_or_get(tree, node, cmp_func) == node) ? 0 : -1;
+}
+
+/* Finger search: Reposition the path (which has to be non-empty) for the key,
+ * starting from its current end instead of from the root.
+ *
+ * We climb up only as long as the subtree we are in cannot contain the key.
+ * Note only ancestors we have entered from the other side than the key lies
+ * may bound the subtree, so we need to compare the key only with those.
+ *
+ * Returns the last comparison, exactly as rbtree_lookup_path() does. */
+static int
+rbtree_finger_path(RBTREE_PATH* path, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
+{
+    unsigned i = path->n - 1;
+    unsigned base = i;      /* Deepest node known to be on the same side. */
+    RBTREE_NODE* start;
+    int cmp, c;
+
+    cmp = cmp_func(key, path->stack[i]);
+    if(cmp == 0)
+        return 0;
+
+    while(i > 0) {
+        i--;
+        if(path->stack[i + 1] != ((cmp > 0) ? LEFT(path->stack[i]) : RIGHT(path->stack[i])))
+            continue;
+
+        c = cmp_func(key, path->stack[i]);
+        if(c == 0) {
+            path->n = i + 1;
+            return 0;
+        }
+        if((c > 0) != (cmp > 0))
+            break;
+        base = i;
+    }
+
+    path->n = base + 1;
+    start = (cmp > 0) ? RIGHT(path->stack[base]) : LEFT(path->stack[base]);
+    if(start == NULL)
+        return cmp;
+    return rbtree_lookup_path(start, key, cmp_func, path);
+}
+
+RBTREE_NODE*
+rbtree_lookup_from(RBTREE_CURSOR* cur, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
+{
+    if(cur->n == 0)
+        return NULL;
+
+    if(rbtree_finger_path(cur, key, cmp_func) != 0)
+        return NULL;
+    return cur->stack[cur->n - 1];
+}
+
+int
+rbtree_insert_hint(RBTREE* tree, RBTREE_CURSOR* cur, RBTREE_NODE* node,
+                   RBTREE_CMP_FUNC cmp_func)
+{
+    RBTREE_PATH tmp_path;
+    unsigned char go_left[sizeof(tmp_path.stack) / sizeof(tmp_path.stack[0])];
+    RBTREE_NODE* iter;
+    unsigned n, i, j;
+    int cmp;
+
+    if(cur->n > 0  &&  tree->root != NULL) {
+        cmp = rbtree_finger_path(cur, node, cmp_func);
     } else {
-        tree->root = node;
+        cur->n = 0;
+        cmp = rbtree_lookup_path(tree->root, node, cmp_func, cur);
+    }
+    if(cur->n > 0  &&  cmp == 0) {
+        /* An equal node already present. The cursor points to it. */
+        return -1;
     }
-    path.stack[path.n++] = node;
 
-    /* Preserve RB-tree properties. */
-    rbtree_insert_fixup(tree, &path);
+    rbtree_link(tree, cur, node, cmp);
+
+    /* The re-balancing may rotate some nodes of the path, so we need to
+     * rebuild the cursor afterwards. Note no nodes outside the path can get
+     * on it, and their order with respect to the new node is known, so we
+     * remember it now and use it then to descend without any comparisons. */
+    n = cur->n;
+    for(i = 0; i < n - 1; i++)
+        go_left[i] = (cur->stack[i + 1] == LEFT(cur->stack[i]));
+    tmp_path.n = n;
+    memcpy(tmp_path.stack, cur->stack, n * sizeof(RBTREE_NODE*));
+
+    rbtree_insert_fixup(tree, &tmp_path);
+
+    /* The rotations move any node by at most two levels up or one level
+     * down, so we can find it near the same index in the old path. */
+    iter = tree->root;
+    for(i = 0; iter != node; i++) {
+        for(j = (i > 0) ? i - 1 : 0; tmp_path.stack[j] != iter; j++)
+            ;
+        cur->stack[i] = iter;
+        iter = go_left[j] ? LEFT(iter) : RIGHT(iter);
+    }
+    cur->stack[i] = node;
+    cur->n = i + 1;
+
+    return 0;
+}
+
+/* Link nodes[0] ... nodes[n-1] into a perfectly balanced subtree and return
+ * its root. The nodes at the given red_depth are made red, all others black. */
+static RBTREE_NODE*
+rbtree_build_subtree(RBTREE* tree, RBTREE_NODE* const* nodes, size_t n,
+                     unsigned depth, unsigned red_depth)
+{
+    RBTREE_NODE* node;
+    size_t mid;
+
+    if(n == 0)
+        return NULL;
+
+    mid = (n - 1) / 2;
+    node = nodes[mid];
+    node->lc = rbtree_build_subtree(tree, nodes, mid, depth + 1, red_depth);
+    SET_RIGHT(node, rbtree_build_subtree(tree, nodes + mid + 1, n - mid - 1, depth + 1, red_depth));
+    if(depth == red_depth)
+        MAKE_RED(node);
+    rbtree_set_parent(tree, LEFT(node), node);
+    rbtree_set_parent(tree, RIGHT(node), node);
+    rbtree_update(tree, node);
+    return node;
+}
+
+int
+rbtree_build_sorted(RBTREE* tree, RBTREE_NODE* const* nodes, size_t n)
+{
+    unsigned red_depth = 0;
+    size_t n_full = 1;
+
+    if(tree->root != NULL)
+        return -1;
+
+    /* By always splitting the nodes in halves, the levels 0 ... (red_depth-1)
+     * are complete, and only the deepest level red_depth (if any) may be
+     * incomplete. Making just those nodes red keeps the black height of all
+     * the paths the same. */
+    while(n_full <= n) {
+        red_depth++;
+        n_full = 2 * n_full + 1;
+    }
 
+    tree->root = rbtree_build_subtree(tree, nodes, n, 0, red_depth);
+    rbtree_set_parent(tree, tree->root, NULL);
     return 0;
 }
 
@@ -361,49 +584,39 @@ rbtree_remove_fixup(RBTREE* tree, RBTREE_PATH* path)
     }
 }
 
-RBTREE_NODE*
-rbtree_remove(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
+/* Remove the node at the end of the path (which has to lead from the root). */
+static RBTREE_NODE*
+rbtree_remove_path(RBTREE* tree, RBTREE_PATH* path)
 {
-    RBTREE_PATH path;
     RBTREE_NODE* node;
     RBTREE_NODE* single_child;
-    int cmp;
 
-    path.n = 0;
-
-    /* Lookup the place where we should live. */
-    cmp = rbtree_lookup_path(tree->root, key, cmp_func, &path);
-    if(path.n == 0  ||  cmp != 0) {
-        /* Not found. */
-        return NULL;
-    }
-
-    node = path.stack[path.n - 1];
+    node = path->stack[path->n - 1];
 
     /* If we are not at the bottom of the tree, we switch our place with
      * another node, which is our direct successor; i.e. with the minimal
      * value of the right subtree (that one must be at he bottom). */
     if(RIGHT(node) != NULL) {
         RBTREE_NODE* successor;
-        int node_index = path.n - 1;
+        int node_index = path->n - 1;
 
         if(LEFT(RIGHT(node)) != NULL) {
             RBTREE_NODE* tmp;
 
-            rbtree_leftmost_path(RIGHT(node), &path);
-            successor = path.stack[path.n - 1];
+            rbtree_leftmost_path(RIGHT(node), path);
+            successor = path->stack[path->n - 1];
 
             tmp = RIGHT(successor);
             SET_RIGHT(successor, RIGHT(node));
             SET_RIGHT(node, tmp);
 
-            if(successor == LEFT(path.stack[path.n - 2]))
-                SET_LEFT(path.stack[path.n - 2], node);
+            if(successor == LEFT(path->stack[path->n - 2]))
+                SET_LEFT(path->stack[path->n - 2], node);
             else
-                SET_RIGHT(path.stack[path.n - 2], node);
+                SET_RIGHT(path->stack[path->n - 2], node);
 
-            path.stack[node_index] = successor;
-            path.stack[path.n - 1] = node;
+            path->stack[node_index] = successor;
+            path->stack[path->n - 1] = node;
         } else if(LEFT(node) != NULL) {
             /* The right child is directly the successor. This has to be
              * handled as the code above would entangle the pointers in the
@@ -412,8 +625,8 @@ rbtree_remove(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
             SET_RIGHT(node, RIGHT(successor));
             SET_RIGHT(successor, node);
 
-            path.stack[path.n - 1] = successor;
-            path.stack[path.n++] = node;
+            path->stack[path->n - 1] = successor;
+            path->stack[path->n++] = node;
         } else {
             /* The left node is NULL; i.e. node has at most one child.
              * The code below is capable to handle this. */
@@ -426,10 +639,10 @@ rbtree_remove(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
             SET_LEFT(node, NULL);
 
             if(node_index > 0) {
-                if(node == LEFT(path.stack[node_index - 1]))
-                    SET_LEFT(path.stack[node_index - 1], successor);
+                if(node == LEFT(path->stack[node_index - 1]))
+                    SET_LEFT(path->stack[node_index - 1], successor);
                 else
-                    SET_RIGHT(path.stack[node_index - 1], successor);
+                    SET_RIGHT(path->stack[node_index - 1], successor);
             } else {
                 tree->root = successor;
             }
@@ -438,6 +651,10 @@ rbtree_remove(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
                 TOGGLE_COLOR(successor);
                 TOGGLE_COLOR(node);
             }
+
+            rbtree_set_parent(tree, successor, (node_index > 0) ? path->stack[node_index - 1] : NULL);
+            rbtree_set_parent(tree, LEFT(successor), successor);
+            rbtree_set_parent(tree, RIGHT(successor), successor);
         }
     }
 
@@ -445,23 +662,313 @@ rbtree_remove(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
      * upwards to take the place of the node being removed. As a side effect,
      * it leaves the original node disconnected from the tree hierarchy. */
     single_child = (LEFT(node) != NULL) ? LEFT(node) : RIGHT(node);
-    if(path.n > 1) {
-        if(node == LEFT(path.stack[path.n - 2]))
-            SET_LEFT(path.stack[path.n - 2], single_child);
+    if(path->n > 1) {
+        if(node == LEFT(path->stack[path->n - 2]))
+            SET_LEFT(path->stack[path->n - 2], single_child);
         else
-            SET_RIGHT(path.stack[path.n - 2], single_child);
+            SET_RIGHT(path->stack[path->n - 2], single_child);
+        rbtree_set_parent(tree, single_child, path->stack[path->n - 2]);
     } else {
         tree->root = single_child;
+        rbtree_set_parent(tree, single_child, NULL);
     }
-    path.stack[path.n - 1] = single_child;
+    path->stack[path->n - 1] = single_child;
+    rbtree_update_path(tree, path);
 
     /* Re-balancing may be needed if we have removed a black node. */
     if(IS_BLACK(node))
-        rbtree_remove_fixup(tree, &path);
+        rbtree_remove_fixup(tree, path);
 
     return node;
 }
 
+RBTREE_NODE*
+rbtree_remove(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
+{
+    RBTREE_PATH path;
+    int cmp;
+
+    path.n = 0;
+
+    /* Lookup the place where we should live. */
+    cmp = rbtree_lookup_path(tree->root, key, cmp_func, &path);
+    if(path.n == 0  ||  cmp != 0) {
+        /* Not found. */
+        return NULL;
+    }
+
+    return rbtree_remove_path(tree, &path);
+}
+
+void
+rbtree_remove_node(RBTREE* tree, RBTREE_NODE* node)
+{
+    RBTREE_PATH path;
+    RBTREE_NODE* n;
+    unsigned depth = 0;
+    unsigned i;
+
+    /* Reconstruct the path from the root by climbing up the parent links. */
+    for(n = node; n != NULL; n = PARENT(n))
+        depth++;
+    path.n = depth;
+    for(n = node, i = depth; n != NULL; n = PARENT(n))
+        path.stack[--i] = n;
+
+    rbtree_remove_path(tree, &path);
+}
+
+/* Black height of the (sub)tree, i.e. count of black nodes on any path from
+ * the node down to a leaf, including the node itself. */
+static unsigned
+rbtree_black_height(const RBTREE_NODE* node)
+{
+    unsigned bh = 0;
+
+    while(node != NULL) {
+        if(IS_BLACK(node))
+            bh++;
+        node = LEFT(node);
+    }
+    return bh;
+}
+
+/* Make a subtree a valid tree on its own: Its root has to be black. */
+static RBTREE_NODE*
+rbtree_detach_subtree(RBTREE_NODE* node, unsigned* p_bh)
+{
+    if(node != NULL  &&  IS_RED(node)) {
+        MAKE_BLACK(node);
+        (*p_bh)++;
+    }
+    return node;
+}
+
+/* Join two valid trees (i.e. with black roots) of the given black heights
+ * together with the pivot node, which has to be greater than all nodes of the
+ * tree1 and lower then all nodes of tree2. Returns the root of the joined tree
+ * and stores its black height into *p_bh.
+ *
+ * The work is proportional to the difference of the black heights: We hang the
+ * shorter tree with the pivot (as a red node) on the spine of the taller tree,
+ * at a black node of the same black height, and fix any double-red problem
+ * as after an insertion. */
+static RBTREE_NODE*
+rbtree_join_internal(const RBTREE* proto, RBTREE_NODE* root1, unsigned bh1,
+                     RBTREE_NODE* pivot, RBTREE_NODE* root2, unsigned bh2,
+                     unsigned* p_bh)
+{
+    RBTREE tmp_tree;
+    RBTREE_PATH path;
+    RBTREE_NODE* node;
+    unsigned bh;
+
+    tmp_tree.flags = proto->flags;
+    tmp_tree.augment_func = proto->augment_func;
+
+    if(bh1 == bh2) {
+        pivot->lc = root1;
+        SET_RIGHT(pivot, root2);
+        rbtree_set_parent(&tmp_tree, root1, pivot);
+        rbtree_set_parent(&tmp_tree, root2, pivot);
+        rbtree_set_parent(&tmp_tree, pivot, NULL);
+        rbtree_update(&tmp_tree, pivot);
+        *p_bh = bh1 + 1;
+        return pivot;
+    }
+
+    path.n = 0;
+    if(bh1 > bh2) {
+        node = root1;
+        bh = bh1;
+        while(node != NULL  &&  (bh > bh2  ||  IS_RED(node))) {
+            path.stack[path.n++] = node;
+            if(IS_BLACK(node))
+                bh--;
+            node = RIGHT(node);
+        }
+        pivot->lc = node;
+        SET_RIGHT(pivot, root2);
+        SET_RIGHT(path.stack[path.n - 1], pivot);
+        tmp_tree.root = root1;
+        bh = bh1;
+    } else {
+        node = root2;
+        bh = bh2;
+        while(node != NULL  &&  (bh > bh1  ||  IS_RED(node))) {
+            path.stack[path.n++] = node;
+            if(IS_BLACK(node))
+                bh--;
+            node = LEFT(node);
+        }
+        pivot->lc = root1;
+        SET_RIGHT(pivot, node);
+        SET_LEFT(path.stack[path.n - 1], pivot);
+        tmp_tree.root = root2;
+        bh = bh2;
+    }
+
+    MAKE_RED(pivot);
+    rbtree_set_parent(&tmp_tree, LEFT(pivot), pivot);
+    rbtree_set_parent(&tmp_tree, RIGHT(pivot), pivot);
+    rbtree_set_parent(&tmp_tree, pivot, path.stack[path.n - 1]);
+    rbtree_update(&tmp_tree, pivot);
+    path.stack[path.n++] = pivot;
+    rbtree_update_path(&tmp_tree, &path);
+    if(rbtree_insert_fixup(&tmp_tree, &path))
+        bh++;
+
+    *p_bh = bh;
+    return tmp_tree.root;
+}
+
+void
+rbtree_join(RBTREE* tree1, RBTREE_NODE* pivot, RBTREE* tree2)
+{
+    unsigned bh;
+
+    tree1->root = rbtree_join_internal(tree1,
+                        tree1->root, rbtree_black_height(tree1->root), pivot,
+                        tree2->root, rbtree_black_height(tree2->root), &bh);
+    rbtree_set_parent(tree1, tree1->root, NULL);
+    tree2->root = NULL;
+}
+
+/* Split the subtree of the given black height into nodes lower than the key
+ * and greater than the key. The node equal to the key (if any) goes to the
+ * left part if equal_to_left is set, or to the right part otherwise. */
+static void
+rbtree_split_internal(const RBTREE* proto, RBTREE_NODE* node, unsigned bh,
+                      const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func, int equal_to_left,
+                      RBTREE_NODE** p_left, unsigned* p_left_bh,
+                      RBTREE_NODE** p_right, unsigned* p_right_bh)
+{
+    RBTREE_NODE* left;
+    RBTREE_NODE* right;
+    unsigned left_bh, right_bh;
+    RBTREE_NODE* part;
+    unsigned part_bh;
+    int cmp;
+
+    if(node == NULL) {
+        *p_left = NULL;
+        *p_left_bh = 0;
+        *p_right = NULL;
+        *p_right_bh = 0;
+        return;
+    }
+
+    /* Disassemble the node into the two subtrees and the node itself, which
+     * is then used as a pivot for joining the pieces on the respective side. */
+    left_bh = right_bh = bh - (IS_BLACK(node) ? 1 : 0);
+    left = rbtree_detach_subtree(LEFT(node), &left_bh);
+    right = rbtree_detach_subtree(RIGHT(node), &right_bh);
+    cmp = cmp_func(key, node);
+
+    if(cmp < 0  ||  (cmp == 0  &&  !equal_to_left)) {
+        if(cmp == 0) {
+            *p_left = left;
+            *p_left_bh = left_bh;
+            part = NULL;
+            part_bh = 0;
+        } else {
+            rbtree_split_internal(proto, left, left_bh, key, cmp_func, equal_to_left,
+                                  p_left, p_left_bh, &part, &part_bh);
+        }
+        *p_right = rbtree_join_internal(proto, part, part_bh, node, right, right_bh, p_right_bh);
+    } else {
+        if(cmp == 0) {
+            *p_right = right;
+            *p_right_bh = right_bh;
+            part = NULL;
+            part_bh = 0;
+        } else {
+            rbtree_split_internal(proto, right, right_bh, key, cmp_func, equal_to_left,
+                                  &part, &part_bh, p_right, p_right_bh);
+        }
+        *p_left = rbtree_join_internal(proto, left, left_bh, node, part, part_bh, p_left_bh);
+    }
+}
+
+void
+rbtree_split(RBTREE* tree, const RBTREE_NODE* key, RBTREE* left, RBTREE* right,
+             RBTREE_CMP_FUNC cmp_func)
+{
+    RBTREE proto = *tree;
+    RBTREE_NODE* left_root;
+    RBTREE_NODE* right_root;
+    unsigned left_bh, right_bh;
+
+    rbtree_split_internal(&proto, proto.root, rbtree_black_height(proto.root), key, cmp_func, 0,
+                          &left_root, &left_bh, &right_root, &right_bh);
+
+    /* (Note tree may be the same as left or right.) */
+    tree->root = NULL;
+    left->root = left_root;
+    left->flags = proto.flags;
+    left->augment_func = proto.augment_func;
+    rbtree_set_parent(left, left_root, NULL);
+    right->root = right_root;
+    right->flags = proto.flags;
+    right->augment_func = proto.augment_func;
+    rbtree_set_parent(right, right_root, NULL);
+}
+
+size_t
+rbtree_remove_range(RBTREE* tree, const RBTREE_NODE* lo, const RBTREE_NODE* hi,
+                    RBTREE_CMP_FUNC cmp_func, void (*callback)(RBTREE_NODE*))
+{
+    RBTREE_NODE* left;
+    RBTREE_NODE* middle;
+    RBTREE_NODE* right;
+    unsigned left_bh, middle_bh, right_bh;
+    RBTREE_PATH range;
+    RBTREE_NODE* node;
+    unsigned bh;
+    size_t n = 0;
+
+    rbtree_split_internal(tree, tree->root, rbtree_black_height(tree->root),
+                          lo, cmp_func, 0, &left, &left_bh, &middle, &middle_bh);
+    rbtree_split_internal(tree, middle, middle_bh,
+                          hi, cmp_func, 1, &middle, &middle_bh, &right, &right_bh);
+
+    /* Glue the remaining parts together. We need a pivot for that, so steal
+     * the minimum from the right part. */
+    if(right != NULL) {
+        RBTREE right_tree;
+        RBTREE_PATH path;
+        RBTREE_NODE* pivot;
+
+        right_tree = *tree;
+        right_tree.root = right;
+        rbtree_set_parent(&right_tree, right, NULL);
+        path.n = 0;
+        rbtree_leftmost_path(right, &path);
+        pivot = rbtree_remove_path(&right_tree, &path);
+        right = right_tree.root;
+        right_bh = rbtree_black_height(right);
+        tree->root = rbtree_join_internal(tree, left, left_bh, pivot, right, right_bh, &bh);
+    } else {
+        tree->root = left;
+        rbtree_set_parent(tree, left, NULL);
+    }
+
+    /* Visit the nodes of the range in the ascending order with a single
+     * in-order walk. We advance past each node before handing it to the
+     * callback, which may destroy it. */
+    range.n = 0;
+    rbtree_leftmost_path(middle, &range);
+    while(range.n > 0) {
+        node = range.stack[--range.n];
+        rbtree_leftmost_path(RIGHT(node), &range);
+        if(callback != NULL)
+            callback(node);
+        n++;
+    }
+
+    return n;
+}
+
 RBTREE_NODE*
 rbtree_lookup(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
 {
@@ -499,6 +1006,77 @@ rbtree_lookup_ex(RBTREE* tree, const RBTREE_NODE* key,
     return cur->stack[cur->n - 1];
 }
 
+/* Kinds of the inexact lookup for rbtree_bound(). */
+#define BOUND_LOWER             0   /* First node >= key. */
+#define BOUND_UPPER             1   /* First node > key. */
+#define BOUND_FLOOR             2   /* Last node <= key. */
+
+static RBTREE_NODE*
+rbtree_bound(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func,
+             RBTREE_CURSOR* cur, int kind)
+{
+    RBTREE_PATH tmp_path;
+    RBTREE_NODE* node = tree->root;
+    unsigned found_n = 0;
+    int cmp;
+
+    /* The candidate found so far is always on the path, so in the end, we
+     * just need to cut off the path below it. */
+    if(cur == NULL)
+        cur = &tmp_path;
+    cur->n = 0;
+
+    while(node != NULL) {
+        cur->stack[cur->n++] = node;
+        cmp = cmp_func(key, node);
+
+        if(cmp == 0  &&  kind != BOUND_UPPER) {
+            found_n = cur->n;
+            break;
+        }
+
+        if(kind == BOUND_FLOOR) {
+            if(cmp > 0) {
+                found_n = cur->n;
+                node = RIGHT(node);
+            } else {
+                node = LEFT(node);
+            }
+        } else {
+            if(cmp < 0) {
+                found_n = cur->n;
+                node = LEFT(node);
+            } else {
+                node = RIGHT(node);
+            }
+        }
+    }
+
+    cur->n = found_n;
+    return (found_n > 0) ? cur->stack[found_n - 1] : NULL;
+}
+
+RBTREE_NODE*
+rbtree_lower_bound(RBTREE* tree, const RBTREE_NODE* key,
+                   RBTREE_CMP_FUNC cmp_func, RBTREE_CURSOR* cur)
+{
+    return rbtree_bound(tree, key, cmp_func, cur, BOUND_LOWER);
+}
+
+RBTREE_NODE*
+rbtree_upper_bound(RBTREE* tree, const RBTREE_NODE* key,
+                   RBTREE_CMP_FUNC cmp_func, RBTREE_CURSOR* cur)
+{
+    return rbtree_bound(tree, key, cmp_func, cur, BOUND_UPPER);
+}
+
+RBTREE_NODE*
+rbtree_floor(RBTREE* tree, const RBTREE_NODE* key,
+             RBTREE_CMP_FUNC cmp_func, RBTREE_CURSOR* cur)
+{
+    return rbtree_bound(tree, key, cmp_func, cur, BOUND_FLOOR);
+}
+
 RBTREE_NODE*
 rbtree_current(RBTREE_CURSOR* cur)
 {
@@ -569,12 +1147,157 @@ rbtree_prev(RBTREE_CURSOR* cur)
 }
 
 
+RBTREE_NODE*
+rbtree_first(RBTREE* tree)
+{
+    RBTREE_NODE* node = tree->root;
+
+    if(node != NULL) {
+        while(LEFT(node) != NULL)
+            node = LEFT(node);
+    }
+    return node;
+}
+
+RBTREE_NODE*
+rbtree_last(RBTREE* tree)
+{
+    RBTREE_NODE* node = tree->root;
+
+    if(node != NULL) {
+        while(RIGHT(node) != NULL)
+            node = RIGHT(node);
+    }
+    return node;
+}
+
+RBTREE_NODE*
+rbtree_next_node(RBTREE_NODE* node)
+{
+    RBTREE_NODE* parent;
+
+    if(RIGHT(node) != NULL) {
+        node = RIGHT(node);
+        while(LEFT(node) != NULL)
+            node = LEFT(node);
+        return node;
+    }
+
+    /* Climb up until we come from a left child. */
+    parent = PARENT(node);
+    while(parent != NULL  &&  node == RIGHT(parent)) {
+        node = parent;
+        parent = PARENT(node);
+    }
+    return parent;
+}
+
+RBTREE_NODE*
+rbtree_prev_node(RBTREE_NODE* node)
+{
+    RBTREE_NODE* parent;
+
+    if(LEFT(node) != NULL) {
+        node = LEFT(node);
+        while(RIGHT(node) != NULL)
+            node = RIGHT(node);
+        return node;
+    }
+
+    /* Climb up until we come from a right child. */
+    parent = PARENT(node);
+    while(parent != NULL  &&  node == LEFT(parent)) {
+        node = parent;
+        parent = PARENT(node);
+    }
+    return parent;
+}
+
+
+size_t
+rbtree_size(const RBTREE* tree)
+{
+    return SIZE(tree->root);
+}
+
+RBTREE_NODE*
+rbtree_select(RBTREE* tree, size_t k, RBTREE_CURSOR* cur)
+{
+    RBTREE_NODE* node = tree->root;
+
+    if(cur != NULL)
+        cur->n = 0;
+
+    while(node != NULL) {
+        size_t left_size = SIZE(LEFT(node));
+
+        if(cur != NULL)
+            cur->stack[cur->n++] = node;
+
+        if(k < left_size) {
+            node = LEFT(node);
+        } else if(k > left_size) {
+            k -= left_size + 1;
+            node = RIGHT(node);
+        } else {
+            return node;
+        }
+    }
+
+    if(cur != NULL)
+        cur->n = 0;
+    return NULL;
+}
+
+/* Count of nodes lower than the key (or lower or equal if inclusive). */
+static size_t
+rbtree_rank_internal(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func,
+                     int inclusive)
+{
+    RBTREE_NODE* node = tree->root;
+    size_t rank = 0;
+    int cmp;
+
+    while(node != NULL) {
+        cmp = cmp_func(key, node);
+
+        if(cmp < 0) {
+            node = LEFT(node);
+        } else if(cmp > 0) {
+            rank += SIZE(LEFT(node)) + 1;
+            node = RIGHT(node);
+        } else {
+            rank += SIZE(LEFT(node)) + (inclusive ? 1 : 0);
+            break;
+        }
+    }
+
+    return rank;
+}
+
+size_t
+rbtree_rank(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func)
+{
+    return rbtree_rank_internal(tree, key, cmp_func, 0);
+}
+
+size_t
+rbtree_count_range(RBTREE* tree, const RBTREE_NODE* lo, const RBTREE_NODE* hi,
+                   RBTREE_CMP_FUNC cmp_func)
+{
+    size_t below_lo = rbtree_rank_internal(tree, lo, cmp_func, 0);
+    size_t up_to_hi = rbtree_rank_internal(tree, hi, cmp_func, 1);
+
+    return (up_to_hi > below_lo) ? up_to_hi - below_lo : 0;
+}
+
+
 #ifdef CRE_TEST
 /* Verification of RB-tree correctness. */
 
 /* Returns black height of the tree, or -1 on an error. */
 static int
-rbtree_verify_recurse(RBTREE_NODE* node)
+rbtree_verify_recurse(RBTREE* tree, RBTREE_NODE* node)
 {
     RBTREE_NODE* children[2];
     RBTREE_NODE* child;
@@ -596,8 +1319,12 @@ rbtree_verify_recurse(RBTREE_NODE* node)
         if(IS_RED(node) && child != NULL && IS_RED(child))
             return -1;
 
+        /* Child has to point back to us. */
+        if((tree->flags & RBTREE_PARENT)  &&  child != NULL  &&  PARENT(child) != node)
+            return -1;
+
         /* Verify the child subtree. */
-        child_height[i] = rbtree_verify_recurse(child);
+        child_height[i] = rbtree_verify_recurse(tree, child);
         if(child_height[i] < 0)
             return -1;
     }
@@ -606,6 +1333,11 @@ rbtree_verify_recurse(RBTREE_NODE* node)
     if(child_height[0] != child_height[1])
         return -1;
 
+    /* Subtree size has to be right. */
+    if((tree->flags & RBTREE_ORDERSTAT)  &&
+       OS_SIZE(node) != 1 + SIZE(children[0]) + SIZE(children[1]))
+        return -1;
+
     return child_height[0] + (IS_BLACK(node) ? 1 : 0);
 }
 
@@ -617,7 +1349,11 @@ rbtree_verify(RBTREE* tree)
     if(tree->root != NULL  &&  IS_RED(tree->root))
         return -1;
 
-    return (rbtree_verify_recurse(tree->root) >= 0) ? 0 : -1;
+    /* Root must have no parent. */
+    if((tree->flags & RBTREE_PARENT)  &&  tree->root != NULL  &&  PARENT(tree->root) != NULL)
+        return -1;
+
+    return (rbtree_verify_recurse(tree, tree->root) >= 0) ? 0 : -1;
 }
 
 #endif  /* #ifdef CRE_TEST */
@@ -111,10 +111,37 @@ typedef struct RBTREE_NODE {
 } RBTREE_NODE;
 
 
+/* Node structure for trees with RBTREE_ORDERSTAT. Treat as opaque.
+ *
+ * Every node additionally remembers count of nodes in its subtree.
+ */
+typedef struct RBTREE_NODE_OS {
+    RBTREE_NODE node;
+    size_t size;
+} RBTREE_NODE_OS;
+
+
+/* Node structure for trees with RBTREE_PARENT. Treat as opaque.
+ *
+ * Every node additionally remembers its parent (NULL for the root).
+ */
+typedef struct RBTREE_NODE_P {
+    RBTREE_NODE node;
+    RBTREE_NODE* parent;
+} RBTREE_NODE_P;
+
+
+/* Augmentation function type. See rbtree_init_augmented().
+ */
+typedef void (*RBTREE_AUGMENT_FUNC)(RBTREE_NODE*);
+
+
 /* Tree structure. Treat as opaque.
  */
 typedef struct RBTREE {
     RBTREE_NODE* root;
+    unsigned flags;
+    RBTREE_AUGMENT_FUNC augment_func;
 } RBTREE;
 
 
@@ -144,12 +171,63 @@ typedef int (*RBTREE_CMP_FUNC)(const RBTREE_NODE*, const RBTREE_NODE*);
                 ((type*)((char*)(node_ptr) - RBTREE_OFFSETOF__(type, member)))
 
 
+/* Flag for rbtree_init_ex() specifying that all the nodes in the tree are
+ * actually RBTREE_NODE_OS structures, i.e. the tree is an order-statistic
+ * tree.
+ *
+ * The tree then keeps the subtree sizes up to date as it is modified (at a
+ * small cost of insert and remove operations), and in exchange it supports
+ * rbtree_size(), rbtree_select(), rbtree_rank() and rbtree_count_range().
+ */
+#define RBTREE_ORDERSTAT        0x0001
+
+/* Flag for rbtree_init_ex() specifying that all the nodes in the tree are
+ * actually RBTREE_NODE_P structures, i.e. every node knows its parent.
+ *
+ * The tree then supports rbtree_remove_node() and rbtree_next_node() and
+ * rbtree_prev_node(), which need neither a key nor RBTREE_CURSOR.
+ *
+ * (The flag cannot be combined with RBTREE_ORDERSTAT.)
+ */
+#define RBTREE_PARENT           0x0002
+
+
 /* The tree has to be initialized before it is used by any other function.
  */
+RBTREE_INLINE__ void rbtree_init_augmented(RBTREE* tree, unsigned flags,
+                                           RBTREE_AUGMENT_FUNC augment_func)
+        { tree->root = NULL; tree->flags = flags; tree->augment_func = augment_func; }
+RBTREE_INLINE__ void rbtree_init_ex(RBTREE* tree, unsigned flags)
+        { rbtree_init_augmented(tree, flags, NULL); }
 RBTREE_INLINE__ void rbtree_init(RBTREE* tree)
-        { tree->root = NULL; }
+        { rbtree_init_ex(tree, 0); }
 
-#define RBTREE_INITIALIZER      { NULL }
+#define RBTREE_INITIALIZER                              { NULL, 0, NULL }
+#define RBTREE_INITIALIZER_EX(flags)                    { NULL, (flags), NULL }
+#define RBTREE_INITIALIZER_AUGMENTED(flags, func)       { NULL, (flags), (func) }
+
+
+/* Augmented tree: With rbtree_init_augmented(), the application may keep its
+ * own per-node data about the node's subtree (e.g. a sum or a maximum of some
+ * value over all nodes in the subtree), in the structure embedding the node.
+ *
+ * The augmentation function has to recompute such data of the given node from
+ * the node itself and from its children (whose data are already up to date).
+ * Use rbtree_left() and rbtree_right() to get the children.
+ *
+ * The tree calls the function on every node whose subtree changes, bottom up:
+ * During insertion and removal, that is the nodes on the path from the root
+ * to the place of the change; the re-balancing then calls it only on the
+ * nodes it rotates. When joining and splitting trees, it is called on the
+ * nodes those operations touch. Note the function is not called by
+ * rbtree_fini_step().
+ *
+ * This can be combined with any flags.
+ */
+RBTREE_INLINE__ RBTREE_NODE* rbtree_left(const RBTREE_NODE* node)
+        { return (RBTREE_NODE*)((uintptr_t) node->lc & ~(uintptr_t) 0x1); }
+RBTREE_INLINE__ RBTREE_NODE* rbtree_right(const RBTREE_NODE* node)
+        { return node->r; }
 
 
 /* Cleaning a (non-empty) tree can be a more complex operation. Usually, caller
@@ -210,6 +288,27 @@ RBTREE_INLINE__ int rbtree_is_empty(const RBTREE* tree)
  */
 int rbtree_insert(RBTREE* tree, RBTREE_NODE* node, RBTREE_CMP_FUNC cmp_func);
 
+/* Insert a new node into the tree, unless an equal node is already present.
+ *
+ * Returns the node already present in the tree (and then the new node is not
+ * inserted), or the new node itself if it has been inserted. This is cheaper
+ * than rbtree_lookup() followed by rbtree_insert(), as the tree is searched
+ * only once.
+ */
+RBTREE_NODE* rbtree_insert_or_get(RBTREE* tree, RBTREE_NODE* node, RBTREE_CMP_FUNC cmp_func);
+
+/* Build the tree from an array of n nodes, which are already sorted (in the
+ * order as defined by the comparator function which is then used with the
+ * tree) and contain no duplicates.
+ *
+ * This is much faster than inserting the nodes one by one: It takes O(n) time
+ * and no comparator calls at all. The resulting tree is perfectly balanced.
+ *
+ * The tree has to be empty. Returns 0 on success or -1 if the tree is not
+ * empty.
+ */
+int rbtree_build_sorted(RBTREE* tree, RBTREE_NODE* const* nodes, size_t n);
+
 /* Remove a node equal to the key (as defined by the comparator function).
  *
  * Returns pointer to the node disconnected from the tree (so that caller can
@@ -217,6 +316,14 @@ int rbtree_insert(RBTREE* tree, RBTREE_NODE* node, RBTREE_CMP_FUNC cmp_func);
  */
 RBTREE_NODE* rbtree_remove(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func);
 
+/* Remove the given node from the tree. This may be used only on trees
+ * initialized with the flag RBTREE_PARENT.
+ *
+ * Unlike rbtree_remove(), it calls no comparator function: The node is found
+ * by following the parent links up to the root.
+ */
+void rbtree_remove_node(RBTREE* tree, RBTREE_NODE* node);
+
 /* Find a node equal to the key (as defined by the comparator function).
  *
  * Returns pointer to the found node or NULL if no such node has been found in
@@ -225,6 +332,41 @@ RBTREE_NODE* rbtree_remove(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC
 RBTREE_NODE* rbtree_lookup(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func);
 
 
+/* Join two trees into one, moving all the nodes of tree1, the pivot node and
+ * all the nodes of tree2 into tree1. The tree2 becomes empty.
+ *
+ * All nodes in tree1 have to be lower than the pivot, and all nodes in tree2
+ * have to be greater than the pivot (as defined by the comparator function
+ * used for the trees). Both trees have to use the same flags.
+ *
+ * The pivot need not be initialized. The join takes O(log n) time and calls
+ * no comparator function.
+ */
+void rbtree_join(RBTREE* tree1, RBTREE_NODE* pivot, RBTREE* tree2);
+
+/* Split the tree into two: All nodes lower than the key are moved into the
+ * left tree, all the others (i.e. greater or equal to the key) into the right
+ * tree. The tree then becomes empty (unless it is the same as left or right).
+ *
+ * The left and right trees need not be initialized (they get the same flags
+ * as the tree). The split takes O(log n) time.
+ */
+void rbtree_split(RBTREE* tree, const RBTREE_NODE* key, RBTREE* left, RBTREE* right,
+                  RBTREE_CMP_FUNC cmp_func);
+
+/* Remove all nodes in the closed range [lo, hi] from the tree.
+ *
+ * If callback is not NULL, it is called for every removed node (after it is
+ * disconnected from the tree, so that it may e.g. free it), in the ascending
+ * order.
+ *
+ * Returns count of removed nodes. It takes O(log n + k) time, where k is the
+ * count of the removed nodes.
+ */
+size_t rbtree_remove_range(RBTREE* tree, const RBTREE_NODE* lo, const RBTREE_NODE* hi,
+                           RBTREE_CMP_FUNC cmp_func, void (*callback)(RBTREE_NODE*));
+
+
 /* The structure and functions below implement a walking over all nodes in the
  * tree. When reaching an end of the iteration, the functions return NULL.
  *
@@ -269,6 +411,61 @@ typedef struct RBTREE_CURSOR {
 RBTREE_NODE* rbtree_lookup_ex(RBTREE* tree, const RBTREE_NODE* key,
                               RBTREE_CMP_FUNC cmp_func, RBTREE_CURSOR* cur);
 
+/* Inexact variants of rbtree_lookup_ex(), useful e.g. for range scans:
+ *
+ *  - rbtree_lower_bound() finds the first node greater than or equal to the key;
+ *  - rbtree_upper_bound() finds the first node greater than the key;
+ *  - rbtree_floor() finds the last node lower than or equal to the key;
+ *  - rbtree_ceiling() finds the first node greater than or equal to the key
+ *    (i.e. it is the same as rbtree_lower_bound(), provided for symmetry with
+ *    rbtree_floor()).
+ *
+ * If there is such node, it is returned and the cursor (if not NULL) points
+ * to it. Otherwise NULL is returned and the cursor is reset.
+ *
+ * For example, to visit all nodes in the range [lo, hi):
+ *
+ * ```
+ * for(node = rbtree_lower_bound(tree, lo, cmp_func, &cur);
+ *     node != NULL  &&  cmp_func(node, hi) < 0;
+ *     node = rbtree_next(&cur))
+ * {
+ *     ...
+ * }
+ * ```
+ */
+RBTREE_NODE* rbtree_lower_bound(RBTREE* tree, const RBTREE_NODE* key,
+                                RBTREE_CMP_FUNC cmp_func, RBTREE_CURSOR* cur);
+RBTREE_NODE* rbtree_upper_bound(RBTREE* tree, const RBTREE_NODE* key,
+                                RBTREE_CMP_FUNC cmp_func, RBTREE_CURSOR* cur);
+RBTREE_NODE* rbtree_floor(RBTREE* tree, const RBTREE_NODE* key,
+                          RBTREE_CMP_FUNC cmp_func, RBTREE_CURSOR* cur);
+RBTREE_INLINE__ RBTREE_NODE* rbtree_ceiling(RBTREE* tree, const RBTREE_NODE* key,
+                                            RBTREE_CMP_FUNC cmp_func, RBTREE_CURSOR* cur)
+        { return rbtree_lower_bound(tree, key, cmp_func, cur); }
+
+/* Finger search: These functions do the same as rbtree_lookup_ex() and
+ * rbtree_insert(), but they start the search at the current position of the
+ * cursor and climb up from it only as far as needed. So for keys near the
+ * cursor, they are much cheaper than a search from the root. E.g. inserting
+ * nodes in the ascending order (with the cursor reused from the previous
+ * insertion) takes O(1) amortized comparisons per node.
+ *
+ * rbtree_lookup_from() returns the node equal to the key (and points the cursor
+ * to it), or NULL if there is no such node (the cursor then points to a node
+ * neighboring with the key). It also returns NULL if the cursor points to
+ * nowhere.
+ *
+ * rbtree_insert_hint() returns 0 on success, and the cursor then points to
+ * the inserted node. If an equal node is already in the tree, it returns -1,
+ * and the cursor points to that node. If the cursor points to nowhere, the
+ * search starts from the root.
+ */
+RBTREE_NODE* rbtree_lookup_from(RBTREE_CURSOR* cur, const RBTREE_NODE* key,
+                                RBTREE_CMP_FUNC cmp_func);
+int rbtree_insert_hint(RBTREE* tree, RBTREE_CURSOR* cur, RBTREE_NODE* node,
+                       RBTREE_CMP_FUNC cmp_func);
+
 /* Get the node corresponding to the current position of the cursor; or NULL.
  */
 RBTREE_NODE* rbtree_current(RBTREE_CURSOR* cur);
@@ -294,6 +491,52 @@ RBTREE_NODE* rbtree_tail(RBTREE* tree, RBTREE_CURSOR* cur);
 RBTREE_NODE* rbtree_next(RBTREE_CURSOR* cur);
 RBTREE_NODE* rbtree_prev(RBTREE_CURSOR* cur);
 
+/* Iteration without any cursor: The node itself serves as the position.
+ *
+ * rbtree_first() and rbtree_last() return the first or the last node in the
+ * tree (or NULL if the tree is empty).
+ *
+ * rbtree_next_node() and rbtree_prev_node() return the next or the previous
+ * node (or NULL if there is none). These may be used only on trees initialized
+ * with the flag RBTREE_PARENT; they take O(1) amortized time.
+ *
+ * Unlike RBTREE_CURSOR, the node stays a valid position even if other nodes
+ * are added into the tree or removed from it.
+ *
+ * ```
+ * for(node = rbtree_first(tree); node != NULL; node = rbtree_next_node(node)) {
+ *     ...
+ * }
+ * ```
+ */
+RBTREE_NODE* rbtree_first(RBTREE* tree);
+RBTREE_NODE* rbtree_last(RBTREE* tree);
+RBTREE_NODE* rbtree_next_node(RBTREE_NODE* node);
+RBTREE_NODE* rbtree_prev_node(RBTREE_NODE* node);
+
+
+/* Order-statistic queries. These may be used only on trees initialized with
+ * the flag RBTREE_ORDERSTAT. All of them are O(log n), except rbtree_size()
+ * which is O(1).
+ *
+ * rbtree_size() returns count of nodes in the tree.
+ *
+ * rbtree_select() returns the k-th smallest node (counting from zero), or
+ * NULL if the tree has no more than k nodes. If cur is not NULL, it is also
+ * set to point to the node (or reset if not found), so caller may continue
+ * with rbtree_next() and rbtree_prev() from there.
+ *
+ * rbtree_rank() returns count of nodes lower than the key. (If the key is in
+ * the tree, that is its index as understood by rbtree_select().)
+ *
+ * rbtree_count_range() returns count of nodes in the closed range [lo, hi].
+ */
+size_t rbtree_size(const RBTREE* tree);
+RBTREE_NODE* rbtree_select(RBTREE* tree, size_t k, RBTREE_CURSOR* cur);
+size_t rbtree_rank(RBTREE* tree, const RBTREE_NODE* key, RBTREE_CMP_FUNC cmp_func);
+size_t rbtree_count_range(RBTREE* tree, const RBTREE_NODE* lo, const RBTREE_NODE* hi,
+                          RBTREE_CMP_FUNC cmp_func);
+
 
 #ifdef __cplusplus
 }
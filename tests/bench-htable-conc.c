@@ -0,0 +1,253 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Read-scaling benchmark of HTABLE_CONC: Lookups from 1 to N threads into
+ * HTABLE_CONC (with lock-free readers), compared with the same lookups into
+ * a plain HTABLE guarded by a mutex.
+ *
+ * Usage: bench-htable-conc [COUNT [MAX_THREADS]]
+ *
+ * COUNT is the count of nodes in the table (default: 1M), MAX_THREADS is the
+ * maximal count of reading threads (default: count of CPUs).
+ */
+
+#include "htable.h"
+#include "threads.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <time.h>
+    #include <unistd.h>
+#endif
+
+
+#define LOOKUPS_PER_THREAD      (2 * 1024 * 1024)
+#define MAX_THREADS             256
+
+
+typedef struct VAL {
+    HTABLE_NODE the_node;
+    uint64_t key;
+} VAL;
+
+static uint32_t
+hash_func(const HTABLE_NODE* node)
+{
+    uint64_t x = HTABLE_DATA(node, VAL, the_node)->key;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (uint32_t) x;
+}
+
+static int
+cmp_func(const HTABLE_NODE* node1, const HTABLE_NODE* node2)
+{
+    return (HTABLE_DATA(node1, VAL, the_node)->key != HTABLE_DATA(node2, VAL, the_node)->key);
+}
+
+
+static double
+now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, t;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (double) t.QuadPart / (double) freq.QuadPart;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + (double) t.tv_nsec * 1e-9;
+#endif
+}
+
+static unsigned
+cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (unsigned) info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (unsigned) n : 1;
+#endif
+}
+
+
+/*************************
+ ***   The benchmark   ***
+ *************************/
+
+static size_t count;
+static VAL* conc_vals;
+static VAL* plain_vals;
+static HTABLE_CONC conc_table;
+static HTABLE plain_table = HTABLE_INITIALIZER;
+static MUTEX plain_mutex;
+
+typedef struct READER {
+    unsigned index;
+    uint64_t random_state;
+    size_t found;
+} READER;
+
+/* Simple xorshift generator, so that we do not depend on the quality of
+ * rand() of the platform (nor on its thread safety). */
+static uint64_t
+next_random(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static THREAD_FUNC_RET
+conc_reader(void* arg)
+{
+    READER* reader = (READER*) arg;
+    VAL key;
+    int i;
+
+    for(i = 0; i < LOOKUPS_PER_THREAD; i++) {
+        key.key = conc_vals[next_random(&reader->random_state) % count].key;
+
+        htable_conc_read_begin(&conc_table, reader->index);
+        if(htable_conc_lookup(&conc_table, &key.the_node, cmp_func, hash_func) != NULL)
+            reader->found++;
+        htable_conc_read_end(&conc_table, reader->index);
+    }
+
+    return 0;
+}
+
+static THREAD_FUNC_RET
+plain_reader(void* arg)
+{
+    READER* reader = (READER*) arg;
+    VAL key;
+    int i;
+
+    for(i = 0; i < LOOKUPS_PER_THREAD; i++) {
+        key.key = plain_vals[next_random(&reader->random_state) % count].key;
+
+        mutex_lock(&plain_mutex);
+        if(htable_lookup(&plain_table, &key.the_node, cmp_func, hash_func) != NULL)
+            reader->found++;
+        mutex_unlock(&plain_mutex);
+    }
+
+    return 0;
+}
+
+/* Returns millions of lookups per second. */
+static double
+run(THREAD_FUNC_RET (*func)(void*), unsigned n_threads)
+{
+    THREAD threads[MAX_THREADS];
+    READER readers[MAX_THREADS];
+    double start, duration;
+    unsigned i;
+
+    start = now();
+    for(i = 0; i < n_threads; i++) {
+        readers[i].index = i;
+        readers[i].random_state = 0x9e3779b97f4a7c15ULL * (i + 1);
+        readers[i].found = 0;
+        if(thread_create(&threads[i], func, &readers[i]) != 0) {
+            fprintf(stderr, "Cannot create a thread.\n");
+            exit(1);
+        }
+    }
+    for(i = 0; i < n_threads; i++)
+        thread_join(threads[i]);
+    duration = now() - start;
+
+    for(i = 0; i < n_threads; i++) {
+        if(readers[i].found != LOOKUPS_PER_THREAD) {
+            fprintf(stderr, "Lookup failure.\n");
+            exit(1);
+        }
+    }
+
+    return (double) n_threads * LOOKUPS_PER_THREAD / duration * 1e-6;
+}
+
+int
+main(int argc, char** argv)
+{
+    unsigned max_threads;
+    unsigned n_threads;
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    size_t i;
+
+    count = (argc > 1) ? (size_t) strtoul(argv[1], NULL, 10) : 1024 * 1024;
+    if(count == 0)
+        count = 1;
+    max_threads = (argc > 2) ? (unsigned) strtoul(argv[2], NULL, 10) : cpu_count();
+    if(max_threads == 0)
+        max_threads = 1;
+    if(max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    conc_vals = (VAL*) malloc(count * sizeof(VAL));
+    plain_vals = (VAL*) malloc(count * sizeof(VAL));
+    if(conc_vals == NULL  ||  plain_vals == NULL  ||  htable_conc_init(&conc_table, max_threads) != 0) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    mutex_init(&plain_mutex);
+
+    for(i = 0; i < count; i++) {
+        conc_vals[i].key = next_random(&state);
+        plain_vals[i].key = conc_vals[i].key;
+        if(htable_conc_insert_unsafe(&conc_table, &conc_vals[i].the_node, cmp_func, hash_func) != 0  ||
+           htable_insert_unsafe(&plain_table, &plain_vals[i].the_node, cmp_func, hash_func) != 0) {
+            fprintf(stderr, "Insertion failed.\n");
+            return 1;
+        }
+    }
+
+    printf("Threads    HTABLE_CONC [M/s]    HTABLE+mutex [M/s]\n");
+    for(n_threads = 1; n_threads <= max_threads; n_threads++) {
+        double conc_rate = run(conc_reader, n_threads);
+        double plain_rate = run(plain_reader, n_threads);
+
+        printf("%7u    %17.2f    %18.2f\n", n_threads, conc_rate, plain_rate);
+    }
+
+    mutex_fini(&plain_mutex);
+    htable_conc_fini(&conc_table, NULL);
+    htable_fini(&plain_table, NULL);
+    free(conc_vals);
+    free(plain_vals);
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Simple benchmark of htable_lookup_batch() versus htable_lookup() called in
+ * a loop.
+ *
+ * Usage: bench-htable [COUNT]
+ *
+ * COUNT is the count of nodes in the table (default: 8M). To see any effect of
+ * the batching, the table should be much larger than the last level cache.
+ */
+
+#include "htable.h"
+
+#include <stdio.h>
+#include <time.h>
+
+
+#define BATCH_SIZE      256
+#define N_REPEATS       5
+
+
+typedef struct VAL {
+    HTABLE_NODE the_node;
+    uint64_t key;
+} VAL;
+
+
+static uint32_t
+hash_func(const HTABLE_NODE* node)
+{
+    uint64_t x = HTABLE_DATA(node, VAL, the_node)->key;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (uint32_t) x;
+}
+
+static int
+cmp_func(const HTABLE_NODE* node1, const HTABLE_NODE* node2)
+{
+    return (HTABLE_DATA(node1, VAL, the_node)->key != HTABLE_DATA(node2, VAL, the_node)->key);
+}
+
+/* Simple xorshift generator, so that we do not depend on the quality of
+ * rand() of the platform. */
+static uint64_t
+next_random(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static double
+seconds_since(clock_t start)
+{
+    return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int
+main(int argc, char** argv)
+{
+    HTABLE htable = HTABLE_INITIALIZER;
+    size_t count = 8 * 1024 * 1024;
+    size_t n_lookups;
+    VAL* vals;
+    VAL* keys;
+    const HTABLE_NODE* key_ptrs[BATCH_SIZE];
+    HTABLE_NODE* results[BATCH_SIZE];
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    size_t i, j, found, found_batch;
+    int rep;
+    clock_t start;
+    double t_loop, t_batch;
+
+    if(argc > 1)
+        count = (size_t) strtoul(argv[1], NULL, 10);
+    if(count == 0)
+        count = 1;
+    n_lookups = count;
+
+    vals = (VAL*) malloc(count * sizeof(VAL));
+    keys = (VAL*) malloc(n_lookups * sizeof(VAL));
+    if(vals == NULL  ||  keys == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    for(i = 0; i < count; i++) {
+        vals[i].key = next_random(&state);
+        if(htable_insert_unsafe(&htable, &vals[i].the_node, cmp_func, hash_func) != 0) {
+            fprintf(stderr, "Insertion failed.\n");
+            return 1;
+        }
+    }
+
+    /* Random keys; every other one is present in the table. */
+    for(i = 0; i < n_lookups; i++) {
+        uint64_t r = next_random(&state);
+        keys[i].key = (i % 2 == 0) ? vals[r % count].key : r;
+    }
+
+    /* The measurements are repeated, alternating both variants, and the best
+     * time is taken to reduce noise from the rest of the system. */
+    t_loop = t_batch = 0.0;
+    for(rep = 0; rep < N_REPEATS; rep++) {
+        double t;
+
+        found = 0;
+        start = clock();
+        for(i = 0; i < n_lookups; i++) {
+            if(htable_lookup(&htable, &keys[i].the_node, cmp_func, hash_func) != NULL)
+                found++;
+        }
+        t = seconds_since(start);
+        if(rep == 0  ||  t < t_loop)
+            t_loop = t;
+
+        found_batch = 0;
+        start = clock();
+        for(i = 0; i < n_lookups; i += BATCH_SIZE) {
+            size_t n = (n_lookups - i < BATCH_SIZE) ? n_lookups - i : BATCH_SIZE;
+
+            for(j = 0; j < n; j++)
+                key_ptrs[j] = &keys[i+j].the_node;
+            htable_lookup_batch(&htable, key_ptrs, results, n, cmp_func, hash_func);
+            for(j = 0; j < n; j++) {
+                if(results[j] != NULL)
+                    found_batch++;
+            }
+        }
+        t = seconds_since(start);
+        if(rep == 0  ||  t < t_batch)
+            t_batch = t;
+    }
+
+    printf("htable_lookup():       %8.2f ns/key (%lu found)\n",
+           t_loop * 1e9 / (double) n_lookups, (unsigned long) found);
+    printf("htable_lookup_batch(): %8.2f ns/key (%lu found)\n",
+           t_batch * 1e9 / (double) n_lookups, (unsigned long) found_batch);
+
+    if(t_batch > 0.0)
+        printf("Speedup:               %8.2fx\n", t_loop / t_batch);
+
+    htable_fini(&htable, NULL);
+    free(keys);
+    free(vals);
+    return 0;
+}
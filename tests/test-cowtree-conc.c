@@ -0,0 +1,244 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2018-2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "acutest.h"
+#include "cowtree.h"
+#include "threads.h"
+
+
+/* Provided by cowtree.c when built with CRE_TEST. */
+int cowtree_verify(const COWTREE_SNAPSHOT* snapshot, COWTREE_CMP_FUNC cmp_func);
+
+
+/********************
+ ***   The test   ***
+ ********************/
+
+/* The keys below N_STABLE are inserted before the readers start and never
+ * removed, so the readers must always find them. All the other keys come and
+ * go at random. */
+#define N_READERS       4
+#define N_STABLE        1000
+#define N_KEYS          100000
+#define N_OPS           200000
+
+typedef struct VAL {
+    int x;
+    COWTREE_ITEM item;
+} VAL;
+
+typedef struct READER {
+    unsigned index;
+    unsigned long n_rounds;
+    unsigned long n_errors;
+} READER;
+
+static COWTREE tree;
+static MUTEX stop_mutex;
+static int stop;
+static int n_destroyed;
+
+static int
+val_cmp(const COWTREE_ITEM* item1, const COWTREE_ITEM* item2)
+{
+    const VAL* val1 = COWTREE_DATA(item1, VAL, item);
+    const VAL* val2 = COWTREE_DATA(item2, VAL, item);
+
+    if(val1->x < val2->x)
+        return -1;
+    if(val1->x > val2->x)
+        return +1;
+    return 0;
+}
+
+/* Only the writer (from cowtree_publish() and cowtree_fini()) destroys the
+ * items, so the counter needs no synchronization. Poison the value so that
+ * a reader touching a destroyed item is more likely to notice. */
+static void
+val_dtor(COWTREE_ITEM* item)
+{
+    VAL* val = COWTREE_DATA(item, VAL, item);
+
+    val->x = -1;
+    free(val);
+    n_destroyed++;
+}
+
+static int
+insert_val(int x)
+{
+    VAL* val;
+
+    val = (VAL*) malloc(sizeof(VAL));
+    if(val == NULL)
+        return -1;
+    val->x = x;
+    if(cowtree_insert(&tree, &val->item, val_cmp) != 0) {
+        free(val);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+should_stop(void)
+{
+    int ret;
+
+    mutex_lock(&stop_mutex);
+    ret = stop;
+    mutex_unlock(&stop_mutex);
+    return ret;
+}
+
+static unsigned
+next_random(unsigned* seed)
+{
+    *seed = *seed * 1103515245U + 12345U;
+    return (*seed >> 8);
+}
+
+/* Alternate between iterating over a whole acquired snapshot (it must be
+ * sorted and of the announced size) and short read-side sections with
+ * lookups (the stable keys must be there; whatever is found has to match
+ * the key). */
+static THREAD_FUNC_RET
+reader_func(void* arg)
+{
+    READER* reader = (READER*) arg;
+    unsigned seed = reader->index + 1;
+    const COWTREE_SNAPSHOT* snapshot;
+    COWTREE_CURSOR cursor;
+    COWTREE_ITEM* item;
+    VAL key = { 0 };
+    size_t count;
+    int last;
+    int i;
+
+    /* Do at least a few rounds, even if the writer is done early. */
+    while(!should_stop()  ||  reader->n_rounds < 4) {
+        if(reader->n_rounds % 2 == 0) {
+            snapshot = cowtree_acquire(&tree, reader->index);
+            count = 0;
+            last = -1;
+            for(item = cowtree_head(snapshot, &cursor); item != NULL; item = cowtree_next(&cursor)) {
+                if(COWTREE_DATA(item, VAL, item)->x <= last)
+                    reader->n_errors++;
+                last = COWTREE_DATA(item, VAL, item)->x;
+                count++;
+            }
+            if(count != cowtree_size(snapshot)  ||  count < N_STABLE)
+                reader->n_errors++;
+            cowtree_release(snapshot);
+        } else {
+            snapshot = cowtree_read_begin(&tree, reader->index);
+            for(i = 0; i < 100; i++) {
+                key.x = (int) (next_random(&seed) % N_KEYS);
+                item = cowtree_lookup(snapshot, &key.item, val_cmp);
+                if(item != NULL  &&  COWTREE_DATA(item, VAL, item)->x != key.x)
+                    reader->n_errors++;
+                if(item == NULL  &&  key.x < N_STABLE)
+                    reader->n_errors++;
+            }
+            cowtree_read_end(&tree, reader->index);
+        }
+        reader->n_rounds++;
+    }
+
+    return 0;
+}
+
+static void
+test_stress(void)
+{
+    THREAD threads[N_READERS];
+    READER readers[N_READERS];
+    const COWTREE_SNAPSHOT* snapshot;
+    VAL key = { 0 };
+    unsigned seed = 1;
+    unsigned r;
+    int n_inserted = 0;
+    int i;
+
+    /* The writer uses the extra reader slot for its own checks. */
+    TEST_ASSERT(cowtree_init(&tree, N_READERS + 1, val_dtor) == 0);
+    mutex_init(&stop_mutex);
+    stop = 0;
+    n_destroyed = 0;
+
+    for(i = 0; i < N_STABLE; i++) {
+        TEST_CHECK(insert_val(i) == 0);
+        n_inserted++;
+    }
+    TEST_CHECK(cowtree_publish(&tree) == 0);
+
+    for(r = 0; r < N_READERS; r++) {
+        readers[r].index = r;
+        readers[r].n_rounds = 0;
+        readers[r].n_errors = 0;
+        TEST_ASSERT(thread_create(&threads[r], reader_func, &readers[r]) == 0);
+    }
+
+    for(i = 0; i < N_OPS; i++) {
+        unsigned rnd = next_random(&seed);
+
+        key.x = N_STABLE + (int) (rnd % (N_KEYS - N_STABLE));
+        if((rnd >> 20) % 2 == 0) {
+            if(insert_val(key.x) == 0)
+                n_inserted++;
+        } else {
+            cowtree_remove(&tree, &key.item, val_cmp);
+        }
+
+        if(i % 3 == 0)
+            TEST_CHECK(cowtree_publish(&tree) == 0);
+
+        if(i % 50000 == 0) {
+            snapshot = cowtree_acquire(&tree, N_READERS);
+            TEST_CHECK(cowtree_verify(snapshot, val_cmp) == 0);
+            cowtree_release(snapshot);
+        }
+    }
+
+    mutex_lock(&stop_mutex);
+    stop = 1;
+    mutex_unlock(&stop_mutex);
+    for(r = 0; r < N_READERS; r++) {
+        thread_join(threads[r]);
+        TEST_CHECK(readers[r].n_errors == 0);
+        TEST_MSG("reader %u: %lu errors in %lu rounds", r,
+                 readers[r].n_errors, readers[r].n_rounds);
+    }
+
+    cowtree_fini(&tree);
+    TEST_CHECK(n_destroyed == n_inserted);
+    mutex_fini(&stop_mutex);
+}
+
+
+TEST_LIST = {
+    { "stress",     test_stress },
+    { NULL, NULL }
+};
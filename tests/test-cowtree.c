@@ -0,0 +1,308 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2018-2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "acutest.h"
+#include "cowtree.h"
+
+#include <stdint.h>
+
+
+/* Provided by cowtree.c when built with CRE_TEST. */
+int cowtree_verify(const COWTREE_SNAPSHOT* snapshot, COWTREE_CMP_FUNC cmp_func);
+
+
+typedef struct VAL {
+    int x;
+    COWTREE_ITEM item;
+} VAL;
+
+static int n_destroyed = 0;
+
+static int
+val_cmp(const COWTREE_ITEM* item1, const COWTREE_ITEM* item2)
+{
+    const VAL* val1 = COWTREE_DATA(item1, VAL, item);
+    const VAL* val2 = COWTREE_DATA(item2, VAL, item);
+
+    if(val1->x < val2->x)
+        return -1;
+    if(val1->x > val2->x)
+        return +1;
+    return 0;
+}
+
+static void
+val_dtor(COWTREE_ITEM* item)
+{
+    free(COWTREE_DATA(item, VAL, item));
+    n_destroyed++;
+}
+
+static COWTREE_ITEM*
+make_val(int x)
+{
+    VAL* v;
+
+    v = (VAL*) malloc(sizeof(VAL));
+    TEST_ASSERT(v != NULL);
+    v->x = x;
+    return &v->item;
+}
+
+static int
+insert_val(COWTREE* tree, int x)
+{
+    COWTREE_ITEM* item = make_val(x);
+
+    if(cowtree_insert(tree, item, val_cmp) != 0) {
+        free(COWTREE_DATA(item, VAL, item));
+        return -1;
+    }
+    return 0;
+}
+
+static int
+remove_val(COWTREE* tree, int x)
+{
+    VAL key = { 0 };
+
+    key.x = x;
+    return cowtree_remove(tree, &key.item, val_cmp);
+}
+
+static int
+contains_val(const COWTREE_SNAPSHOT* snapshot, int x)
+{
+    VAL key = { 0 };
+
+    key.x = x;
+    return (cowtree_lookup(snapshot, &key.item, val_cmp) != NULL);
+}
+
+/* Check the snapshot holds exactly the values from..(to-1) with the given
+ * step, in the ascending order. */
+static int
+check_sequence(const COWTREE_SNAPSHOT* snapshot, int from, int to, int step)
+{
+    COWTREE_CURSOR cur;
+    COWTREE_ITEM* item;
+    int i = from;
+
+    for(item = cowtree_head(snapshot, &cur); item != NULL; item = cowtree_next(&cur)) {
+        if(COWTREE_DATA(item, VAL, item)->x != i)
+            return 0;
+        i += step;
+    }
+    return (i >= to  &&  i < to + step);
+}
+
+
+static void
+test_empty(void)
+{
+    COWTREE tree;
+    const COWTREE_SNAPSHOT* snapshot;
+    COWTREE_CURSOR cur;
+
+    TEST_ASSERT(cowtree_init(&tree, 1, val_dtor) == 0);
+    TEST_CHECK((uintptr_t) tree.readers % 64 == 0);
+    snapshot = cowtree_read_begin(&tree, 0);
+    TEST_CHECK(cowtree_size(snapshot) == 0);
+    TEST_CHECK(cowtree_head(snapshot, &cur) == NULL);
+    TEST_CHECK(!contains_val(snapshot, 42));
+    cowtree_read_end(&tree, 0);
+
+    TEST_CHECK(remove_val(&tree, 42) == -1);
+    TEST_CHECK(cowtree_publish(&tree) == 0);
+    cowtree_fini(&tree);
+}
+
+static void
+test_insert_remove(void)
+{
+    static char present[1000];
+    COWTREE tree;
+    const COWTREE_SNAPSHOT* snapshot;
+    size_t n = 0;
+    int n_inserted = 0;
+    unsigned seed = 1;
+    int i, x;
+
+    n_destroyed = 0;
+    TEST_ASSERT(cowtree_init(&tree, 1, val_dtor) == 0);
+
+    for(i = 0; i < 5000; i++) {
+        seed = seed * 1103515245U + 12345U;
+        x = (seed >> 8) % 1000;
+
+        if((seed >> 20) % 3 != 0) {
+            TEST_CHECK(insert_val(&tree, x) == (present[x] ? -1 : 0));
+            if(!present[x]) {
+                n++;
+                n_inserted++;
+            }
+            present[x] = 1;
+        } else {
+            TEST_CHECK(remove_val(&tree, x) == (present[x] ? 0 : -1));
+            if(present[x])
+                n--;
+            present[x] = 0;
+        }
+
+        /* Publish only sometimes, so that both the copying and the in-place
+         * modifications get exercised. */
+        if(i % 7 == 0) {
+            TEST_CHECK(cowtree_publish(&tree) == 0);
+            snapshot = cowtree_acquire(&tree, 0);
+            if(!TEST_CHECK(cowtree_verify(snapshot, val_cmp) == 0))
+                TEST_MSG("Broken after step %d", i);
+            TEST_CHECK(cowtree_size(snapshot) == n);
+            cowtree_release(snapshot);
+        }
+    }
+    TEST_CHECK(cowtree_size_working(&tree) == n);
+
+    TEST_CHECK(cowtree_publish(&tree) == 0);
+    snapshot = cowtree_read_begin(&tree, 0);
+    for(x = 0; x < 1000; x++) {
+        if(!TEST_CHECK(contains_val(snapshot, x) == present[x]))
+            TEST_MSG("Broken value: %d", x);
+    }
+    cowtree_read_end(&tree, 0);
+
+    /* Every item gets destroyed exactly once. */
+    cowtree_fini(&tree);
+    TEST_CHECK(n_destroyed == n_inserted);
+}
+
+static void
+test_spare(void)
+{
+    COWTREE tree;
+    int i;
+
+    TEST_ASSERT(cowtree_init(&tree, 1, val_dtor) == 0);
+
+    /* Without publishing, all the nodes of the working version are exclusive,
+     * so the removals disassemble them into the spare nodes. They must not
+     * pile up there. */
+    for(i = 0; i < 100000; i++)
+        TEST_CHECK(insert_val(&tree, i) == 0);
+    for(i = 0; i < 100000; i++)
+        TEST_CHECK(remove_val(&tree, i) == 0);
+    TEST_CHECK(cowtree_publish(&tree) == 0);
+    TEST_CHECK(cowtree_size_working(&tree) == 0);
+    TEST_CHECK(tree.n_spare <= 100);
+    TEST_MSG("n_spare: %u", (unsigned) tree.n_spare);
+
+    cowtree_fini(&tree);
+}
+
+static void
+test_snapshots(void)
+{
+    COWTREE tree;
+    const COWTREE_SNAPSHOT* old_snapshot;
+    const COWTREE_SNAPSHOT* new_snapshot;
+    int i;
+
+    n_destroyed = 0;
+    TEST_ASSERT(cowtree_init(&tree, 2, val_dtor) == 0);
+
+    for(i = 0; i < 1000; i++)
+        TEST_CHECK(insert_val(&tree, i) == 0);
+    TEST_CHECK(cowtree_publish(&tree) == 0);
+    old_snapshot = cowtree_acquire(&tree, 0);
+
+    /* Modify the tree and publish a new version. */
+    for(i = 0; i < 1000; i += 2)
+        TEST_CHECK(remove_val(&tree, i) == 0);
+    TEST_CHECK(cowtree_publish(&tree) == 0);
+    new_snapshot = cowtree_acquire(&tree, 1);
+
+    /* The old snapshot is intact, and the removed items are still alive. */
+    TEST_CHECK(cowtree_verify(old_snapshot, val_cmp) == 0);
+    TEST_CHECK(cowtree_size(old_snapshot) == 1000);
+    TEST_CHECK(check_sequence(old_snapshot, 0, 1000, 1));
+    TEST_CHECK(cowtree_verify(new_snapshot, val_cmp) == 0);
+    TEST_CHECK(cowtree_size(new_snapshot) == 500);
+    TEST_CHECK(check_sequence(new_snapshot, 1, 1000, 2));
+    TEST_CHECK(n_destroyed == 0);
+
+    /* Once the old snapshot is released, the removed items are destroyed. */
+    cowtree_release(old_snapshot);
+    cowtree_collect(&tree);
+    TEST_CHECK(n_destroyed == 500);
+    TEST_CHECK(check_sequence(new_snapshot, 1, 1000, 2));
+
+    /* Items removed before they have ever been published are destroyed
+     * immediately. */
+    TEST_CHECK(insert_val(&tree, 5000) == 0);
+    TEST_CHECK(remove_val(&tree, 5000) == 0);
+    TEST_CHECK(n_destroyed == 501);
+
+    cowtree_release(new_snapshot);
+    cowtree_fini(&tree);
+    TEST_CHECK(n_destroyed == 1001);
+}
+
+static void
+test_unpublished(void)
+{
+    COWTREE tree;
+    const COWTREE_SNAPSHOT* snapshot;
+    VAL key = { 0 };
+    int i;
+
+    TEST_ASSERT(cowtree_init(&tree, 1, val_dtor) == 0);
+
+    /* The modifications are invisible to the readers until published. */
+    for(i = 0; i < 100; i++)
+        TEST_CHECK(insert_val(&tree, i) == 0);
+    key.x = 42;
+    TEST_CHECK(cowtree_lookup_working(&tree, &key.item, val_cmp) != NULL);
+    snapshot = cowtree_read_begin(&tree, 0);
+    TEST_CHECK(cowtree_size(snapshot) == 0);
+    TEST_CHECK(!contains_val(snapshot, 42));
+    cowtree_read_end(&tree, 0);
+
+    TEST_CHECK(cowtree_publish(&tree) == 0);
+    snapshot = cowtree_read_begin(&tree, 0);
+    TEST_CHECK(cowtree_size(snapshot) == 100);
+    TEST_CHECK(contains_val(snapshot, 42));
+    cowtree_read_end(&tree, 0);
+
+    cowtree_fini(&tree);
+}
+
+
+TEST_LIST = {
+    { "empty",          test_empty },
+    { "insert-remove",  test_insert_remove },
+    { "spare",          test_spare },
+    { "snapshots",      test_snapshots },
+    { "unpublished",    test_unpublished },
+    { NULL, NULL }
+};
@@ -0,0 +1,179 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "acutest.h"
+#include "htable.h"
+#include "threads.h"
+
+
+/********************
+ ***   The test   ***
+ ********************/
+
+/* The keys below N_STABLE are inserted before the readers start and never
+ * removed, so the readers must always find them. The writer repeatedly
+ * inserts and removes all the other keys, so the table keeps growing and
+ * shrinking under the readers' hands. */
+#define N_READERS       4
+#define N_STABLE        1000
+#define N_KEYS          50000
+#define N_ROUNDS        4
+
+typedef struct VAL {
+    HTABLE_NODE the_node;
+    uint32_t key;
+} VAL;
+
+typedef struct READER {
+    unsigned index;
+    unsigned long n_rounds;
+    unsigned long n_errors;
+} READER;
+
+static HTABLE_CONC htable;
+static VAL vals[N_KEYS];
+static MUTEX stop_mutex;
+static int stop;
+
+static uint32_t
+hash_func(const HTABLE_NODE* node)
+{
+    uint32_t x = HTABLE_DATA(node, VAL, the_node)->key;
+
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static int
+cmp_func(const HTABLE_NODE* node1, const HTABLE_NODE* node2)
+{
+    return (HTABLE_DATA(node1, VAL, the_node)->key != HTABLE_DATA(node2, VAL, the_node)->key);
+}
+
+static int
+should_stop(void)
+{
+    int ret;
+
+    mutex_lock(&stop_mutex);
+    ret = stop;
+    mutex_unlock(&stop_mutex);
+    return ret;
+}
+
+static THREAD_FUNC_RET
+reader_func(void* arg)
+{
+    READER* reader = (READER*) arg;
+    uint32_t seed = reader->index + 1;
+    HTABLE_NODE* node;
+    VAL key;
+    int i;
+
+    /* Do at least a few rounds, even if the writer is done early. */
+    while(!should_stop()  ||  reader->n_rounds < 4) {
+        htable_conc_read_begin(&htable, reader->index);
+        for(i = 0; i < 100; i++) {
+            seed = seed * 1103515245U + 12345U;
+            /* Every other lookup goes for a stable key. */
+            key.key = (seed >> 8) % ((i % 2 == 0) ? N_STABLE : N_KEYS);
+            node = htable_conc_lookup(&htable, &key.the_node, cmp_func, hash_func);
+            if(node != NULL  &&  node != &vals[key.key].the_node)
+                reader->n_errors++;
+            if(node == NULL  &&  key.key < N_STABLE)
+                reader->n_errors++;
+        }
+        htable_conc_read_end(&htable, reader->index);
+        reader->n_rounds++;
+    }
+
+    return 0;
+}
+
+static void
+test_stress(void)
+{
+    THREAD threads[N_READERS];
+    READER readers[N_READERS];
+    VAL key;
+    unsigned r;
+    int round;
+    int i;
+
+    TEST_ASSERT(htable_conc_init(&htable, N_READERS) == 0);
+    mutex_init(&stop_mutex);
+    stop = 0;
+
+    for(i = 0; i < N_KEYS; i++)
+        vals[i].key = (uint32_t) i;
+    for(i = 0; i < N_STABLE; i++)
+        TEST_CHECK(htable_conc_insert(&htable, &vals[i].the_node, cmp_func, hash_func) == 0);
+
+    for(r = 0; r < N_READERS; r++) {
+        readers[r].index = r;
+        readers[r].n_rounds = 0;
+        readers[r].n_errors = 0;
+        TEST_ASSERT(thread_create(&threads[r], reader_func, &readers[r]) == 0);
+    }
+
+    for(round = 0; round < N_ROUNDS; round++) {
+        /* Grow. */
+        for(i = N_STABLE; i < N_KEYS; i++)
+            TEST_CHECK(htable_conc_insert(&htable, &vals[i].the_node, cmp_func, hash_func) == 0);
+
+        /* Shrink (in a different order). */
+        for(i = N_KEYS - 1; i >= N_STABLE; i--) {
+            key.key = (uint32_t) i;
+            TEST_CHECK(htable_conc_remove(&htable, &key.the_node, cmp_func, hash_func) == &vals[i].the_node);
+        }
+
+        /* The removed nodes may still be in use by the readers. Wait for them
+         * before inserting the nodes again. */
+        htable_conc_synchronize(&htable);
+    }
+
+    mutex_lock(&stop_mutex);
+    stop = 1;
+    mutex_unlock(&stop_mutex);
+    for(r = 0; r < N_READERS; r++) {
+        thread_join(threads[r]);
+        TEST_CHECK(readers[r].n_errors == 0);
+        TEST_MSG("reader %u: %lu errors in %lu rounds", r,
+                 readers[r].n_errors, readers[r].n_rounds);
+    }
+
+    htable_conc_fini(&htable, NULL);
+    mutex_fini(&stop_mutex);
+}
+
+
+TEST_LIST = {
+    { "stress",     test_stress },
+    { NULL, NULL }
+};
@@ -68,6 +68,23 @@ hash_func(const HTABLE_NODE* node)
     return fnv1a;
 }
 
+/* Deliberately weak hash function: The low bits are always zero. */
+static uint32_t
+weak_hash_func(const HTABLE_NODE* node)
+{
+    VAL* val = (VAL*) HTABLE_DATA(node, VAL, the_node);
+    return (uint32_t) atoi(val->key) << 16;
+}
+
+/* Adversarial hash function: Distinct hashes, but all multiples of the size of
+ * any plane up to 60416 buckets, so they all land in a single bucket. */
+static uint32_t
+flood_hash_func(const HTABLE_NODE* node)
+{
+    VAL* val = (VAL*) HTABLE_DATA(node, VAL, the_node);
+    return (uint32_t) atoi(val->key) * (59U << 10);
+}
+
 static int
 cmp_func(const HTABLE_NODE* node1, const HTABLE_NODE* node2)
 {
@@ -90,6 +107,64 @@ dtor_func(HTABLE_NODE* node)
 }
 
 
+/* Variant of VAL for tables with HTABLE_CACHEHASH. */
+typedef struct VALH {
+    HTABLE_NODE_H the_node;
+    char* key;
+    int payload;
+} VALH;
+
+static unsigned valh_cmp_calls;
+
+static HTABLE_NODE*
+make_valh(const char* key, int payload)
+{
+    VALH* v;
+
+    v = (VALH*) malloc(sizeof(VALH));
+    TEST_ASSERT(v != NULL);
+
+    v->key = strdup(key);
+    v->payload = payload;
+
+    return &v->the_node.node;
+}
+
+static uint32_t
+valh_hash_func(const HTABLE_NODE* node)
+{
+    VALH* val = (VALH*) HTABLE_DATA(node, VALH, the_node.node);
+    const uint8_t* ptr = (const uint8_t*) val->key;
+    uint32_t fnv1a = 0;
+
+    while(*ptr) {
+        fnv1a ^= *ptr;
+        fnv1a *= 16777619;
+        ptr++;
+    }
+
+    return fnv1a;
+}
+
+static int
+valh_cmp_func(const HTABLE_NODE* node1, const HTABLE_NODE* node2)
+{
+    VALH* data1 = (VALH*) HTABLE_DATA(node1, VALH, the_node.node);
+    VALH* data2 = (VALH*) HTABLE_DATA(node2, VALH, the_node.node);
+
+    valh_cmp_calls++;
+    return strcmp(data1->key, data2->key);
+}
+
+static void
+valh_dtor_func(HTABLE_NODE* node)
+{
+    VALH* val = (VALH*) HTABLE_DATA(node, VALH, the_node.node);
+    free(val->key);
+    free(val);
+}
+
+
 /*****************************
  ***   The test routines   ***
  *****************************/
@@ -180,6 +255,1009 @@ test_remove(void)
     htable_fini(&htable, dtor_func);
 }
 
+static void
+test_migrate(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER;
+    VAL val_key;
+    char key[8];
+    int i, j;
+
+    val_key.key = key;
+
+    /* Verify all the nodes stay reachable while the table grows (and migrates
+     * the nodes from the older plane into the new one) and while it shrinks
+     * back. */
+    for(i = 0; i < 20000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+
+        if(i % 500 == 0) {
+            for(j = 0; j <= i; j++) {
+                snprintf(key, 8, "%d", j);
+                if(!TEST_CHECK(htable_lookup(&htable, &val_key.the_node, cmp_func, hash_func) != NULL)) {
+                    TEST_MSG("Missing element %d after inserting %d", j, i);
+                    break;
+                }
+            }
+        }
+    }
+
+    /* Cheating a little bit here: Verify the migration is long complete. */
+    TEST_CHECK(htable.old_plane == NULL);
+
+    for(i = 0; i < 20000; i++) {
+        snprintf(key, 8, "%d", i);
+        dtor_func(htable_remove(&htable, &val_key.the_node, cmp_func, hash_func));
+
+        if(i % 500 == 0) {
+            for(j = i+1; j < 20000; j++) {
+                snprintf(key, 8, "%d", j);
+                if(!TEST_CHECK(htable_lookup(&htable, &val_key.the_node, cmp_func, hash_func) != NULL)) {
+                    TEST_MSG("Missing element %d after removing %d", j, i);
+                    break;
+                }
+            }
+        }
+    }
+
+    TEST_CHECK(htable_is_empty(&htable));
+    htable_fini(&htable, dtor_func);
+}
+
+static void
+test_pow2(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER_EX(HTABLE_POW2PLANES);
+    VAL val_key;
+    char key[8];
+    int i;
+
+    val_key.key = key;
+
+    for(i = 0; i < 20000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, weak_hash_func) == 0);
+    }
+
+    /* Cheating a little bit here: Verify the plane geometry. */
+    TEST_CHECK((htable.plane_size & (htable.plane_size - 1)) == 0);
+
+    for(i = 0; i < 20000; i++) {
+        HTABLE_NODE* node;
+
+        snprintf(key, 8, "%d", i);
+        node = htable_lookup(&htable, &val_key.the_node, cmp_func, weak_hash_func);
+        TEST_CHECK(node != NULL);
+        TEST_CHECK(HTABLE_DATA(node, VAL, the_node)->payload == i);
+    }
+
+    for(i = 0; i < 20000; i++) {
+        HTABLE_NODE* node;
+
+        snprintf(key, 8, "%d", i);
+        node = htable_remove(&htable, &val_key.the_node, cmp_func, weak_hash_func);
+        TEST_CHECK(node != NULL);
+        TEST_MSG("Broken element: %d", i);
+        dtor_func(node);
+    }
+
+    TEST_CHECK(htable_is_empty(&htable));
+    htable_fini(&htable, dtor_func);
+}
+
+static void
+test_cachehash(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER_EX(HTABLE_CACHEHASH);
+    VALH val_key;
+    char key[8];
+    int i;
+
+    val_key.key = key;
+
+    for(i = 0; i < 20000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_valh(key, i), valh_cmp_func, valh_hash_func) == 0);
+    }
+
+    /* With the cached hashes, a successful lookup should (almost always)
+     * need just a single comparison. */
+    valh_cmp_calls = 0;
+    for(i = 0; i < 20000; i++) {
+        HTABLE_NODE* node;
+
+        snprintf(key, 8, "%d", i);
+        node = htable_lookup(&htable, &val_key.the_node.node, valh_cmp_func, valh_hash_func);
+        TEST_CHECK(node != NULL);
+        TEST_CHECK(HTABLE_DATA(node, VALH, the_node.node)->payload == i);
+    }
+    TEST_CHECK(valh_cmp_calls < 20100);
+    TEST_MSG("Comparator calls: %u", valh_cmp_calls);
+
+    for(i = 0; i < 20000; i++) {
+        HTABLE_NODE* node;
+
+        snprintf(key, 8, "%d", i);
+        node = htable_remove(&htable, &val_key.the_node.node, valh_cmp_func, valh_hash_func);
+        TEST_CHECK(node != NULL);
+        TEST_MSG("Broken element: %d", i);
+        valh_dtor_func(node);
+    }
+
+    TEST_CHECK(htable_is_empty(&htable));
+    htable_fini(&htable, valh_dtor_func);
+}
+
+static void
+test_hashed(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER;
+    HTABLE htable_h = HTABLE_INITIALIZER_EX(HTABLE_CACHEHASH);
+    VAL val_key;
+    VALH valh_key;
+    char key[8];
+    int i;
+
+    val_key.key = key;
+    valh_key.key = key;
+
+    /* Mixing the hashed and the plain functions is fine. */
+    for(i = 0; i < 1000; i++) {
+        HTABLE_NODE* node;
+
+        snprintf(key, 8, "%d", i);
+        node = make_val(key, i);
+        TEST_CHECK(htable_insert_hashed(&htable, node, hash_func(node), cmp_func, hash_func) == 0);
+        TEST_CHECK(htable_insert_hashed(&htable, node, hash_func(node), cmp_func, hash_func) != 0);
+    }
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_lookup_hashed(&htable, &val_key.the_node,
+                        hash_func(&val_key.the_node), cmp_func) ==
+                   htable_lookup(&htable, &val_key.the_node, cmp_func, hash_func));
+        if(i % 2 == 0) {
+            dtor_func(htable_remove_hashed(&htable, &val_key.the_node,
+                        hash_func(&val_key.the_node), cmp_func, hash_func));
+        }
+    }
+    TEST_CHECK(htable.n == 500);
+    htable_fini(&htable, dtor_func);
+
+    /* With HTABLE_CACHEHASH, the table never needs the hash function at all. */
+    for(i = 0; i < 1000; i++) {
+        HTABLE_NODE* node;
+
+        snprintf(key, 8, "%d", i);
+        node = make_valh(key, i);
+        TEST_CHECK(htable_insert_hashed(&htable_h, node, valh_hash_func(node), valh_cmp_func, NULL) == 0);
+    }
+    for(i = 0; i < 1000; i++) {
+        uint32_t hash;
+
+        snprintf(key, 8, "%d", i);
+        hash = valh_hash_func(&valh_key.the_node.node);
+        TEST_CHECK(htable_lookup_hashed(&htable_h, &valh_key.the_node.node, hash, valh_cmp_func) != NULL);
+        valh_dtor_func(htable_remove_hashed(&htable_h, &valh_key.the_node.node, hash, valh_cmp_func, NULL));
+    }
+    TEST_CHECK(htable_is_empty(&htable_h));
+    htable_fini(&htable_h, valh_dtor_func);
+}
+
+static void
+test_multimap(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER_EX(HTABLE_MULTIMAP);
+    HTABLE_CURSOR cur;
+    HTABLE_NODE* node;
+    VAL val_key;
+    char key[8];
+    int i, j, mask;
+
+    val_key.key = key;
+
+    /* Key i is present (i % 5 + 1) times, and every copy has a distinct
+     * payload i + 1000 * j. Insert them interleaved so that the table grows
+     * (and migrates) meanwhile. */
+    for(j = 0; j < 5; j++) {
+        for(i = 0; i < 1000; i++) {
+            if(j <= i % 5) {
+                snprintf(key, 8, "%d", i);
+                TEST_CHECK(htable_insert(&htable, make_val(key, i + 1000 * j), cmp_func, hash_func) == 0);
+            }
+        }
+    }
+    TEST_CHECK(htable.n == 3000);
+
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_count(&htable, &val_key.the_node, cmp_func, hash_func) == (size_t) (i % 5 + 1));
+        TEST_MSG("Broken element: %d", i);
+
+        mask = 0;
+        for(node = htable_lookup_all(&htable, &val_key.the_node, &cur, cmp_func, hash_func);
+            node != NULL;
+            node = htable_next_equal(&cur, cmp_func))
+        {
+            int payload = HTABLE_DATA(node, VAL, the_node)->payload;
+            TEST_CHECK(payload % 1000 == i);
+            mask |= (1 << (payload / 1000));
+        }
+        TEST_CHECK(mask == (1 << (i % 5 + 1)) - 1);
+        TEST_MSG("Broken element: %d", i);
+    }
+
+    /* Remove the copies with an odd j during the equal-range iteration. */
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        for(node = htable_lookup_all(&htable, &val_key.the_node, &cur, cmp_func, hash_func);
+            node != NULL;
+            node = htable_next_equal(&cur, cmp_func))
+        {
+            if((HTABLE_DATA(node, VAL, the_node)->payload / 1000) % 2 == 1)
+                dtor_func(htable_remove_at_cursor(&cur));
+        }
+        TEST_CHECK(htable_count(&htable, &val_key.the_node, cmp_func, hash_func) == (size_t) ((i % 5) / 2 + 1));
+        TEST_MSG("Broken element: %d", i);
+    }
+
+    /* htable_remove() removes them one by one. */
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        while((node = htable_remove(&htable, &val_key.the_node, cmp_func, hash_func)) != NULL)
+            dtor_func(node);
+        TEST_CHECK(htable_lookup(&htable, &val_key.the_node, cmp_func, hash_func) == NULL);
+    }
+    TEST_CHECK(htable_is_empty(&htable));
+
+    htable_fini(&htable, dtor_func);
+}
+
+static void
+test_reserve(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER;
+    HTABLE_NODE** plane;
+    VAL val_key;
+    char key[8];
+    int i;
+
+    val_key.key = key;
+
+    /* No growing after the reservation. */
+    TEST_CHECK(htable_reserve(&htable, 10000, hash_func) == 0);
+    plane = htable.plane;
+    for(i = 0; i < 10000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+    TEST_CHECK(htable.plane == plane);
+    TEST_CHECK(htable.old_plane == NULL);
+    htable_fini(&htable, dtor_func);
+
+    /* Reservation in a non-empty table moves the present nodes. */
+    for(i = 0; i < 100; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+    TEST_CHECK(htable_reserve(&htable, 5000, hash_func) == 0);
+    TEST_CHECK(htable.old_plane == NULL);
+    TEST_CHECK(htable.plane_size > 5000);
+    for(i = 0; i < 100; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_lookup(&htable, &val_key.the_node, cmp_func, hash_func) != NULL);
+        TEST_MSG("Broken element: %d", i);
+    }
+    htable_fini(&htable, dtor_func);
+}
+
+static void
+test_shrink_policy(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER_EX(HTABLE_NOSHRINK);
+    uint32_t plane_size;
+    VAL val_key;
+    char key[8];
+    int i;
+
+    val_key.key = key;
+
+    /* Never shrink. */
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+    plane_size = htable.plane_size;
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        dtor_func(htable_remove(&htable, &val_key.the_node, cmp_func, hash_func));
+    }
+    TEST_CHECK(htable.plane != NULL);
+    TEST_CHECK(htable.plane_size == plane_size);
+    htable_fini(&htable, NULL);
+
+    /* Custom low-water mark. */
+    htable_init(&htable);
+    htable_set_shrink_policy(&htable, 10, 0);
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+    plane_size = htable.plane_size;
+    for(i = 0; i < 1000  &&  (htable.n - 1) * 10 >= plane_size; i++) {
+        snprintf(key, 8, "%d", i);
+        dtor_func(htable_remove(&htable, &val_key.the_node, cmp_func, hash_func));
+        TEST_CHECK(htable.plane_size == plane_size);
+    }
+    snprintf(key, 8, "%d", i);
+    dtor_func(htable_remove(&htable, &val_key.the_node, cmp_func, hash_func));
+    TEST_CHECK(htable.plane_size == plane_size / 2);
+    htable_fini(&htable, dtor_func);
+
+    /* Minimal size. */
+    htable_init(&htable);
+    htable_set_shrink_policy(&htable, 25, 500);
+    for(i = 0; i < 2000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+    for(i = 0; i < 2000; i++) {
+        snprintf(key, 8, "%d", i);
+        dtor_func(htable_remove(&htable, &val_key.the_node, cmp_func, hash_func));
+    }
+    TEST_CHECK(htable_is_empty(&htable));
+    TEST_CHECK(htable.plane != NULL);
+    TEST_CHECK(htable.plane_size > 500);
+    htable_fini(&htable, NULL);
+}
+
+/* Deliberately broken hash function: All nodes collide. */
+static uint32_t
+const_hash_func(const HTABLE_NODE* node)
+{
+    return 42;
+}
+
+static void
+test_stats(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER;
+    HTABLE_STATS stats;
+    VAL val_key;
+    char key[8];
+    size_t sum;
+    int i;
+
+    val_key.key = key;
+
+    htable_stats(&htable, &stats);
+    TEST_CHECK(stats.n == 0);
+    TEST_CHECK(stats.n_planes == 0);
+    TEST_CHECK(stats.max_chain == 0);
+
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+
+    htable_stats(&htable, &stats);
+    TEST_CHECK(stats.n == 1000);
+    TEST_CHECK(stats.n_planes >= 1);
+    sum = 0;
+    for(i = 0; i < (int) stats.n_planes; i++)
+        sum += stats.planes[i].n_nodes;
+    TEST_CHECK(sum == 1000);
+    sum = 0;
+    for(i = 0; i < HTABLE_STATS_HISTOGRAM_SIZE; i++)
+        sum += stats.histogram[i];
+    TEST_CHECK(sum == stats.planes[0].size + (stats.n_planes > 1 ? stats.planes[1].size : 0));
+    TEST_CHECK(stats.max_chain < 16);
+    TEST_CHECK(stats.mean_chain >= 1.0  &&  stats.mean_chain < 3.0);
+    TEST_MSG("max_chain: %u, mean_chain: %f", (unsigned) stats.max_chain, stats.mean_chain);
+
+#ifdef CRE_HTABLE_STATS
+    TEST_CHECK(stats.counters.n_lookups == 1000);
+    TEST_CHECK(stats.counters.n_grows >= 4);
+    TEST_CHECK(stats.counters.n_shrinks == 0);
+
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        dtor_func(htable_remove(&htable, &val_key.the_node, cmp_func, hash_func));
+    }
+    htable_stats(&htable, &stats);
+    TEST_CHECK(stats.counters.n_lookups == 2000);
+    TEST_CHECK(stats.counters.n_cmp_calls >= 1000);
+    TEST_CHECK(stats.counters.n_shrinks >= 1);
+#endif
+    htable_fini(&htable, dtor_func);
+
+    /* A broken hash function shows up as one very long chain. */
+    for(i = 0; i < 100; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, const_hash_func) == 0);
+    }
+    htable_stats(&htable, &stats);
+    TEST_CHECK(stats.max_chain == 100);
+    TEST_CHECK(stats.mean_chain == 100.0);
+    TEST_CHECK(stats.histogram[HTABLE_STATS_HISTOGRAM_SIZE-1] == 1);
+    htable_fini(&htable, dtor_func);
+}
+
+static void
+test_floodguard(void)
+{
+    HTABLE htable;
+    HTABLE_STATS stats;
+    VAL val_key;
+    char key[8];
+    int i;
+
+    val_key.key = key;
+
+    /* Without the guard, the crafted keys make a single long chain. */
+    htable_init(&htable);
+    for(i = 0; i < 2000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, flood_hash_func) == 0);
+    }
+    htable_stats(&htable, &stats);
+    TEST_CHECK(stats.max_chain > 1000);
+    htable_fini(&htable, dtor_func);
+
+    /* With the guard, the table reseeds itself. */
+    htable_init_ex(&htable, HTABLE_FLOODGUARD);
+    for(i = 0; i < 2000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, flood_hash_func) == 0);
+    }
+    htable_stats(&htable, &stats);
+    TEST_CHECK(stats.max_chain < 20);
+    TEST_MSG("max_chain: %u", (unsigned) stats.max_chain);
+#ifdef CRE_HTABLE_STATS
+    TEST_CHECK(stats.counters.n_reseeds >= 1);
+#endif
+    for(i = 0; i < 2000; i++) {
+        HTABLE_NODE* node;
+
+        snprintf(key, 8, "%d", i);
+        node = htable_lookup(&htable, &val_key.the_node, cmp_func, flood_hash_func);
+        TEST_CHECK(node != NULL  &&  HTABLE_DATA(node, VAL, the_node)->payload == i);
+        TEST_MSG("Broken element: %d", i);
+    }
+    for(i = 0; i < 2000; i += 2) {
+        snprintf(key, 8, "%d", i);
+        dtor_func(htable_remove(&htable, &val_key.the_node, cmp_func, flood_hash_func));
+    }
+    TEST_CHECK(htable.n == 1000);
+    htable_fini(&htable, dtor_func);
+
+    /* Identical hashes cannot be helped, but the table must not be busy with
+     * reseeding all the time either. */
+    htable_init_ex(&htable, HTABLE_FLOODGUARD);
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, const_hash_func) == 0);
+    }
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_lookup(&htable, &val_key.the_node, cmp_func, const_hash_func) != NULL);
+    }
+#ifdef CRE_HTABLE_STATS
+    htable_stats(&htable, &stats);
+    TEST_CHECK(stats.counters.n_reseeds < 100);
+    TEST_MSG("n_reseeds: %u", (unsigned) stats.counters.n_reseeds);
+#endif
+    htable_fini(&htable, dtor_func);
+}
+
+static void
+test_batch(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER;
+    HTABLE_NODE* nodes[1000];
+    const HTABLE_NODE* keys[1500];
+    HTABLE_NODE* results[1500];
+    VAL* key_vals;
+    char key[8];
+    int i;
+
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        nodes[i] = make_val(key, i);
+    }
+    TEST_CHECK(htable_insert_batch(&htable, nodes, 1000, cmp_func, hash_func) == 1000);
+
+    /* Insertion of a batch stops on a duplicate. */
+    TEST_CHECK(htable_insert_batch(&htable, nodes + 500, 1, cmp_func, hash_func) == 0);
+
+    /* Look up all the inserted keys as well as some missing ones. */
+    key_vals = (VAL*) malloc(1500 * sizeof(VAL));
+    TEST_ASSERT(key_vals != NULL);
+    for(i = 0; i < 1500; i++) {
+        key_vals[i].key = (char*) malloc(8);
+        snprintf(key_vals[i].key, 8, "%d", i);
+        keys[i] = &key_vals[i].the_node;
+    }
+    htable_lookup_batch(&htable, keys, results, 1500, cmp_func, hash_func);
+    for(i = 0; i < 1500; i++) {
+        if(i < 1000)
+            TEST_CHECK(results[i] == nodes[i]);
+        else
+            TEST_CHECK(results[i] == NULL);
+        TEST_MSG("Broken element: %d", i);
+        free(key_vals[i].key);
+    }
+    free(key_vals);
+
+    htable_fini(&htable, dtor_func);
+}
+
+/* Type-specialized table with integer keys. */
+typedef struct IVAL {
+    HTABLE_NODE_H the_node;     /* HTABLE_NODE_H so it works also with HTABLE_CACHEHASH. */
+    uint32_t key;
+} IVAL;
+
+#define IVAL_HASH(ival)         ((ival)->key * 2654435761U)
+#define IVAL_EQ(ival1, ival2)   ((ival1)->key == (ival2)->key)
+
+HTABLE_DEFINE(ival_table, IVAL, the_node.node, IVAL_HASH, IVAL_EQ)
+
+static void
+test_define(void)
+{
+    static const unsigned flags[] = { 0, HTABLE_POW2PLANES, HTABLE_CACHEHASH };
+    IVAL* vals;
+    IVAL key;
+    int saw_migration;
+    int f, i;
+
+    vals = (IVAL*) malloc(2000 * sizeof(IVAL));
+    TEST_ASSERT(vals != NULL);
+
+    for(f = 0; f < (int) (sizeof(flags) / sizeof(flags[0])); f++) {
+        HTABLE htable;
+
+        TEST_CASE_("flags 0x%x", flags[f]);
+        htable_init_ex(&htable, flags[f]);
+
+        /* Interleave lookups with the insertions so that they also happen
+         * while a growing migration (from the older plane) is in progress. */
+        saw_migration = 0;
+        for(i = 0; i < 2000; i++) {
+            vals[i].key = i;
+            TEST_CHECK(ival_table_insert(&htable, &vals[i]) == 0);
+            if(htable.old_plane != NULL)
+                saw_migration = 1;
+            key.key = i / 2;
+            TEST_CHECK(ival_table_lookup(&htable, &key) == &vals[i / 2]);
+        }
+        TEST_CHECK(saw_migration);
+        TEST_CHECK(htable.n == 2000);
+
+        /* Duplicate key. */
+        key.key = 123;
+        TEST_CHECK(ival_table_insert(&htable, &key) != 0);
+
+        /* Interleave lookups with removals (so that they also happen after
+         * the table has shrunk). */
+        for(i = 0; i < 2000; i += 2) {
+            key.key = i;
+            TEST_CHECK(ival_table_remove(&htable, &key) == &vals[i]);
+            key.key = i + 1;
+            TEST_CHECK(ival_table_lookup(&htable, &key) == &vals[i + 1]);
+            TEST_CHECK(ival_table_remove(&htable, &key) == &vals[i + 1]);
+            TEST_CHECK(ival_table_insert(&htable, &vals[i + 1]) == 0);
+        }
+        TEST_CHECK(htable.n == 1000);
+
+        for(i = 0; i < 2000; i++) {
+            key.key = i;
+            TEST_CHECK(ival_table_lookup(&htable, &key) == ((i % 2) ? &vals[i] : NULL));
+            TEST_MSG("Broken element: %d", i);
+        }
+
+        /* The generic API works with the generated callbacks too. */
+        key.key = 7;
+        TEST_CHECK(htable_lookup(&htable, &key.the_node.node, ival_table_cmp_func,
+                                 ival_table_hash_func) == &vals[7].the_node.node);
+
+        htable_fini(&htable, NULL);
+    }
+
+    free(vals);
+}
+
+static void
+test_cursor(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER;
+    HTABLE_CURSOR cur;
+    HTABLE_NODE* node;
+    VAL val_key;
+    char key[8];
+    char seen[2000];
+    int i, n;
+
+    val_key.key = key;
+
+    TEST_CHECK(htable_first(&htable, &cur) == NULL);
+
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+
+    /* Every node is visited exactly once. */
+    memset(seen, 0, sizeof(seen));
+    n = 0;
+    for(node = htable_first(&htable, &cur); node != NULL; node = htable_next(&cur)) {
+        seen[HTABLE_DATA(node, VAL, the_node)->payload]++;
+        n++;
+    }
+    TEST_CHECK(n == 1000);
+    for(i = 0; i < 1000; i++) {
+        TEST_CHECK(seen[i] == 1);
+        TEST_MSG("Broken element: %d", i);
+    }
+
+    /* Remove all the odd ones during the iteration. */
+    for(node = htable_first(&htable, &cur); node != NULL; node = htable_next(&cur)) {
+        if(HTABLE_DATA(node, VAL, the_node)->payload % 2 == 1) {
+            TEST_CHECK(htable_remove_at_cursor(&cur) == node);
+            TEST_CHECK(htable_remove_at_cursor(&cur) == NULL);
+            dtor_func(node);
+        }
+    }
+    TEST_CHECK(htable.n == 500);
+    for(i = 0; i < 1000; i++) {
+        snprintf(key, 8, "%d", i);
+        node = htable_lookup(&htable, &val_key.the_node, cmp_func, hash_func);
+        TEST_CHECK((node != NULL) == (i % 2 == 0));
+        TEST_MSG("Broken element: %d", i);
+    }
+
+    /* Cheating a little bit here: Grow the table until there is an old plane
+     * being migrated, to verify the cursor visits both planes. */
+    for(i = 1000; i < 2000  &&  htable.old_plane == NULL; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+    TEST_CHECK(htable.old_plane != NULL);
+    memset(seen, 0, sizeof(seen));
+    n = 0;
+    for(node = htable_first(&htable, &cur); node != NULL; node = htable_next(&cur)) {
+        seen[HTABLE_DATA(node, VAL, the_node)->payload]++;
+        n++;
+    }
+    TEST_CHECK(n == (int) htable.n);
+    for(i = 0; i < 2000; i++) {
+        snprintf(key, 8, "%d", i);
+        node = htable_lookup(&htable, &val_key.the_node, cmp_func, hash_func);
+        TEST_CHECK(seen[i] == (node != NULL ? 1 : 0));
+        TEST_MSG("Broken element: %d", i);
+    }
+
+    /* Remove everything. */
+    for(node = htable_first(&htable, &cur); node != NULL; node = htable_next(&cur))
+        dtor_func(htable_remove_at_cursor(&cur));
+    TEST_CHECK(htable_is_empty(&htable));
+    TEST_CHECK(htable_first(&htable, &cur) == NULL);
+
+    htable_fini(&htable, dtor_func);
+}
+
+static void
+test_cursor_shrink(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER;
+    HTABLE_CURSOR cur;
+    HTABLE_NODE* node;
+    uint32_t plane_size;
+    char key[8];
+    int i;
+
+    /* Reserve so that no migration is in progress, which would prevent any
+     * shrinking. */
+    TEST_CHECK(htable_reserve(&htable, 20000, hash_func) == 0);
+    for(i = 0; i < 20000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+    plane_size = htable.plane_size;
+
+    /* Removing 90 % of nodes in a complete iteration shrinks the table more
+     * than once. */
+    for(node = htable_first(&htable, &cur); node != NULL; node = htable_next(&cur)) {
+        if(HTABLE_DATA(node, VAL, the_node)->payload % 10 != 0)
+            dtor_func(htable_remove_at_cursor(&cur));
+    }
+    TEST_CHECK(htable.n == 2000);
+    TEST_CHECK(htable.plane_size <= plane_size / 4);
+    TEST_CHECK((uint64_t) htable.n * 100 >= (uint64_t) htable.plane_size * 25);
+
+    /* When the iteration is stopped early, htable_compact() has to do it. */
+    plane_size = htable.plane_size;
+    for(node = htable_first(&htable, &cur); node != NULL; node = htable_next(&cur)) {
+        dtor_func(htable_remove_at_cursor(&cur));
+        if(htable.n == 100)
+            break;
+    }
+    TEST_CHECK(htable.plane_size == plane_size);
+    htable_compact(&htable);
+    TEST_CHECK(htable.plane_size < plane_size);
+    TEST_CHECK((uint64_t) htable.n * 100 >= (uint64_t) htable.plane_size * 25);
+
+    htable_fini(&htable, dtor_func);
+}
+
+/* Node for counting occurrences of a key. */
+typedef struct COUNTER {
+    HTABLE_NODE the_node;
+    int key;
+    int count;
+} COUNTER;
+
+static uint32_t
+counter_hash_func(const HTABLE_NODE* node)
+{
+    uint32_t x = (uint32_t) HTABLE_DATA(node, COUNTER, the_node)->key;
+
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static int
+counter_cmp_func(const HTABLE_NODE* node1, const HTABLE_NODE* node2)
+{
+    return (HTABLE_DATA(node1, COUNTER, the_node)->key != HTABLE_DATA(node2, COUNTER, the_node)->key);
+}
+
+static void
+counter_merge_func(HTABLE_NODE* dst, HTABLE_NODE* src)
+{
+    HTABLE_DATA(dst, COUNTER, the_node)->count += HTABLE_DATA(src, COUNTER, the_node)->count;
+    free(HTABLE_DATA(src, COUNTER, the_node));
+}
+
+static void
+counter_dtor_func(HTABLE_NODE* node)
+{
+    free(HTABLE_DATA(node, COUNTER, the_node));
+}
+
+static void
+test_sharded(void)
+{
+    HTABLE_SHARDED workers[3];
+    HTABLE_SHARDED* srcs[3];
+    HTABLE_SHARDED result;
+    COUNTER key;
+    unsigned shard;
+    int i, w;
+
+    TEST_ASSERT(htable_sharded_init(&result, 4, 0) == 0);
+    TEST_CHECK(htable_sharded_count(&result) == 16);
+
+    /* Every worker counts occurrences of keys in its part of the stream; the
+     * worker w sees the key i (i % (w + 2) + 1) times. */
+    for(w = 0; w < 3; w++) {
+        TEST_ASSERT(htable_sharded_init(&workers[w], 4, 0) == 0);
+        srcs[w] = &workers[w];
+
+        for(i = 0; i < 5000; i++) {
+            int j;
+
+            for(j = 0; j < i % (w + 2) + 1; j++) {
+                HTABLE_NODE* node;
+
+                key.key = (w == 1) ? i + 2500 : i;
+                node = htable_sharded_lookup(&workers[w], &key.the_node, counter_cmp_func, counter_hash_func);
+                if(node != NULL) {
+                    HTABLE_DATA(node, COUNTER, the_node)->count++;
+                } else {
+                    COUNTER* c = (COUNTER*) malloc(sizeof(COUNTER));
+                    TEST_ASSERT(c != NULL);
+                    c->key = key.key;
+                    c->count = 1;
+                    TEST_CHECK(htable_sharded_insert(&workers[w], &c->the_node, counter_cmp_func, counter_hash_func) == 0);
+                }
+            }
+        }
+    }
+
+    /* Every shard could be merged in its own thread. */
+    for(shard = 0; shard < htable_sharded_count(&result); shard++) {
+        TEST_CHECK(htable_sharded_merge_shard(&result, srcs, 3, shard, counter_cmp_func,
+                        counter_hash_func, counter_merge_func) == 0);
+    }
+
+    for(w = 0; w < 3; w++) {
+        for(shard = 0; shard < htable_sharded_count(&workers[w]); shard++)
+            TEST_CHECK(htable_is_empty(htable_sharded_shard(&workers[w], shard)));
+        htable_sharded_fini(&workers[w], counter_dtor_func);
+    }
+
+    for(i = 0; i < 7500; i++) {
+        HTABLE_NODE* node;
+        int expected = 0;
+
+        if(i < 5000)
+            expected += i % 2 + 1 + i % 4 + 1;
+        if(i >= 2500)
+            expected += (i - 2500) % 3 + 1;
+
+        key.key = i;
+        node = htable_sharded_lookup(&result, &key.the_node, counter_cmp_func, counter_hash_func);
+        TEST_CHECK(node != NULL  &&  HTABLE_DATA(node, COUNTER, the_node)->count == expected);
+        TEST_MSG("Broken element: %d", i);
+
+        /* Nodes live in the shard given by the high bits of the hash. */
+        TEST_CHECK(htable_lookup(htable_sharded_shard(&result, counter_hash_func(&key.the_node) >> 28),
+                        &key.the_node, counter_cmp_func, counter_hash_func) == node);
+    }
+
+    key.key = 0;
+    counter_dtor_func(htable_sharded_remove(&result, &key.the_node, counter_cmp_func, counter_hash_func));
+    TEST_CHECK(htable_sharded_lookup(&result, &key.the_node, counter_cmp_func, counter_hash_func) == NULL);
+
+    htable_sharded_fini(&result, counter_dtor_func);
+}
+
+static void
+test_flat_insert(void)
+{
+    HTABLE_FLAT htable = HTABLE_FLAT_INITIALIZER;
+    HTABLE_NODE* dup;
+
+    TEST_CHECK(htable_flat_is_empty(&htable));
+    TEST_CHECK(htable_flat_insert(&htable, make_val("key", 42), cmp_func, hash_func) == 0);
+    TEST_CHECK(!htable_flat_is_empty(&htable));
+
+    /* Check we cannot insert value with the same key. */
+    dup = make_val("key", 42);
+    TEST_CHECK(htable_flat_insert(&htable, dup, cmp_func, hash_func) != 0);
+    dtor_func(dup);
+    htable_flat_fini(&htable, dtor_func);
+    TEST_CHECK(htable_flat_is_empty(&htable));
+}
+
+static void
+test_flat_lookup(void)
+{
+    HTABLE_FLAT htable = HTABLE_FLAT_INITIALIZER;
+    VAL val_key;
+    char key[8];
+    int i;
+
+    for(i = 0; i < 100000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_flat_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+
+    for(i = 0; i < 100000; i++) {
+        HTABLE_NODE* node;
+
+        val_key.key = key;
+        snprintf(val_key.key, 8, "%d", i);
+
+        node = htable_flat_lookup(&htable, &val_key.the_node, cmp_func, hash_func);
+        TEST_CHECK(node != NULL);
+        TEST_CHECK(HTABLE_DATA(node, VAL, the_node)->payload == i);
+    }
+
+    val_key.key = key;
+    snprintf(val_key.key, 8, "n/a");
+    TEST_CHECK(htable_flat_lookup(&htable, &val_key.the_node, cmp_func, hash_func) == NULL);
+
+    htable_flat_fini(&htable, dtor_func);
+}
+
+static void
+test_flat_remove(void)
+{
+    HTABLE_FLAT htable = HTABLE_FLAT_INITIALIZER;
+    VAL val_key;
+    char key[8];
+    int i;
+
+    for(i = 0; i < 100000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_flat_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+
+    /* Remove every other node, so the table has to deal with tombstones,
+     * and verify the remaining ones are still reachable. */
+    for(i = 0; i < 100000; i += 2) {
+        HTABLE_NODE* node;
+
+        val_key.key = key;
+        snprintf(val_key.key, 8, "%d", i);
+
+        node = htable_flat_remove(&htable, &val_key.the_node, cmp_func, hash_func);
+        TEST_CHECK(node != NULL);
+        TEST_MSG("Broken element: %d", i);
+        dtor_func(node);
+        TEST_CHECK(htable_flat_lookup(&htable, &val_key.the_node, cmp_func, hash_func) == NULL);
+    }
+
+    for(i = 1; i < 100000; i += 2) {
+        HTABLE_NODE* node;
+
+        val_key.key = key;
+        snprintf(val_key.key, 8, "%d", i);
+
+        node = htable_flat_remove(&htable, &val_key.the_node, cmp_func, hash_func);
+        TEST_CHECK(node != NULL);
+        TEST_MSG("Broken element: %d", i);
+        dtor_func(node);
+    }
+
+    TEST_CHECK(htable_flat_is_empty(&htable));
+    htable_flat_fini(&htable, dtor_func);
+}
+
+static void
+test_conc(void)
+{
+    HTABLE_CONC htable;
+    VAL val_key;
+    char key[8];
+    int i;
+
+    TEST_ASSERT(htable_conc_init(&htable, 2) == 0);
+    TEST_CHECK((uintptr_t) htable.readers % 64 == 0);
+    val_key.key = key;
+
+    for(i = 0; i < 20000; i++) {
+        snprintf(key, 8, "%d", i);
+        TEST_CHECK(htable_conc_insert(&htable, make_val(key, i), cmp_func, hash_func) == 0);
+    }
+
+    snprintf(key, 8, "%d", 42);
+    TEST_CHECK(htable_conc_insert(&htable, &val_key.the_node, cmp_func, hash_func) != 0);
+
+    htable_conc_read_begin(&htable, 1);
+    for(i = 0; i < 20000; i++) {
+        HTABLE_NODE* node;
+
+        snprintf(key, 8, "%d", i);
+        node = htable_conc_lookup(&htable, &val_key.the_node, cmp_func, hash_func);
+        TEST_CHECK(node != NULL);
+        TEST_CHECK(HTABLE_DATA(node, VAL, the_node)->payload == i);
+    }
+    htable_conc_read_end(&htable, 1);
+
+    /* Remove all but the last 100 nodes; it makes the table shrink. */
+    for(i = 0; i < 19900; i++) {
+        HTABLE_NODE* node;
+
+        snprintf(key, 8, "%d", i);
+        node = htable_conc_remove(&htable, &val_key.the_node, cmp_func, hash_func);
+        TEST_CHECK(node != NULL);
+        TEST_MSG("Broken element: %d", i);
+        htable_conc_synchronize(&htable);
+        dtor_func(node);
+    }
+
+    htable_conc_read_begin(&htable, 0);
+    for(i = 0; i < 20000; i++) {
+        snprintf(key, 8, "%d", i);
+        if(i < 19900)
+            TEST_CHECK(htable_conc_lookup(&htable, &val_key.the_node, cmp_func, hash_func) == NULL);
+        else
+            TEST_CHECK(htable_conc_lookup(&htable, &val_key.the_node, cmp_func, hash_func) != NULL);
+    }
+    htable_conc_read_end(&htable, 0);
+
+    htable_conc_fini(&htable, dtor_func);
+    TEST_CHECK(htable_conc_is_empty(&htable));
+}
+
 
 /*************************
  ***   List of tests   ***
@@ -190,5 +1268,23 @@ TEST_LIST = {
     { "insert",     test_insert },
     { "lookup",     test_lookup },
     { "remove",     test_remove },
+    { "migrate",    test_migrate },
+    { "pow2",       test_pow2 },
+    { "cachehash",  test_cachehash },
+    { "hashed",     test_hashed },
+    { "multimap",   test_multimap },
+    { "reserve",    test_reserve },
+    { "shrink-policy", test_shrink_policy },
+    { "stats",      test_stats },
+    { "floodguard", test_floodguard },
+    { "batch",      test_batch },
+    { "define",     test_define },
+    { "cursor",     test_cursor },
+    { "cursor-shrink", test_cursor_shrink },
+    { "sharded",    test_sharded },
+    { "flat-insert", test_flat_insert },
+    { "flat-lookup", test_flat_lookup },
+    { "flat-remove", test_flat_remove },
+    { "conc",       test_conc },
     { NULL, NULL }
 };
@@ -0,0 +1,174 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2018-2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "acutest.h"
+#include "intmap.h"
+
+
+/* Keys with only high bits set, so that they collide without a good mixing. */
+#define KEY(i)      ((uint64_t) (i) << 32)
+
+
+static void
+test_empty(void)
+{
+    INTMAP map = INTMAP_INITIALIZER;
+    size_t iter = 0;
+
+    TEST_CHECK(intmap_is_empty(&map));
+    TEST_CHECK(intmap_lookup(&map, 0) == NULL);
+    TEST_CHECK(intmap_remove(&map, 0, NULL) != 0);
+    TEST_CHECK(!intmap_next(&map, &iter, NULL, NULL));
+
+    intmap_fini(&map);
+}
+
+static void
+test_insert(void)
+{
+    INTMAP map = INTMAP_INITIALIZER;
+    uint64_t* value;
+    int i;
+
+    for(i = 0; i < 10000; i++)
+        TEST_CHECK(intmap_insert(&map, KEY(i), i) == 0);
+    TEST_CHECK(intmap_size(&map) == 10000);
+
+    /* Duplicate and the reserved key are refused. */
+    TEST_CHECK(intmap_insert(&map, KEY(123), 0) != 0);
+    TEST_CHECK(intmap_insert(&map, INTMAP_EMPTY_KEY, 0) != 0);
+    TEST_CHECK(intmap_size(&map) == 10000);
+
+    for(i = 0; i < 10000; i++) {
+        value = intmap_lookup(&map, KEY(i));
+        TEST_CHECK(value != NULL  &&  *value == (uint64_t) i);
+        TEST_MSG("Broken element: %d", i);
+    }
+    TEST_CHECK(intmap_lookup(&map, KEY(10000)) == NULL);
+    TEST_CHECK(intmap_lookup(&map, INTMAP_EMPTY_KEY) == NULL);
+
+    /* Update in place. */
+    value = intmap_lookup(&map, KEY(42));
+    *value = 4242;
+    TEST_CHECK(*intmap_lookup(&map, KEY(42)) == 4242);
+
+    intmap_fini(&map);
+}
+
+static void
+test_remove(void)
+{
+    INTMAP map = INTMAP_INITIALIZER;
+    uint64_t value;
+    int i, j;
+
+    for(i = 0; i < 10000; i++)
+        TEST_CHECK(intmap_insert(&map, KEY(i), i) == 0);
+
+    /* Verify all the remaining entries stay reachable as the others are
+     * removed (and the map shrinks). */
+    for(i = 0; i < 10000; i += 2) {
+        TEST_CHECK(intmap_remove(&map, KEY(i), &value) == 0);
+        TEST_CHECK(value == (uint64_t) i);
+        TEST_CHECK(intmap_remove(&map, KEY(i), &value) != 0);
+
+        if(i % 1000 == 0) {
+            for(j = 0; j < 10000; j++) {
+                int present = (j > i  ||  j % 2 == 1);
+                if(!TEST_CHECK((intmap_lookup(&map, KEY(j)) != NULL) == present)) {
+                    TEST_MSG("Broken element %d after removing %d", j, i);
+                    break;
+                }
+            }
+        }
+    }
+    TEST_CHECK(intmap_size(&map) == 5000);
+
+    for(i = 1; i < 10000; i += 2)
+        TEST_CHECK(intmap_remove(&map, KEY(i), NULL) == 0);
+    TEST_CHECK(intmap_is_empty(&map));
+    TEST_CHECK(map.slots == NULL);
+
+    intmap_fini(&map);
+}
+
+static void
+test_reserve(void)
+{
+    INTMAP map = INTMAP_INITIALIZER;
+    INTMAP_SLOT* slots;
+    int i;
+
+    TEST_CHECK(intmap_reserve(&map, 1000) == 0);
+    slots = map.slots;
+    for(i = 0; i < 1000; i++)
+        TEST_CHECK(intmap_insert(&map, KEY(i), i) == 0);
+    TEST_CHECK(map.slots == slots);
+
+    /* Reserving in a non-empty map keeps the entries. */
+    TEST_CHECK(intmap_reserve(&map, 5000) == 0);
+    for(i = 0; i < 1000; i++)
+        TEST_CHECK(intmap_lookup(&map, KEY(i)) != NULL);
+
+    /* Absurd sizes fail (and leave the map intact). */
+    TEST_CHECK(intmap_reserve(&map, SIZE_MAX) == -1);
+    TEST_CHECK(intmap_size(&map) == 1000);
+
+    intmap_fini(&map);
+}
+
+static void
+test_iterate(void)
+{
+    INTMAP map = INTMAP_INITIALIZER;
+    char seen[1000] = { 0 };
+    size_t iter = 0;
+    uint64_t key, value;
+    int i, n = 0;
+
+    for(i = 0; i < 1000; i++)
+        TEST_CHECK(intmap_insert(&map, KEY(i), i) == 0);
+
+    while(intmap_next(&map, &iter, &key, &value)) {
+        TEST_CHECK(key == KEY(value));
+        seen[value]++;
+        n++;
+    }
+    TEST_CHECK(n == 1000);
+    for(i = 0; i < 1000; i++)
+        TEST_CHECK(seen[i] == 1);
+
+    intmap_fini(&map);
+}
+
+
+TEST_LIST = {
+    { "empty",      test_empty },
+    { "insert",     test_insert },
+    { "remove",     test_remove },
+    { "reserve",    test_reserve },
+    { "iterate",    test_iterate },
+    { 0 }
+};
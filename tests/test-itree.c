@@ -0,0 +1,207 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2018-2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "acutest.h"
+#include "itree.h"
+
+
+#define N_INTERVALS     2000
+
+static ITREE_NODE nodes[N_INTERVALS];
+static int in_tree[N_INTERVALS];
+
+/* Pseudo-random but deterministic intervals. */
+static void
+make_intervals(ITREE* itree)
+{
+    unsigned seed = 12345;
+    int64_t start, len;
+    int i;
+
+    for(i = 0; i < N_INTERVALS; i++) {
+        seed = seed * 1103515245U + 12345U;
+        start = (seed >> 8) % 10000;
+        seed = seed * 1103515245U + 12345U;
+        len = (i % 10 == 0) ? (int64_t) ((seed >> 8) % 3000) : (int64_t) ((seed >> 8) % 30);
+        TEST_CHECK(itree_insert(itree, &nodes[i], start, start + len) == 0);
+        in_tree[i] = 1;
+    }
+}
+
+static size_t
+brute_force_count(int64_t lo, int64_t hi)
+{
+    size_t n = 0;
+    int i;
+
+    for(i = 0; i < N_INTERVALS; i++) {
+        if(in_tree[i]  &&  nodes[i].start <= hi  &&  lo <= nodes[i].end)
+            n++;
+    }
+    return n;
+}
+
+typedef struct CHECK_CTX {
+    int64_t lo;
+    int64_t hi;
+    int64_t last_start;
+    int broken;
+} CHECK_CTX;
+
+static int
+check_callback(ITREE_NODE* node, void* ctx_)
+{
+    CHECK_CTX* ctx = (CHECK_CTX*) ctx_;
+
+    if(node->start > ctx->hi  ||  node->end < ctx->lo  ||  node->start < ctx->last_start)
+        ctx->broken = 1;
+    if(!in_tree[node - nodes])
+        ctx->broken = 1;
+    ctx->last_start = node->start;
+    return 0;
+}
+
+static void
+check_queries(ITREE* itree)
+{
+    static const int64_t lens[] = { 0, 1, 17, 500 };
+    CHECK_CTX ctx;
+    int64_t lo;
+    int i;
+
+    for(lo = -100; lo < 11000; lo += 37) {
+        for(i = 0; i < (int) (sizeof(lens) / sizeof(lens[0])); i++) {
+            ctx.lo = lo;
+            ctx.hi = lo + lens[i];
+            ctx.last_start = INT64_MIN;
+            ctx.broken = 0;
+            if(!TEST_CHECK(itree_overlap(itree, ctx.lo, ctx.hi, check_callback, &ctx) ==
+                           brute_force_count(ctx.lo, ctx.hi)))
+            {
+                TEST_MSG("Query: [%d, %d]", (int) ctx.lo, (int) ctx.hi);
+                return;
+            }
+            if(!TEST_CHECK(!ctx.broken)) {
+                TEST_MSG("Query: [%d, %d]", (int) ctx.lo, (int) ctx.hi);
+                return;
+            }
+        }
+    }
+}
+
+
+static void
+test_empty(void)
+{
+    ITREE itree = ITREE_INITIALIZER;
+    ITREE_NODE node;
+
+    TEST_CHECK(itree_is_empty(&itree));
+    TEST_CHECK(itree_overlap(&itree, 0, 100, NULL, NULL) == 0);
+    TEST_CHECK(itree_insert(&itree, &node, 10, 5) == -1);
+    TEST_CHECK(itree_is_empty(&itree));
+}
+
+static void
+test_overlap(void)
+{
+    ITREE itree;
+
+    itree_init(&itree);
+    make_intervals(&itree);
+    check_queries(&itree);
+
+    while(itree_fini_step(&itree) != NULL)
+        ;
+    TEST_CHECK(itree_is_empty(&itree));
+}
+
+static void
+test_duplicates(void)
+{
+    ITREE itree = ITREE_INITIALIZER;
+    ITREE_NODE dups[10];
+    int i;
+
+    for(i = 0; i < 10; i++)
+        TEST_CHECK(itree_insert(&itree, &dups[i], 5, 7) == 0);
+    TEST_CHECK(itree_overlap(&itree, 7, 7, NULL, NULL) == 10);
+    TEST_CHECK(itree_overlap(&itree, 8, 100, NULL, NULL) == 0);
+
+    itree_remove(&itree, &dups[3]);
+    itree_remove(&itree, &dups[7]);
+    TEST_CHECK(itree_overlap(&itree, 0, 5, NULL, NULL) == 8);
+}
+
+static void
+test_remove(void)
+{
+    ITREE itree = ITREE_INITIALIZER;
+    int i;
+
+    make_intervals(&itree);
+
+    /* Remove all the long intervals and some of the short ones. */
+    for(i = 0; i < N_INTERVALS; i++) {
+        if(i % 10 == 0  ||  i % 7 == 0) {
+            itree_remove(&itree, &nodes[i]);
+            in_tree[i] = 0;
+        }
+    }
+    check_queries(&itree);
+
+    for(i = 0; i < N_INTERVALS; i++) {
+        if(in_tree[i]) {
+            itree_remove(&itree, &nodes[i]);
+            in_tree[i] = 0;
+        }
+    }
+    TEST_CHECK(itree_is_empty(&itree));
+}
+
+static int
+stop_callback(ITREE_NODE* node, void* ctx)
+{
+    return 1;
+}
+
+static void
+test_stop(void)
+{
+    ITREE itree = ITREE_INITIALIZER;
+
+    make_intervals(&itree);
+    TEST_CHECK(itree_overlap(&itree, 0, 10000, stop_callback, NULL) == 1);
+}
+
+
+TEST_LIST = {
+    { "empty",          test_empty },
+    { "overlap",        test_overlap },
+    { "duplicates",     test_duplicates },
+    { "remove",         test_remove },
+    { "stop",           test_stop },
+    { NULL, NULL }
+};
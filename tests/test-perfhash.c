@@ -0,0 +1,266 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2018-2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "acutest.h"
+#include "perfhash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+static void
+test_empty(void)
+{
+    PERFHASH ph;
+    void* blob;
+    size_t size;
+
+    TEST_CHECK(perfhash_build(NULL, 0, &blob, &size) == 0);
+    TEST_CHECK(perfhash_init(&ph, blob, size) == 0);
+    TEST_CHECK(perfhash_count(&ph) == 0);
+    TEST_CHECK(perfhash_lookup(&ph, "foo", 3) == PERFHASH_NOT_FOUND);
+    free(blob);
+}
+
+static void
+test_lookup(void)
+{
+    static const int N = 20000;
+    PERFHASH_KEY* keys;
+    char (*strings)[16];
+    char buffer[16];
+    PERFHASH ph;
+    void* blob;
+    size_t size;
+    int i;
+
+    keys = (PERFHASH_KEY*) malloc(N * sizeof(PERFHASH_KEY));
+    strings = malloc(N * sizeof(*strings));
+    TEST_ASSERT(keys != NULL  &&  strings != NULL);
+    for(i = 0; i < N; i++) {
+        snprintf(strings[i], 16, "key-%d", i);
+        keys[i].data = strings[i];
+        keys[i].size = strlen(strings[i]);
+    }
+
+    TEST_CHECK(perfhash_build(keys, N, &blob, &size) == 0);
+    TEST_ASSERT(perfhash_init(&ph, blob, size) == 0);
+    TEST_CHECK(perfhash_count(&ph) == (size_t) N);
+
+    for(i = 0; i < N; i++) {
+        TEST_CHECK(perfhash_lookup(&ph, strings[i], strlen(strings[i])) == (size_t) i);
+        TEST_MSG("Broken element: %d", i);
+    }
+    for(i = N; i < 2 * N; i++) {
+        snprintf(buffer, 16, "key-%d", i);
+        TEST_CHECK(perfhash_lookup(&ph, buffer, strlen(buffer)) == PERFHASH_NOT_FOUND);
+    }
+    TEST_CHECK(perfhash_lookup(&ph, "", 0) == PERFHASH_NOT_FOUND);
+    TEST_CHECK(perfhash_lookup(&ph, "key-1", 4) == PERFHASH_NOT_FOUND);
+
+    /* Blob does not depend on its address. */
+    {
+        void* copy = malloc(size);
+        PERFHASH ph2;
+
+        TEST_ASSERT(copy != NULL);
+        memcpy(copy, blob, size);
+        free(blob);
+        TEST_CHECK(perfhash_init(&ph2, copy, size) == 0);
+        for(i = 0; i < N; i++)
+            TEST_CHECK(perfhash_lookup(&ph2, strings[i], strlen(strings[i])) == (size_t) i);
+        free(copy);
+    }
+
+    free(strings);
+    free(keys);
+}
+
+static void
+test_duplicate(void)
+{
+    PERFHASH_KEY keys[3] = { { "foo", 3 }, { "bar", 3 }, { "foo", 3 } };
+    void* blob;
+    size_t size;
+
+    TEST_CHECK(perfhash_build(keys, 3, &blob, &size) != 0);
+}
+
+static void
+test_invalid(void)
+{
+    PERFHASH_KEY keys[2] = { { "foo", 3 }, { "bar", 3 } };
+    PERFHASH ph;
+    void* blob;
+    size_t size;
+
+    TEST_CHECK(perfhash_build(keys, 2, &blob, &size) == 0);
+    TEST_CHECK(perfhash_init(&ph, blob, size - 4) != 0);
+    TEST_CHECK(perfhash_init(&ph, blob, 8) != 0);
+    ((uint8_t*) blob)[0] ^= 0xff;
+    TEST_CHECK(perfhash_init(&ph, blob, size) != 0);
+    free(blob);
+}
+
+
+/* Count the keys which are not found (or found with a wrong index). Returns
+ * -1 if any index is out of range. */
+static int
+count_broken(const PERFHASH* ph, const PERFHASH_KEY* keys, int n)
+{
+    int n_broken = 0;
+    size_t index;
+    int i;
+
+    for(i = 0; i < n; i++) {
+        index = perfhash_lookup(ph, keys[i].data, keys[i].size);
+        if(index != PERFHASH_NOT_FOUND  &&  index >= (size_t) n)
+            return -1;
+        if(index != (size_t) i)
+            n_broken++;
+    }
+    return n_broken;
+}
+
+static void
+test_corrupted(void)
+{
+    PERFHASH_KEY keys[3] = { { "foo", 3 }, { "bar", 3 }, { "baz", 3 } };
+    PERFHASH ph;
+    void* blob;
+    size_t size;
+    uint32_t* slots;
+    uint32_t* record;
+    uint32_t off;
+    uint32_t i;
+
+    TEST_ASSERT(perfhash_build(keys, 3, &blob, &size) == 0);
+    TEST_ASSERT(perfhash_init(&ph, blob, size) == 0);
+    TEST_CHECK(count_broken(&ph, keys, 3) == 0);
+
+    /* perfhash_init() does not check the slots and key records (a record is
+     * the index and size of the key, both uint32_t), but the lookup must not
+     * read out of the blob because of them. */
+    slots = (uint32_t*) ph.slots;
+    for(i = 0; i < 3; i++) {
+        off = slots[i];
+        record = (uint32_t*) ((uint8_t*) blob + off);
+
+        slots[i] = (uint32_t) size;
+        TEST_CHECK(count_broken(&ph, keys, 3) == 1);
+        slots[i] = (uint32_t) size - 4;
+        TEST_CHECK(count_broken(&ph, keys, 3) == 1);
+        slots[i] = off + 2;
+        TEST_CHECK(count_broken(&ph, keys, 3) == 1);
+        slots[i] = off;
+
+        record[0] += 3;
+        TEST_CHECK(count_broken(&ph, keys, 3) == 1);
+        record[0] -= 3;
+
+        record[1] = UINT32_MAX;
+        TEST_CHECK(count_broken(&ph, keys, 3) == 1);
+        record[1] = 3;
+    }
+
+    TEST_CHECK(count_broken(&ph, keys, 3) == 0);
+    free(blob);
+}
+
+
+typedef struct VAL {
+    HTABLE_NODE the_node;
+    char key[16];
+} VAL;
+
+static uint32_t
+hash_func(const HTABLE_NODE* node)
+{
+    VAL* val = HTABLE_DATA(node, VAL, the_node);
+    const uint8_t* ptr = (const uint8_t*) val->key;
+    uint32_t fnv1a = 0;
+
+    while(*ptr) {
+        fnv1a ^= *ptr;
+        fnv1a *= 16777619;
+        ptr++;
+    }
+
+    return fnv1a;
+}
+
+static int
+cmp_func(const HTABLE_NODE* node1, const HTABLE_NODE* node2)
+{
+    return strcmp(HTABLE_DATA(node1, VAL, the_node)->key, HTABLE_DATA(node2, VAL, the_node)->key);
+}
+
+static void
+key_func(const HTABLE_NODE* node, PERFHASH_KEY* key)
+{
+    VAL* val = HTABLE_DATA(node, VAL, the_node);
+
+    key->data = val->key;
+    key->size = strlen(val->key);
+}
+
+static void
+test_htable(void)
+{
+    HTABLE htable = HTABLE_INITIALIZER;
+    VAL vals[1000];
+    HTABLE_NODE* nodes[1000];
+    PERFHASH ph;
+    void* blob;
+    size_t size;
+    int i;
+
+    for(i = 0; i < 1000; i++) {
+        snprintf(vals[i].key, 16, "%d", i * 7);
+        TEST_CHECK(htable_insert(&htable, &vals[i].the_node, cmp_func, hash_func) == 0);
+    }
+
+    TEST_CHECK(perfhash_build_htable(&htable, key_func, nodes, &blob, &size) == 0);
+    TEST_ASSERT(perfhash_init(&ph, blob, size) == 0);
+    for(i = 0; i < 1000; i++) {
+        size_t index = perfhash_lookup(&ph, vals[i].key, strlen(vals[i].key));
+        TEST_CHECK(index != PERFHASH_NOT_FOUND  &&  nodes[index] == &vals[i].the_node);
+        TEST_MSG("Broken element: %d", i);
+    }
+
+    free(blob);
+    htable_fini(&htable, NULL);
+}
+
+
+TEST_LIST = {
+    { "empty",      test_empty },
+    { "lookup",     test_lookup },
+    { "duplicate",  test_duplicate },
+    { "invalid",    test_invalid },
+    { "corrupted",  test_corrupted },
+    { "htable",     test_htable },
+    { 0 }
+};
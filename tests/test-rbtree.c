@@ -92,6 +92,26 @@ clear_tree(RBTREE* tree)
 }
 
 
+/* Variant of VAL for trees with RBTREE_ORDERSTAT. */
+typedef struct VALOS {
+    int x;
+    RBTREE_NODE_OS the_node;
+} VALOS;
+
+static int
+valos_cmp(const RBTREE_NODE* node1, const RBTREE_NODE* node2)
+{
+    const VALOS* val1 = RBTREE_DATA(node1, VALOS, the_node.node);
+    const VALOS* val2 = RBTREE_DATA(node2, VALOS, the_node.node);
+
+    if(val1->x < val2->x)
+        return -1;
+    if(val1->x > val2->x)
+        return +1;
+    return 0;
+}
+
+
 /*****************************
  ***   The test routines   ***
  *****************************/
@@ -199,6 +219,31 @@ test_insert_lookup(void)
     }
 }
 
+static void
+test_insert_or_get(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER;
+    RBTREE_NODE* nodes[100];
+    RBTREE_NODE* node;
+    int i;
+
+    for(i = 0; i < 100; i++) {
+        nodes[i] = make_val(i);
+        TEST_CHECK(rbtree_insert_or_get(&tree, nodes[i], val_cmp) == nodes[i]);
+    }
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+
+    /* Equal nodes are not inserted; the existing ones are returned instead. */
+    for(i = 0; i < 100; i++) {
+        node = make_val(i);
+        TEST_CHECK(rbtree_insert_or_get(&tree, node, val_cmp) == nodes[i]);
+        destroy_val(RBTREE_DATA(node, VAL, the_node));
+    }
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+
+    clear_tree(&tree);
+}
+
 static void
 test_remove(void)
 {
@@ -372,14 +417,758 @@ test_lookup_ex(void)
     clear_tree(&tree);
 }
 
+static void
+test_bounds(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER;
+    RBTREE_CURSOR cur;
+    RBTREE_NODE* node;
+    VAL key;
+    int i;
+
+    /* Multiples of 10: 0, 10, ..., 990. */
+    for(i = 0; i < 100; i++)
+        TEST_CHECK(rbtree_insert(&tree, make_val(10 * i), val_cmp) == 0);
+
+    for(i = -5; i < 1005; i++) {
+        int lower = (i <= 0) ? 0 : ((i + 9) / 10) * 10;
+        int upper = (i < 0) ? 0 : (i / 10 + 1) * 10;
+        int floor = (i < 0) ? -1 : (i / 10) * 10;
+
+        if(floor > 990)
+            floor = 990;
+
+        TEST_CASE_("key %d", i);
+        key.x = i;
+
+        node = rbtree_lower_bound(&tree, &key.the_node, val_cmp, &cur);
+        if(lower <= 990) {
+            TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VAL, the_node)->x == lower);
+            TEST_CHECK(rbtree_current(&cur) == node);
+        } else {
+            TEST_CHECK(node == NULL);
+            TEST_CHECK(rbtree_current(&cur) == NULL);
+        }
+        TEST_CHECK(rbtree_ceiling(&tree, &key.the_node, val_cmp, NULL) == node);
+
+        node = rbtree_upper_bound(&tree, &key.the_node, val_cmp, &cur);
+        if(upper <= 990)
+            TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VAL, the_node)->x == upper);
+        else
+            TEST_CHECK(node == NULL);
+
+        node = rbtree_floor(&tree, &key.the_node, val_cmp, &cur);
+        if(floor >= 0)
+            TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VAL, the_node)->x == floor);
+        else
+            TEST_CHECK(node == NULL);
+    }
+    TEST_CASE_(NULL);
+
+    /* Range scan of [125, 175). */
+    key.x = 125;
+    i = 130;
+    for(node = rbtree_lower_bound(&tree, &key.the_node, val_cmp, &cur);
+        node != NULL  &&  RBTREE_DATA(node, VAL, the_node)->x < 175;
+        node = rbtree_next(&cur))
+    {
+        TEST_CHECK(RBTREE_DATA(node, VAL, the_node)->x == i);
+        i += 10;
+    }
+    TEST_CHECK(i == 180);
+
+    /* Backward from the floor. */
+    key.x = 25;
+    node = rbtree_floor(&tree, &key.the_node, val_cmp, &cur);
+    TEST_CHECK(RBTREE_DATA(node, VAL, the_node)->x == 20);
+    node = rbtree_prev(&cur);
+    TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VAL, the_node)->x == 10);
+
+    clear_tree(&tree);
+
+    /* Empty tree. */
+    key.x = 10;
+    TEST_CHECK(rbtree_lower_bound(&tree, &key.the_node, val_cmp, &cur) == NULL);
+    TEST_CHECK(rbtree_current(&cur) == NULL);
+    TEST_CHECK(rbtree_floor(&tree, &key.the_node, val_cmp, NULL) == NULL);
+}
+
+static void
+test_build_sorted(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER;
+    RBTREE_NODE* nodes[1000];
+    RBTREE_CURSOR cur;
+    RBTREE_NODE* node;
+    VAL key;
+    int n, i;
+
+    for(n = 0; n <= 1000; n += (n < 40) ? 1 : 137) {
+        TEST_CASE_("%d nodes", n);
+
+        for(i = 0; i < n; i++)
+            nodes[i] = make_val(i);
+        TEST_CHECK(rbtree_build_sorted(&tree, nodes, n) == 0);
+        TEST_CHECK(rbtree_verify(&tree) == 0);
+
+        for(node = rbtree_head(&tree, &cur), i = 0; node != NULL; node = rbtree_next(&cur), i++)
+            TEST_CHECK(RBTREE_DATA(node, VAL, the_node)->x == i);
+        TEST_CHECK(i == n);
+
+        /* The tree is fully usable afterwards. */
+        TEST_CHECK(rbtree_insert(&tree, make_val(-1), val_cmp) == 0);
+        TEST_CHECK(rbtree_insert(&tree, make_val(n), val_cmp) == 0);
+        TEST_CHECK(rbtree_verify(&tree) == 0);
+        for(i = 0; i < n; i += 2) {
+            key.x = i;
+            destroy_val(RBTREE_DATA(rbtree_remove(&tree, &key.the_node, val_cmp), VAL, the_node));
+            TEST_CHECK(rbtree_verify(&tree) == 0);
+        }
+
+        /* Refuse building into a non-empty tree. */
+        TEST_CHECK(rbtree_build_sorted(&tree, nodes, 0) != 0);
+
+        clear_tree(&tree);
+    }
+    TEST_CASE_(NULL);
+}
+
+static void
+test_split_orderstat(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER_EX(RBTREE_ORDERSTAT);
+    RBTREE left, right;
+    VALOS* vals;
+    VALOS key, key2;
+    int i;
+
+    vals = (VALOS*) malloc(1000 * sizeof(VALOS));
+    TEST_ASSERT(vals != NULL);
+    for(i = 0; i < 1000; i++) {
+        vals[i].x = i;
+        TEST_CHECK(rbtree_insert(&tree, &vals[i].the_node.node, valos_cmp) == 0);
+    }
+
+    key.x = 400;
+    rbtree_split(&tree, &key.the_node.node, &left, &right, valos_cmp);
+    TEST_CHECK(rbtree_verify(&left) == 0);
+    TEST_CHECK(rbtree_verify(&right) == 0);
+    TEST_CHECK(rbtree_size(&left) == 400);
+    TEST_CHECK(rbtree_size(&right) == 600);
+
+    /* The key itself goes to the right part. Take it out to serve as the
+     * pivot for joining back. */
+    TEST_CHECK(rbtree_remove(&right, &key.the_node.node, valos_cmp) == &vals[400].the_node.node);
+
+    key.x = 450;
+    key2.x = 549;
+    TEST_CHECK(rbtree_remove_range(&right, &key.the_node.node, &key2.the_node.node, valos_cmp, NULL) == 100);
+    TEST_CHECK(rbtree_verify(&right) == 0);
+    TEST_CHECK(rbtree_size(&right) == 499);
+
+    rbtree_join(&left, &vals[400].the_node.node, &right);
+    TEST_CHECK(rbtree_verify(&left) == 0);
+    TEST_CHECK(rbtree_size(&left) == 900);
+    key.x = 600;
+    TEST_CHECK(rbtree_rank(&left, &key.the_node.node, valos_cmp) == 500);
+
+    free(vals);
+}
+
+static void
+test_build_sorted_orderstat(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER_EX(RBTREE_ORDERSTAT);
+    RBTREE_NODE* nodes[777];
+    VALOS* vals;
+    RBTREE_NODE* node;
+    int i;
+
+    vals = (VALOS*) malloc(777 * sizeof(VALOS));
+    TEST_ASSERT(vals != NULL);
+    for(i = 0; i < 777; i++) {
+        vals[i].x = i;
+        nodes[i] = &vals[i].the_node.node;
+    }
+
+    TEST_CHECK(rbtree_build_sorted(&tree, nodes, 777) == 0);
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+    TEST_CHECK(rbtree_size(&tree) == 777);
+    node = rbtree_select(&tree, 123, NULL);
+    TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VALOS, the_node.node)->x == 123);
+
+    free(vals);
+}
+
+/* Check the tree holds exactly the values from..(to-1) in the ascending order. */
+static int
+check_sequence(RBTREE* tree, int from, int to)
+{
+    RBTREE_CURSOR cur;
+    RBTREE_NODE* node;
+    int i = from;
+
+    for(node = rbtree_head(tree, &cur); node != NULL; node = rbtree_next(&cur)) {
+        if(RBTREE_DATA(node, VAL, the_node)->x != i)
+            return 0;
+        i++;
+    }
+    return (i == to);
+}
+
+static void
+test_join(void)
+{
+    static const int sizes[] = { 0, 1, 2, 3, 7, 10, 100, 1000 };
+    int i1, i2, i;
+
+    for(i1 = 0; i1 < (int) (sizeof(sizes) / sizeof(sizes[0])); i1++) {
+        for(i2 = 0; i2 < (int) (sizeof(sizes) / sizeof(sizes[0])); i2++) {
+            RBTREE tree1 = RBTREE_INITIALIZER;
+            RBTREE tree2 = RBTREE_INITIALIZER;
+            int n1 = sizes[i1];
+            int n2 = sizes[i2];
+
+            TEST_CASE_("%d + 1 + %d nodes", n1, n2);
+
+            for(i = 0; i < n1; i++)
+                rbtree_insert(&tree1, make_val(i), val_cmp);
+            for(i = 0; i < n2; i++)
+                rbtree_insert(&tree2, make_val(n1 + 1 + i), val_cmp);
+
+            rbtree_join(&tree1, make_val(n1), &tree2);
+            TEST_CHECK(rbtree_verify(&tree1) == 0);
+            TEST_CHECK(rbtree_is_empty(&tree2));
+            TEST_CHECK(check_sequence(&tree1, 0, n1 + 1 + n2));
+
+            clear_tree(&tree1);
+        }
+    }
+    TEST_CASE_(NULL);
+}
+
+static void
+test_split(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER;
+    RBTREE left, right;
+    RBTREE_CURSOR cur;
+    RBTREE_NODE* node;
+    VAL key;
+    int i;
+
+    for(i = -1; i <= 1001; i += 7) {
+        int j;
+
+        TEST_CASE_("split at %d", i);
+
+        /* Values 0, 2, ..., 998, so we split at present as well as at absent
+         * keys. */
+        for(j = 0; j < 500; j++)
+            rbtree_insert(&tree, make_val(2 * j), val_cmp);
+
+        key.x = i;
+        rbtree_split(&tree, &key.the_node, &left, &right, val_cmp);
+        TEST_CHECK(rbtree_is_empty(&tree));
+        TEST_CHECK(rbtree_verify(&left) == 0);
+        TEST_CHECK(rbtree_verify(&right) == 0);
+        node = rbtree_tail(&left, &cur);
+        TEST_CHECK(node == NULL  ||  RBTREE_DATA(node, VAL, the_node)->x < i);
+        node = rbtree_head(&right, &cur);
+        TEST_CHECK(node == NULL  ||  RBTREE_DATA(node, VAL, the_node)->x >= i);
+
+        /* Join them back, using the minimum of the right tree as the pivot. */
+        if(node != NULL)
+            rbtree_join(&left, rbtree_remove(&right, node, val_cmp), &right);
+        TEST_CHECK(rbtree_verify(&left) == 0);
+        for(j = 0; j < 500; j++) {
+            key.x = 2 * j;
+            TEST_CHECK(rbtree_lookup(&left, &key.the_node, val_cmp) != NULL);
+        }
+
+        clear_tree(&left);
+    }
+    TEST_CASE_(NULL);
+}
+
+static int n_removed;
+static int last_removed;
+
+static void
+remove_callback(RBTREE_NODE* node)
+{
+    VAL* val = RBTREE_DATA(node, VAL, the_node);
+
+    TEST_CHECK(val->x > last_removed);
+    last_removed = val->x;
+    n_removed++;
+    destroy_val(val);
+}
+
+static void
+test_remove_range(void)
+{
+    static const struct {
+        int lo;
+        int hi;
+        int n_removed;
+    } ranges[] = {
+        { 100, 199, 100 },
+        { -50, 9, 10 },
+        { 990, 2000, 10 },
+        { 500, 500, 1 },
+        { 600, 599, 0 },
+        { -10, 10000, 1000 }
+    };
+    RBTREE tree = RBTREE_INITIALIZER;
+    VAL lo, hi;
+    int r, i;
+
+    for(r = 0; r < (int) (sizeof(ranges) / sizeof(ranges[0])); r++) {
+        TEST_CASE_("range [%d, %d]", ranges[r].lo, ranges[r].hi);
+
+        for(i = 0; i < 1000; i++)
+            rbtree_insert(&tree, make_val(i), val_cmp);
+
+        lo.x = ranges[r].lo;
+        hi.x = ranges[r].hi;
+        n_removed = 0;
+        last_removed = -1000;
+        TEST_CHECK(rbtree_remove_range(&tree, &lo.the_node, &hi.the_node,
+                                       val_cmp, remove_callback) == (size_t) ranges[r].n_removed);
+        TEST_CHECK(n_removed == ranges[r].n_removed);
+        TEST_CHECK(rbtree_verify(&tree) == 0);
+
+        for(i = 0; i < 1000; i++) {
+            VAL key;
+            int expected = (i < ranges[r].lo  ||  i > ranges[r].hi);
+
+            key.x = i;
+            TEST_CHECK((rbtree_lookup(&tree, &key.the_node, val_cmp) != NULL) == expected);
+        }
+
+        clear_tree(&tree);
+    }
+    TEST_CASE_(NULL);
+}
+
+static unsigned n_cmp_calls;
+
+static int
+counting_val_cmp(const RBTREE_NODE* node1, const RBTREE_NODE* node2)
+{
+    n_cmp_calls++;
+    return val_cmp(node1, node2);
+}
+
+static void
+test_insert_hint(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER;
+    RBTREE_CURSOR cur = RBTREE_CURSOR_INITIALIZER;
+    RBTREE_NODE* node;
+    VAL key;
+    int i;
+
+    /* Appending in the ascending order. */
+    n_cmp_calls = 0;
+    for(i = 0; i < 10000; i++) {
+        node = make_val(i);
+        TEST_CHECK(rbtree_insert_hint(&tree, &cur, node, counting_val_cmp) == 0);
+        TEST_CHECK(rbtree_current(&cur) == node);
+    }
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+    TEST_CHECK(n_cmp_calls <= 3 * 10000);
+    TEST_MSG("n_cmp_calls: %u", n_cmp_calls);
+    TEST_CHECK(check_sequence(&tree, 0, 10000));
+
+    /* The cursor is valid for walking. */
+    TEST_CHECK(rbtree_next(&cur) == NULL);
+    node = rbtree_prev(&cur);
+    TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VAL, the_node)->x == 9998);
+
+    /* Duplicate. */
+    key.x = 5000;
+    TEST_CHECK(rbtree_insert_hint(&tree, &cur, &key.the_node, val_cmp) != 0);
+    node = rbtree_current(&cur);
+    TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VAL, the_node)->x == 5000);
+
+    /* Near-sorted: fill the odd numbers in, in a slightly shuffled order. */
+    clear_tree(&tree);
+    cur.n = 0;
+    for(i = 0; i < 2000; i += 2)
+        TEST_CHECK(rbtree_insert_hint(&tree, &cur, make_val(i), val_cmp) == 0);
+    for(i = 1; i < 2000; i += 4) {
+        TEST_CHECK(rbtree_insert_hint(&tree, &cur, make_val(i + 2), val_cmp) == 0);
+        TEST_CHECK(rbtree_insert_hint(&tree, &cur, make_val(i), val_cmp) == 0);
+        TEST_CHECK(rbtree_verify(&tree) == 0);
+    }
+    TEST_CHECK(check_sequence(&tree, 0, 2000));
+
+    clear_tree(&tree);
+}
+
+static void
+test_lookup_from(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER;
+    RBTREE_CURSOR cur = RBTREE_CURSOR_INITIALIZER;
+    RBTREE_NODE* node;
+    VAL key;
+    int i;
+
+    for(i = 0; i < 10000; i++)
+        TEST_CHECK(rbtree_insert(&tree, make_val(2 * i), val_cmp) == 0);
+
+    /* Walk over the tree in small steps. */
+    rbtree_head(&tree, &cur);
+    n_cmp_calls = 0;
+    for(i = 0; i < 20000; i += 3) {
+        key.x = i;
+        node = rbtree_lookup_from(&cur, &key.the_node, counting_val_cmp);
+        if(i % 2 == 0) {
+            TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VAL, the_node)->x == i);
+            TEST_CHECK(rbtree_current(&cur) == node);
+        } else {
+            TEST_CHECK(node == NULL);
+            TEST_CHECK(rbtree_current(&cur) != NULL);
+        }
+    }
+    /* A search from the root would need about log2(10000) = 13 comparisons. */
+    TEST_CHECK(n_cmp_calls <= 8 * (20000 / 3 + 1));
+    TEST_MSG("n_cmp_calls: %u", n_cmp_calls);
+
+    /* Long jumps in both directions. */
+    key.x = 2;
+    TEST_CHECK(rbtree_lookup_from(&cur, &key.the_node, val_cmp) != NULL);
+    key.x = 19998;
+    TEST_CHECK(rbtree_lookup_from(&cur, &key.the_node, val_cmp) != NULL);
+    key.x = 0;
+    TEST_CHECK(rbtree_lookup_from(&cur, &key.the_node, val_cmp) != NULL);
+    TEST_CHECK(rbtree_prev(&cur) == NULL);
+
+    /* Cursor pointing to nowhere. */
+    cur.n = 0;
+    TEST_CHECK(rbtree_lookup_from(&cur, &key.the_node, val_cmp) == NULL);
+
+    clear_tree(&tree);
+}
+
+static void
+test_orderstat(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER_EX(RBTREE_ORDERSTAT);
+    VALOS* vals;
+    VALOS key, key2;
+    RBTREE_CURSOR cur;
+    RBTREE_NODE* node;
+    int i;
+
+    vals = (VALOS*) malloc(1000 * sizeof(VALOS));
+    TEST_ASSERT(vals != NULL);
+
+    TEST_CHECK(rbtree_size(&tree) == 0);
+    TEST_CHECK(rbtree_select(&tree, 0, NULL) == NULL);
+
+    /* Insert all the even numbers 0, 2, ..., 1998 in a scrambled order. */
+    for(i = 0; i < 1000; i++) {
+        vals[i].x = 2 * ((i * 337) % 1000);
+        TEST_CHECK(rbtree_insert(&tree, &vals[i].the_node.node, valos_cmp) == 0);
+    }
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+    TEST_CHECK(rbtree_size(&tree) == 1000);
+
+    for(i = 0; i < 1000; i++) {
+        node = rbtree_select(&tree, i, NULL);
+        TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VALOS, the_node.node)->x == 2 * i);
+        TEST_MSG("Broken element: %d", i);
+    }
+    TEST_CHECK(rbtree_select(&tree, 1000, NULL) == NULL);
+
+    /* The cursor continues from the selected node. */
+    node = rbtree_select(&tree, 500, &cur);
+    TEST_CHECK(rbtree_current(&cur) == node);
+    node = rbtree_next(&cur);
+    TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VALOS, the_node.node)->x == 1002);
+
+    key.x = 1000;       /* Present. */
+    TEST_CHECK(rbtree_rank(&tree, &key.the_node.node, valos_cmp) == 500);
+    key.x = 1001;       /* Not present. */
+    TEST_CHECK(rbtree_rank(&tree, &key.the_node.node, valos_cmp) == 501);
+    key.x = -1;
+    TEST_CHECK(rbtree_rank(&tree, &key.the_node.node, valos_cmp) == 0);
+    key.x = 5000;
+    TEST_CHECK(rbtree_rank(&tree, &key.the_node.node, valos_cmp) == 1000);
+
+    key.x = 10;
+    key2.x = 20;
+    TEST_CHECK(rbtree_count_range(&tree, &key.the_node.node, &key2.the_node.node, valos_cmp) == 6);
+    key.x = 11;
+    key2.x = 19;
+    TEST_CHECK(rbtree_count_range(&tree, &key.the_node.node, &key2.the_node.node, valos_cmp) == 4);
+    TEST_CHECK(rbtree_count_range(&tree, &key2.the_node.node, &key.the_node.node, valos_cmp) == 0);
+
+    /* Remove every third node and check the sizes are still maintained. */
+    for(i = 0; i < 1000; i += 3) {
+        key.x = 2 * i;
+        TEST_CHECK(rbtree_remove(&tree, &key.the_node.node, valos_cmp) != NULL);
+    }
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+    TEST_CHECK(rbtree_size(&tree) == 666);
+    key.x = 2 * 998;
+    TEST_CHECK(rbtree_rank(&tree, &key.the_node.node, valos_cmp) == 665);
+    node = rbtree_select(&tree, 0, NULL);
+    TEST_CHECK(node != NULL  &&  RBTREE_DATA(node, VALOS, the_node.node)->x == 2);
+
+    while(!rbtree_is_empty(&tree)) {
+        TEST_CHECK(rbtree_remove(&tree, tree.root, valos_cmp) != NULL);
+        TEST_CHECK(rbtree_verify(&tree) == 0);
+    }
+    TEST_CHECK(rbtree_size(&tree) == 0);
+
+    free(vals);
+}
+
+/* Payload structure for trees with RBTREE_PARENT. */
+typedef struct VALP {
+    int x;
+    RBTREE_NODE_P the_node;
+} VALP;
+
+static int
+valp_cmp(const RBTREE_NODE* node1, const RBTREE_NODE* node2)
+{
+    const VALP* val1 = RBTREE_DATA(node1, VALP, the_node.node);
+    const VALP* val2 = RBTREE_DATA(node2, VALP, the_node.node);
+
+    if(val1->x < val2->x)
+        return -1;
+    if(val1->x > val2->x)
+        return +1;
+    return 0;
+}
+
+static void
+test_parent(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER_EX(RBTREE_PARENT);
+    RBTREE left, right;
+    RBTREE_NODE* nodes[1000];
+    VALP* vals;
+    VALP key;
+    RBTREE_NODE* node;
+    RBTREE_NODE* next;
+    int i;
+
+    vals = (VALP*) malloc(1000 * sizeof(VALP));
+    TEST_ASSERT(vals != NULL);
+
+    /* Insert 0, ..., 999 in a scrambled order. */
+    for(i = 0; i < 1000; i++) {
+        vals[i].x = (i * 337) % 1000;
+        TEST_CHECK(rbtree_insert(&tree, &vals[i].the_node.node, valp_cmp) == 0);
+    }
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+
+    /* Walk forward and backward without any cursor. */
+    i = 0;
+    for(node = rbtree_first(&tree); node != NULL; node = rbtree_next_node(node)) {
+        if(!TEST_CHECK(RBTREE_DATA(node, VALP, the_node.node)->x == i))
+            break;
+        i++;
+    }
+    TEST_CHECK(i == 1000);
+    for(node = rbtree_last(&tree); node != NULL; node = rbtree_prev_node(node)) {
+        i--;
+        if(!TEST_CHECK(RBTREE_DATA(node, VALP, the_node.node)->x == i))
+            break;
+    }
+    TEST_CHECK(i == 0);
+
+    /* Remove every odd number by the node, while walking over the tree. */
+    for(node = rbtree_first(&tree); node != NULL; node = next) {
+        next = rbtree_next_node(node);
+        if(RBTREE_DATA(node, VALP, the_node.node)->x % 2 != 0)
+            rbtree_remove_node(&tree, node);
+    }
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+    i = 0;
+    for(node = rbtree_first(&tree); node != NULL; node = rbtree_next_node(node)) {
+        if(!TEST_CHECK(RBTREE_DATA(node, VALP, the_node.node)->x == i))
+            break;
+        i += 2;
+    }
+    TEST_CHECK(i == 1000);
+
+    /* Parent links survive split and join. */
+    key.x = 500;
+    rbtree_split(&tree, &key.the_node.node, &left, &right, valp_cmp);
+    TEST_CHECK(rbtree_verify(&left) == 0);
+    TEST_CHECK(rbtree_verify(&right) == 0);
+    node = rbtree_first(&right);
+    rbtree_remove_node(&right, node);
+    rbtree_join(&left, node, &right);
+    TEST_CHECK(rbtree_verify(&left) == 0);
+
+    /* Remove all the rest by the nodes. */
+    while(!rbtree_is_empty(&left)) {
+        rbtree_remove_node(&left, rbtree_last(&left));
+        TEST_CHECK(rbtree_verify(&left) == 0);
+    }
+    TEST_CHECK(rbtree_first(&left) == NULL);
+
+    /* Bulk construction. */
+    for(i = 0; i < 1000; i++) {
+        vals[i].x = i;
+        nodes[i] = &vals[i].the_node.node;
+    }
+    rbtree_init_ex(&tree, RBTREE_PARENT);
+    TEST_CHECK(rbtree_build_sorted(&tree, nodes, 1000) == 0);
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+    for(i = 0; i < 1000; i += 7)
+        rbtree_remove_node(&tree, nodes[i]);
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+    TEST_CHECK(rbtree_next_node(nodes[1]) == nodes[2]);
+    TEST_CHECK(rbtree_next_node(nodes[6]) == nodes[8]);
+    TEST_CHECK(rbtree_prev_node(nodes[8]) == nodes[6]);
+
+    free(vals);
+}
+
+/* Payload structure for augmented trees: Every node keeps sum of x over its
+ * subtree. */
+typedef struct VALA {
+    int x;
+    long sum;
+    RBTREE_NODE the_node;
+} VALA;
+
+static int
+vala_cmp(const RBTREE_NODE* node1, const RBTREE_NODE* node2)
+{
+    const VALA* val1 = RBTREE_DATA(node1, VALA, the_node);
+    const VALA* val2 = RBTREE_DATA(node2, VALA, the_node);
+
+    if(val1->x < val2->x)
+        return -1;
+    if(val1->x > val2->x)
+        return +1;
+    return 0;
+}
+
+static int n_augment_calls;
+
+static void
+vala_augment(RBTREE_NODE* node)
+{
+    VALA* val = RBTREE_DATA(node, VALA, the_node);
+
+    val->sum = val->x;
+    if(rbtree_left(node) != NULL)
+        val->sum += RBTREE_DATA(rbtree_left(node), VALA, the_node)->sum;
+    if(rbtree_right(node) != NULL)
+        val->sum += RBTREE_DATA(rbtree_right(node), VALA, the_node)->sum;
+    n_augment_calls++;
+}
+
+/* Check all the sums in the subtree. Returns the sum, or -1 on an error. */
+static long
+check_sums(RBTREE_NODE* node)
+{
+    long left_sum, right_sum;
+
+    if(node == NULL)
+        return 0;
+
+    left_sum = check_sums(rbtree_left(node));
+    right_sum = check_sums(rbtree_right(node));
+    if(left_sum < 0  ||  right_sum < 0)
+        return -1;
+    if(RBTREE_DATA(node, VALA, the_node)->sum != left_sum + right_sum + RBTREE_DATA(node, VALA, the_node)->x)
+        return -1;
+    return RBTREE_DATA(node, VALA, the_node)->sum;
+}
+
+static void
+test_augment(void)
+{
+    RBTREE tree = RBTREE_INITIALIZER_AUGMENTED(0, vala_augment);
+    RBTREE left, right;
+    RBTREE_NODE* nodes[1000];
+    VALA* vals;
+    VALA key;
+    RBTREE_NODE* pivot;
+    int i;
+
+    vals = (VALA*) malloc(1000 * sizeof(VALA));
+    TEST_ASSERT(vals != NULL);
+
+    /* Insert 1, ..., 1000 in a scrambled order. */
+    for(i = 0; i < 1000; i++) {
+        vals[i].x = 1 + (i * 337) % 1000;
+        TEST_CHECK(rbtree_insert(&tree, &vals[i].the_node, vala_cmp) == 0);
+    }
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+    TEST_CHECK(check_sums(tree.root) == 500500);
+
+    /* The re-balancing touches only few nodes, so the count of the calls is
+     * dominated by the insertion paths. */
+    TEST_CHECK(n_augment_calls < 1000 * 20);
+    TEST_MSG("Augment calls: %d", n_augment_calls);
+
+    /* Remove all the numbers divisible by 3. */
+    for(i = 3; i <= 1000; i += 3) {
+        key.x = i;
+        TEST_CHECK(rbtree_remove(&tree, &key.the_node, vala_cmp) != NULL);
+    }
+    TEST_CHECK(rbtree_verify(&tree) == 0);
+    TEST_CHECK(check_sums(tree.root) == 500500 - 3 * (333 * 334 / 2));
+
+    /* Split and join. */
+    key.x = 500;
+    rbtree_split(&tree, &key.the_node, &left, &right, vala_cmp);
+    TEST_CHECK(check_sums(left.root) >= 0);
+    TEST_CHECK(check_sums(right.root) >= 0);
+    key.x = 500;
+    pivot = rbtree_remove(&right, &key.the_node, vala_cmp);
+    TEST_ASSERT(pivot != NULL);
+    rbtree_join(&left, pivot, &right);
+    TEST_CHECK(rbtree_verify(&left) == 0);
+    TEST_CHECK(check_sums(left.root) == 500500 - 3 * (333 * 334 / 2));
+
+    /* Bulk construction. */
+    for(i = 0; i < 1000; i++) {
+        vals[i].x = i + 1;
+        nodes[i] = &vals[i].the_node;
+    }
+    rbtree_init_augmented(&tree, 0, vala_augment);
+    TEST_CHECK(rbtree_build_sorted(&tree, nodes, 1000) == 0);
+    TEST_CHECK(check_sums(tree.root) == 500500);
+
+    free(vals);
+}
+
 
 TEST_LIST = {
     { "empty",              test_empty },
     { "fini",               test_fini },
     { "insert-and-lookup",  test_insert_lookup },
+    { "insert-or-get",      test_insert_or_get },
     { "remove",             test_remove },
     { "walk-forward",       test_walk_forward },
     { "walk-backward",      test_walk_backward },
     { "lookup-ex",          test_lookup_ex },
+    { "bounds",             test_bounds },
+    { "build-sorted",       test_build_sorted },
+    { "build-sorted-orderstat", test_build_sorted_orderstat },
+    { "split-orderstat",    test_split_orderstat },
+    { "join",               test_join },
+    { "split",              test_split },
+    { "remove-range",       test_remove_range },
+    { "insert-hint",        test_insert_hint },
+    { "lookup-from",        test_lookup_from },
+    { "orderstat",          test_orderstat },
+    { "parent",             test_parent },
+    { "augment",            test_augment },
     { NULL, NULL }
 };
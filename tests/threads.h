@@ -0,0 +1,63 @@
+/*
+ * C Reusables
+ * <http://github.com/mity/c-reusables>
+ *
+ * Copyright (c) 2023 Martin Mitáš
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Minimal threading wrappers for the tests and benchmarks which need more
+ * threads. Only what they actually use is provided.
+ */
+
+#ifndef CRE_TESTS_THREADS_H
+#define CRE_TESTS_THREADS_H
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
+
+#ifdef _WIN32
+    typedef HANDLE THREAD;
+    typedef CRITICAL_SECTION MUTEX;
+    #define THREAD_FUNC_RET             DWORD WINAPI
+    #define mutex_init(m)               InitializeCriticalSection(m)
+    #define mutex_fini(m)               DeleteCriticalSection(m)
+    #define mutex_lock(m)               EnterCriticalSection(m)
+    #define mutex_unlock(m)             LeaveCriticalSection(m)
+    #define thread_create(t, func, arg) ((*(t) = CreateThread(NULL, 0, (func), (arg), 0, NULL)) != NULL ? 0 : -1)
+    #define thread_join(t)              do { WaitForSingleObject((t), INFINITE); CloseHandle(t); } while(0)
+#else
+    typedef pthread_t THREAD;
+    typedef pthread_mutex_t MUTEX;
+    #define THREAD_FUNC_RET             void*
+    #define mutex_init(m)               pthread_mutex_init((m), NULL)
+    #define mutex_fini(m)               pthread_mutex_destroy(m)
+    #define mutex_lock(m)               pthread_mutex_lock(m)
+    #define mutex_unlock(m)             pthread_mutex_unlock(m)
+    #define thread_create(t, func, arg) pthread_create((t), NULL, (func), (arg))
+    #define thread_join(t)              pthread_join((t), NULL)
+#endif
+
+
+#endif  /* #ifndef CRE_TESTS_THREADS_H */